@@ -275,13 +275,8 @@ namespace fire
 
         bool conversation::send(const message::message& m)
         {
-            bool sent = false;
-            for(auto c : _contacts.list())
-            {
-                CHECK(c);
-                sent |= send(c->id(), m); 
-            }
-            return sent;
+            INVARIANT(_sender);
+            return _sender->send(_contacts, m);
         }
     }
 }
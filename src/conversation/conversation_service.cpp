@@ -394,11 +394,7 @@ namespace fire
             ns.conversation_id = s->second->id(); 
             auto m = ns.to_message();
 
-            for(auto c : s->second->contacts().list())
-            {
-                CHECK(c);
-                _sender->send(c->id(), m);
-            }
+            _sender->send(s->second->contacts(), m);
 
             //remove conversation from map
             _conversations.erase(s);
@@ -436,12 +432,9 @@ namespace fire
             ns.contacts = contacts;
             ns.apps = apps;
             auto m = ns.to_message();
+            m.meta.priority = m::metadata::control;
 
-            for(auto c : s->contacts().list())
-            {
-                CHECK(c);
-                _sender->send(c->id(), m);
-            }
+            _sender->send(s->contacts(), m);
         }
 
         void conversation_service::sync_existing_conversation(const std::string& conversation_id)
@@ -485,11 +478,7 @@ namespace fire
             r.conversation_id = s->id();
             auto m = r.to_message();
 
-            for(auto c : s->contacts().list())
-            {
-                CHECK(c);
-                _sender->send(c->id(), m);
-            }
+            _sender->send(s->contacts(), m);
         }
 
         void conversation_service::add_contact_to_conversation_p( 
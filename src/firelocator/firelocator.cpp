@@ -60,7 +60,6 @@ namespace sc = fire::security;
 
 namespace
 {
-    const size_t THREAD_SLEEP = 100; //in milliseconds
     const size_t POOL_SIZE = 10; //small pool size for now
 }
 
@@ -332,11 +331,7 @@ int main(int argc, char *argv[])
     try
     {
         n::endpoint ep;
-        if(!con.receive(ep, data))
-        {
-            u::sleep_thread(THREAD_SLEEP);
-            continue;
-        }
+        if(!con.receive(ep, data, true)) continue;
 
         //decrypt message
         auto sid = n::make_address_str(ep);
@@ -344,9 +339,9 @@ int main(int argc, char *argv[])
         data = sec.decrypt(sid, data, et);
         data = u::uncompress(data);
 
-        //parse message
+        //parse message, in either mencode version
         m::message m;
-        u::decode(data, m);
+        m::decode_message(data, m);
 
         if(m.meta.type == ms::GREET_REGISTER)
         {
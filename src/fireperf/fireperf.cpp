@@ -30,7 +30,9 @@
  */
 
 #include <string>
+#include <atomic>
 #include <cstdlib>
+#include <new>
 #include <fstream>
 #include <termios.h>
 #include <chrono>
@@ -40,11 +42,22 @@
 #include <boost/filesystem.hpp>
 
 #include "network/connection_manager.hpp"
+#include "network/tcp_queue.hpp"
 #include "message/message.hpp"
+#include "message/message_view.hpp"
+#include "message/post_office.hpp"
+#include "message/master_post.hpp"
+#include "message/send_scheduler.hpp"
 #include "messages/greeter.hpp"
+#include "security/security.hpp"
 #include "util/bytes.hpp"
+#include "util/crstring.hpp"
+#include "util/crtext.hpp"
 #include "util/dbc.hpp"
+#include "util/disk_store.hpp"
 #include "util/log.hpp"
+#include "util/ring_queue.hpp"
+#include "util/thread.hpp"
 
 namespace po = boost::program_options;
 namespace ip = boost::asio::ip;
@@ -53,6 +66,7 @@ namespace n = fire::network;
 namespace m = fire::message;
 namespace ms = fire::messages;
 namespace u = fire::util;
+namespace sc = fire::security;
 
 namespace
 {
@@ -60,9 +74,23 @@ namespace
     const size_t POOL_SIZE = 1; //small pool size for now
     n::port_type SRC_PORT = 7170;
     n::port_type DST_PORT = 7171;
+    n::port_type EXTRA_SRC_PORT = 7200; //senders after the first count up from here
     const std::string DST_ADDR = "udp://localhost:7171";
+    const size_t CLOCK_ENTRIES = 8; //contacts in a payload's vector clock
+
+    std::atomic<size_t> allocations{0}; //counted by operator new below
 }
 
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(auto p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 po::options_description create_descriptions()
 {
     po::options_description d{"Options"};
@@ -73,7 +101,23 @@ po::options_description create_descriptions()
         ("help", "prints help")
         ("messages", po::value<int>()->default_value(100000), "Number of messages")
         ("robust", po::value<bool>()->default_value(true), "Are messages robust?")
-        ("size", po::value<int>()->default_value(512), "Message size in bytes");
+        ("size", po::value<int>()->default_value(512), "Message size in bytes")
+        ("concurrent", po::value<int>()->default_value(1), "Messages sent before waiting for them to arrive")
+        ("batch", po::value<int>()->default_value(0), "Datagrams per sendmmsg/recvmmsg, 0 disables batching")
+        ("mtu", po::value<int>()->default_value(0), "Largest UDP packet to probe for, 512 disables probing")
+        ("shards", po::value<int>()->default_value(1), "UDP sockets the receiver spreads peers over, each on its own thread")
+        ("senders", po::value<int>()->default_value(1), "Sockets sending to the receiver, messages are spread over them")
+        ("idle", po::value<int>()->default_value(0), "Milliseconds idle before each message. Measures idle to first byte latency instead of throughput")
+        ("crypto", po::value<int>()->default_value(0), "Threads encrypting and decrypting on their own channels. Measures crypto throughput instead of the network")
+        ("tcp", po::value<bool>()->default_value(false), "Send over one tcp connection instead of udp")
+        ("legacy", po::value<bool>()->default_value(false), "Use the old text tcp framing instead of binary frames")
+        ("queues", po::value<int>()->default_value(0), "Producer threads pushing into one consumer. Compares util::queue with the lock free rings instead of the network")
+        ("schedule", po::value<bool>()->default_value(false), "Queue a bulk transfer, a ping and a chat message to three peers. Compares the bytes sent ahead of the small ones with a fifo and the send scheduler")
+        ("post", po::value<int>()->default_value(0), "Pipeline threads in each master post office. Sends encrypted messages end to end between master post offices, one per sender, instead of raw udp")
+        ("group", po::value<int>()->default_value(0), "Members in a group. Sends every message to each member, one copy per member and then as one group message encrypted once")
+        ("store", po::value<int>()->default_value(0), "Keys to set, overwrite and get in a disk_store. Measures store throughput instead of the network")
+        ("text", po::value<int>()->default_value(0), "Size of a shared document in bytes. Two replicas type into it at the same time, messages is the number of edits. Compares cr_string merges with cr_text ops")
+        ("mencode", po::value<bool>()->default_value(false), "Encodes and decodes messages with text and binary mencode instead of sending them. Also counts allocations in a full round trip");
 
     return d;
 }
@@ -87,6 +131,692 @@ po::variables_map parse_options(int argc, char* argv[], po::options_description&
     return v;
 }
 
+using latency_clock = std::chrono::steady_clock;
+
+struct latency
+{
+    double min = 0;
+    double max = 0;
+    double total = 0;
+    size_t count = 0;
+
+    void add(latency_clock::time_point start)
+    {
+        double ms = std::chrono::duration<double, std::milli>(latency_clock::now() - start).count();
+        min = count == 0 ? ms : std::min(min, ms);
+        max = std::max(max, ms);
+        total += ms;
+        count++;
+    }
+};
+
+void print_latency(const std::string& name, const latency& l)
+{
+    if(l.count == 0) return;
+    std::cout << name << " latency min: " << l.min << "ms avg: " << (l.total / l.count) << "ms max: " << l.max << "ms" << std::endl;
+}
+
+latency udp_idle_latency(
+        n::connection_manager& src, 
+        n::connection_manager& dst, 
+        const u::bytes& data, 
+        bool robust, 
+        size_t idle, 
+        int iterations)
+{
+    latency l;
+    n::endpoint ep;
+    u::bytes got_data;
+    for(int i = 0; i < iterations; i++)
+    {
+        u::sleep_thread(idle);
+
+        auto start = latency_clock::now();
+        src.send(DST_ADDR, data, robust);
+        if(!dst.receive(ep, got_data, true)) break;
+        l.add(start);
+
+        CHECK(got_data == data);
+    }
+    return l;
+}
+
+latency post_idle_latency(const u::bytes& data, size_t idle, int iterations)
+{
+    auto office = std::make_shared<m::post_office>("perf");
+    auto from = std::make_shared<m::mailbox>("from");
+    auto to = std::make_shared<m::mailbox>("to");
+    office->add(from);
+    office->add(to);
+
+    latency l;
+    for(int i = 0; i < iterations; i++)
+    {
+        u::sleep_thread(idle);
+
+        m::message msg;
+        msg.meta.type = "perf";
+        msg.meta.to = {"to"};
+        msg.data = data;
+
+        auto start = latency_clock::now();
+        from->push_outbox(msg);
+        if(!to->pop_inbox(msg, true)) break;
+        l.add(start);
+    }
+    return l;
+}
+
+//each thread gets its own channel, like peers on different crypto workers
+void crypto_thread(const u::bytes* data, int iterations)
+{
+    REQUIRE(data);
+
+    sc::dh_secret a, b;
+    a.create_symmetric_key(b.public_value());
+    b.create_symmetric_key(a.public_value());
+
+    for(int i = 0; i < iterations; i++)
+    {
+        auto e = a.encrypt(*data);
+        auto d = b.decrypt(e);
+        CHECK(d == *data);
+    }
+}
+
+void crypto_throughput(const u::bytes& data, int threads, int iterations)
+{
+    REQUIRE_GREATER(threads, 0);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> ts;
+    for(int i = 0; i < threads; i++) ts.emplace_back(crypto_thread, &data, iterations);
+    for(auto& t : ts) t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    const double total = static_cast<double>(data.size()) * iterations * threads;
+    std::cout << "crypto threads: " << threads << " messages: " << iterations * threads << " time: " << diff.count() << "s" << std::endl;
+    std::cout << "crypto throughput: " << (total / diff.count() / (1024*1024)) << " MB/s" << std::endl;
+}
+
+void tcp_throughput(const u::bytes& data, int iterations, bool legacy)
+{
+    n::queue_options in_options = {{"bnd", "1"}, {"block", "1"}};
+    n::queue_options out_options = {{"block", "0"}, {"legacy_framing", legacy ? "1" : "0"}};
+
+    auto in = n::create_tcp_queue(n::make_tcp_address("*", DST_PORT), in_options);
+    auto out = n::create_tcp_queue(n::make_tcp_address("127.0.0.1", DST_PORT), out_options);
+
+    //wait for the connection and give the peers time to say hello
+    while(!out->is_connected()) u::sleep_thread(THREAD_SLEEP);
+    u::sleep_thread(THREAD_SLEEP);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for(int i = 0; i < iterations; i++) out->send(data);
+
+    u::bytes got_data;
+    int got = 0;
+    while(got < iterations && in->receive(got_data))
+    {
+        CHECK_EQUAL(got_data.size(), data.size());
+        got++;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    const double total = static_cast<double>(data.size()) * got;
+    std::cout << "tcp framing: " << (legacy ? "legacy" : "binary") << " messages: " << got << " time: " << diff.count() << "s" << std::endl;
+    std::cout << "tcp throughput: " << (total / diff.count() / (1024*1024)) << " MB/s" << std::endl;
+}
+
+template<class q_type>
+void push_items(q_type* q, int items)
+{
+    REQUIRE(q);
+    for(int i = 0; i < items; i++) q->push(i);
+}
+
+template<class q_type>
+void queue_contention(const std::string& name, int producers, int iterations)
+{
+    REQUIRE_GREATER(producers, 0);
+
+    q_type q;
+    const int per_producer = iterations / producers;
+    const int total = per_producer * producers;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> ts;
+    for(int p = 0; p < producers; p++) ts.emplace_back(push_items<q_type>, &q, per_producer);
+
+    int got = 0;
+    int v = 0;
+    while(got < total && q.pop(v, true)) got++;
+    for(auto& t : ts) t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    std::cout << name << " producers: " << producers << " items: " << got << " time: " << diff.count() << "s rate: " << (got / diff.count() / 1e6) << " M/s" << std::endl;
+}
+
+void queue_contention(int producers, int iterations)
+{
+    queue_contention<u::queue<int>>("util::queue", producers, iterations);
+    queue_contention<u::mpsc_queue<int>>("mpsc_queue", producers, iterations);
+    if(producers == 1) queue_contention<u::spsc_queue<int>>("spsc_queue", producers, iterations);
+}
+
+template<class q_type>
+void schedule_order(const std::string& name, const u::bytes& data, int iterations)
+{
+    q_type q;
+
+    m::message bulk;
+    bulk.meta.to = {"udp://10.0.0.1:7171"};
+    bulk.data = data;
+    for(int i = 0; i < iterations; i++) q.push(bulk);
+
+    m::message ping;
+    ping.meta.to = {"udp://10.0.0.2:7171"};
+    ping.meta.priority = m::metadata::control;
+    q.push(ping);
+
+    m::message chat;
+    chat.meta.to = {"udp://10.0.0.3:7171"};
+    chat.data = u::to_bytes(std::string(64, 'c'));
+    q.push(chat);
+
+    size_t bytes = 0;
+    size_t before_ping = 0;
+    size_t before_chat = 0;
+    m::message got;
+    while(q.pop(got))
+    {
+        if(got.meta.to == ping.meta.to) before_ping = bytes;
+        else if(got.meta.to == chat.meta.to) before_chat = bytes;
+        bytes += got.data.size();
+    }
+
+    std::cout << name << " bytes sent before ping: " << before_ping << " before chat: " << before_chat << std::endl;
+}
+
+void schedule_order(const u::bytes& data, int iterations)
+{
+    schedule_order<u::queue<m::message>>("fifo", data, iterations);
+    schedule_order<m::send_scheduler>("send_scheduler", data, iterations);
+}
+
+void mencode_speed(const m::message& msg, int version, int iterations)
+{
+    REQUIRE_GREATER(iterations, 0);
+
+    u::bytes b;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < iterations; i++) b = m::encode_message(msg, version);
+    auto encoded = std::chrono::high_resolution_clock::now();
+
+    m::message got;
+    for(int i = 0; i < iterations; i++) 
+    {
+        got = m::message{};
+        m::decode_message(b, got);
+    }
+    auto decoded = std::chrono::high_resolution_clock::now();
+
+    CHECK(got.data == msg.data);
+    CHECK(got.meta.to == msg.meta.to);
+
+    std::chrono::duration<double> encode_time = encoded - start;
+    std::chrono::duration<double> decode_time = decoded - encoded;
+    std::cout << "mencode v" << version << " size: " << b.size() << " bytes"
+        << " encode: " << (iterations / encode_time.count()) << " msg/s"
+        << " decode: " << (iterations / decode_time.count()) << " msg/s" << std::endl;
+}
+
+void mencode_speed(const u::bytes& data, int iterations)
+{
+    //metadata like a message between contacts
+    m::message msg;
+    msg.meta.type = "perf";
+    msg.meta.to = {"udp://10.0.0.2:7171", "conversation_service", "app"};
+    msg.meta.from = {"app", "conversation_service", "udp://10.0.0.1:7171"};
+    msg.meta.extra["from_id"] = std::string(40, 'f');
+    msg.meta.extra["from_ip"] = std::string{"10.0.0.1"};
+    msg.meta.extra["from_port"] = 7171;
+    msg.meta.extra["conversation_id"] = std::string(40, 'c');
+    msg.meta.extra["seq"] = size_t{123456};
+    msg.meta.extra["time"] = 1234.5678;
+    msg.data = data;
+
+    mencode_speed(msg, m::MENCODE_V1, iterations);
+    mencode_speed(msg, m::MENCODE_V2, iterations);
+}
+
+//payload like a conversation text message
+u::dict text_payload(const u::bytes& text)
+{
+    u::dict clock;
+    for(size_t i = 0; i < CLOCK_ENTRIES; i++) 
+        clock[std::to_string(i) + std::string(39, 'c')] = i * 100;
+
+    u::dict d;
+    d["id"] = std::string(40, 'i');
+    d["from_id"] = std::string(40, 'f');
+    d["to"] = u::array{std::string(40, 'a'), std::string(40, 'b'), std::string(40, 'c')};
+    d["clock"] = clock;
+    d["time"] = 1234.5678;
+    d["text"] = text;
+    return d;
+}
+
+//builds, encodes, decodes and reads a message the way services do 
+void value_round_trip(const m::message& base, const u::dict& payload, int version, int iterations)
+{
+    REQUIRE_GREATER(iterations, 0);
+
+    size_t text_size = 0;
+    const auto start_allocations = allocations.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+        m::message msg = base;
+        msg.meta.extra["seq"] = static_cast<size_t>(i);
+        msg.data = u::encode(payload);
+        auto b = m::encode_message(msg, version);
+
+        m::message got;
+        m::decode_message(b, got);
+        u::dict d;
+        u::decode(got.data, d);
+
+        const auto& clock = d["clock"].as_dict();
+        CHECK_EQUAL(clock.size(), CLOCK_ENTRIES);
+        text_size += d["text"].as_bytes().size() + got.meta.extra["seq"].as_size();
+    }
+    auto done = std::chrono::high_resolution_clock::now();
+    const auto used = allocations.load() - start_allocations;
+
+    CHECK_GREATER(text_size, 0);
+
+    std::chrono::duration<double, std::micro> t = done - start;
+    std::cout << "round trip v" << version 
+        << " allocations: " << (static_cast<double>(used) / iterations) << "/msg"
+        << " latency: " << (t.count() / iterations) << "us" << std::endl;
+}
+
+//what the receiving master post office does with a message before
+//routing it, a full decode or a view that reads the addresses
+void view_speed(const m::message& msg, int version, int iterations)
+{
+    REQUIRE_GREATER(iterations, 0);
+
+    const auto b = m::encode_message(msg, version);
+    const auto shared = std::make_shared<u::bytes>(b);
+    size_t routed = 0;
+
+    auto allocations_start = allocations.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+        m::message got;
+        m::decode_message(b, got);
+        routed += got.meta.to.size();
+    }
+    auto decoded = std::chrono::high_resolution_clock::now();
+    const auto decode_allocations = allocations.load() - allocations_start;
+
+    allocations_start = allocations.load();
+    auto viewed_start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+        m::message_view v{shared};
+        routed += v.to().size();
+    }
+    auto viewed = std::chrono::high_resolution_clock::now();
+    const auto view_allocations = allocations.load() - allocations_start;
+
+    CHECK_GREATER(routed, 0);
+
+    std::chrono::duration<double, std::micro> decode_time = decoded - start;
+    std::chrono::duration<double, std::micro> view_time = viewed - viewed_start;
+    std::cout << "route v" << version 
+        << " decode: " << (decode_time.count() / iterations) << "us " 
+        << (static_cast<double>(decode_allocations) / iterations) << " allocations"
+        << " view: " << (view_time.count() / iterations) << "us " 
+        << (static_cast<double>(view_allocations) / iterations) << " allocations" << std::endl;
+}
+
+void value_round_trip(const u::bytes& text, int iterations)
+{
+    m::message msg;
+    msg.meta.type = "perf";
+    msg.meta.to = {"udp://10.0.0.2:7171", "conversation_service", "app"};
+    msg.meta.from = {"app", "conversation_service", "udp://10.0.0.1:7171"};
+    msg.meta.extra["from_id"] = std::string(40, 'f');
+    msg.meta.extra["from_ip"] = std::string{"10.0.0.1"};
+    msg.meta.extra["from_port"] = 7171;
+
+    auto payload = text_payload(text);
+    value_round_trip(msg, payload, m::MENCODE_V1, iterations);
+    value_round_trip(msg, payload, m::MENCODE_V2, iterations);
+
+    msg.data = u::encode(payload);
+    view_speed(msg, m::MENCODE_V1, iterations);
+    view_speed(msg, m::MENCODE_V2, iterations);
+}
+
+//sets up a dh channel between two master post offices
+void pair_channels(
+        sc::encrypted_channels& a, const std::string& a_address, const sc::private_key& a_key,
+        sc::encrypted_channels& b, const std::string& b_address, const sc::private_key& b_key)
+{
+    a.create_channel(b_address, sc::public_key{b_key});
+    b.create_channel(a_address, sc::public_key{a_key});
+
+    const auto a_value = a.get_channel(b_address)->shared_secret.public_value();
+    const auto b_value = b.get_channel(a_address)->shared_secret.public_value();
+    a.create_channel(b_address, sc::public_key{b_key}, b_value);
+    b.create_channel(a_address, sc::public_key{a_key}, a_value);
+}
+
+void print_stage(const std::string& name, const u::histogram& h)
+{
+    if(h.count() == 0) return;
+    std::cout << name << " count: " << h.count() << " avg: " << h.mean() << "us p50: <" << h.percentile(0.5) 
+        << "us p99: <" << h.percentile(0.99) << "us max: " << h.max() << "us" << std::endl;
+}
+
+void print_pipeline(const std::string& name, const m::pipeline_stats& s)
+{
+    std::cout << name << " pipeline" << std::endl;
+    print_stage("  encode", s.encode);
+    print_stage("  encrypt", s.encrypt);
+    print_stage("  send", s.send);
+    print_stage("  outgoing", s.outgoing);
+    print_stage("  decrypt", s.decrypt);
+    print_stage("  decode", s.decode);
+    print_stage("  incoming", s.incoming);
+}
+
+void post_throughput(const u::bytes& data, int threads, int senders, int iterations)
+{
+    REQUIRE_GREATER(threads, 0);
+    REQUIRE_GREATER(senders, 0);
+
+    using master_ptr = std::unique_ptr<m::master_post_office>;
+    const std::string host = "127.0.0.1";
+
+    sc::private_key dst_key{"perf"};
+    auto dst_channels = std::make_shared<sc::encrypted_channels>(dst_key);
+    const auto dst_address = n::make_udp_address(host, DST_PORT);
+    master_ptr dst{new m::master_post_office{host, DST_PORT, dst_channels, static_cast<size_t>(threads)}};
+    auto to = std::make_shared<m::mailbox>("perf");
+    dst->add(to);
+
+    std::vector<std::unique_ptr<sc::private_key>> keys;
+    std::vector<sc::encrypted_channels_ptr> channels;
+    std::vector<master_ptr> srcs;
+    std::vector<m::mailbox_ptr> froms;
+    for(int i = 0; i < senders; i++)
+    {
+        auto port = static_cast<n::port_type>(i == 0 ? SRC_PORT : EXTRA_SRC_PORT + i);
+        keys.emplace_back(new sc::private_key{"perf"});
+        channels.emplace_back(std::make_shared<sc::encrypted_channels>(*keys.back()));
+        pair_channels(
+                *channels.back(), n::make_udp_address(host, port), *keys.back(), 
+                *dst_channels, dst_address, dst_key);
+
+        srcs.emplace_back(new m::master_post_office{host, port, channels.back(), static_cast<size_t>(threads)});
+        froms.emplace_back(std::make_shared<m::mailbox>("perf"));
+        srcs.back()->add(froms.back());
+    }
+
+    m::message msg;
+    msg.meta.type = "perf";
+    msg.meta.to = {dst_address, "perf"};
+    msg.meta.encryption = m::metadata::symmetric;
+    msg.data = data;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for(int i = 0; i < iterations; i++) froms[i % senders]->push_outbox(msg);
+
+    int got = 0;
+    m::message got_msg;
+    while(got < iterations && to->pop_inbox(got_msg, true))
+    {
+        CHECK(got_msg.data == data);
+        got++;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    const double total = static_cast<double>(data.size()) * got;
+    std::cout << "post threads: " << threads << " senders: " << senders << " messages: " << got << " time: " << diff.count() << "s" << std::endl;
+    std::cout << "post throughput: " << (total / diff.count() / (1024*1024)) << " MB/s" << std::endl;
+    print_pipeline("sender", srcs.front()->get_pipeline_stats());
+    print_pipeline("receiver", dst->get_pipeline_stats());
+}
+
+//microseconds spent encoding and encrypting so far
+double encode_encrypt_time(const m::pipeline_stats& s)
+{
+    return s.encode.mean() * s.encode.count() + s.encrypt.mean() * s.encrypt.count();
+}
+
+//sends each message to every member of a group, first one copy per
+//member like a loop over contacts, then as one group message
+void group_fanout(const u::bytes& data, int members, int iterations)
+{
+    REQUIRE_GREATER(members, 1);
+    REQUIRE_GREATER(iterations, 0);
+
+    using master_ptr = std::unique_ptr<m::master_post_office>;
+    const std::string host = "127.0.0.1";
+    const size_t threads = 1;
+
+    sc::private_key src_key{"perf"};
+    auto src_channels = std::make_shared<sc::encrypted_channels>(src_key);
+    const auto src_address = n::make_udp_address(host, SRC_PORT);
+    master_ptr src{new m::master_post_office{host, SRC_PORT, src_channels, threads}};
+    auto from = std::make_shared<m::mailbox>("perf");
+    src->add(from);
+
+    std::vector<std::unique_ptr<sc::private_key>> keys;
+    std::vector<master_ptr> dsts;
+    std::vector<m::mailbox_ptr> tos;
+    std::vector<std::string> group;
+    for(int i = 0; i < members; i++)
+    {
+        auto port = static_cast<n::port_type>(EXTRA_SRC_PORT + i);
+        const auto address = n::make_udp_address(host, port);
+        keys.emplace_back(new sc::private_key{"perf"});
+        auto channels = std::make_shared<sc::encrypted_channels>(*keys.back());
+        pair_channels(*src_channels, src_address, src_key, *channels, address, *keys.back());
+
+        dsts.emplace_back(new m::master_post_office{host, port, channels, threads});
+        tos.emplace_back(std::make_shared<m::mailbox>("perf"));
+        dsts.back()->add(tos.back());
+        group.push_back(address);
+
+        //lets the source hear what the member understands
+        m::message hi;
+        hi.meta.type = "perf";
+        hi.meta.to = {src_address, "perf"};
+        tos.back()->push_outbox(hi);
+        from->pop_inbox(hi, true);
+    }
+
+    m::message msg;
+    msg.meta.type = "perf";
+    msg.data = data;
+
+    for(bool as_group : {false, true})
+    {
+        const auto before = encode_encrypt_time(src->get_pipeline_stats());
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for(int i = 0; i < iterations; i++)
+        {
+            if(as_group)
+            {
+                msg.meta.to = {group.front(), "perf"};
+                msg.meta.group = group;
+                from->push_outbox(msg);
+                continue;
+            }
+
+            for(const auto& address : group)
+            {
+                msg.meta.to = {address, "perf"};
+                msg.meta.group.clear();
+                from->push_outbox(msg);
+            }
+        }
+
+        int got = 0;
+        m::message got_msg;
+        for(auto& to : tos)
+            for(int i = 0; i < iterations && to->pop_inbox(got_msg, true); i++)
+            {
+                CHECK(got_msg.data == data);
+                got++;
+            }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> diff = end - start;
+        const auto cpu = encode_encrypt_time(src->get_pipeline_stats()) - before;
+
+        std::cout << (as_group ? "group" : "per peer") << " members: " << members << " delivered: " << got 
+            << " time: " << diff.count() << "s"
+            << " encode and encrypt: " << (cpu / iterations) << "us/message" << std::endl;
+    }
+}
+
+double per_second(int ops, std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return ops / diff.count();
+}
+
+//sets, overwrites and gets keys in a disk_store like an app storing
+//its data in a loop, then in one batch and with write behind, then
+//reopens it
+void store_speed(int keys, size_t value_size)
+{
+    REQUIRE_GREATER(keys, 0);
+    using clock = std::chrono::high_resolution_clock;
+
+    const auto dir = (bf::temp_directory_path() / "fireperf_store").string();
+    bf::remove_all(dir);
+    bf::create_directories(dir);
+
+    const u::value v{std::string(value_size, 'v')};
+    {
+        u::disk_store s{dir};
+
+        auto start = clock::now();
+        for(int i = 0; i < keys; i++) s.set("key" + std::to_string(i), v);
+        std::cout << "set: " << per_second(keys, start) << " ops/s" << std::endl;
+
+        start = clock::now();
+        for(int i = 0; i < keys; i++) s.set("key" + std::to_string(i), v);
+        std::cout << "overwrite: " << per_second(keys, start) << " ops/s" << std::endl;
+
+        start = clock::now();
+        for(int i = 0; i < keys; i++) CHECK_EQUAL(s.get("key" + std::to_string(i)).as_string().size(), value_size);
+        std::cout << "get: " << per_second(keys, start) << " ops/s" << std::endl;
+
+        start = clock::now();
+        u::store_batch b;
+        for(int i = 0; i < keys; i++) b["batch" + std::to_string(i)].v = v;
+        s.apply(b);
+        std::cout << "batch: " << per_second(keys, start) << " ops/s" << std::endl;
+
+        s.write_behind(true);
+        start = clock::now();
+        for(int i = 0; i < keys; i++) s.set("key" + std::to_string(i), v);
+        std::cout << "write behind: " << per_second(keys, start) << " ops/s" << std::endl;
+
+        start = clock::now();
+        s.sync();
+        std::cout << "sync: " << per_second(1, start) << " ops/s" << std::endl;
+    }
+
+    auto start = clock::now();
+    u::disk_store s{dir};
+    CHECK_EQUAL(s.size(), static_cast<size_t>(keys * 2));
+    std::chrono::duration<double> diff = clock::now() - start;
+
+    size_t files = 0;
+    for(bf::directory_iterator f{dir}, end; f != end; ++f) files++;
+    std::cout << "reopen: " << diff.count() << "s files: " << files << std::endl;
+}
+
+//two replicas of a document type a character each at the same time and
+//then merge. cr_string sends the whole document and does a three way
+//merge, cr_text sends the ops. both take the whole text from the editor.
+void text_merge(size_t doc_size, int edits)
+{
+    REQUIRE_GREATER(edits, 0);
+    using clock = std::chrono::high_resolution_clock;
+
+    std::string doc;
+    for(size_t i = 0; i < doc_size; i++) doc.push_back(i % 64 == 63 ? '\n' : 'a' + i % 26);
+
+    auto type = [](const std::string& s, size_t p, char c)
+    {
+        auto r = s;
+        r.insert(std::min(p, r.size()), 1, c);
+        return r;
+    };
+
+    {
+        u::cr_string a{"a"}, b{"b"};
+        a.init_set(doc);
+        b.init_set(doc);
+
+        size_t sent = 0;
+        auto start = clock::now();
+        for(int i = 0; i < edits; i++)
+        {
+            a.set(type(a.str(), i * 7919 % doc_size, 'x'));
+            b.set(type(b.str(), i * 104729 % doc_size, 'y'));
+            sent += a.str().size() + b.str().size();
+
+            const auto old_a = a;
+            a.merge(b);
+            b.merge(old_a);
+        }
+        std::cout << "cr_string: " << per_second(edits, start) << " edits/s " << sent / edits << " bytes/edit" << std::endl;
+    }
+
+    u::cr_text a{"a"}, b{"b"};
+    b.apply(a.set(doc));
+
+    size_t sent = 0;
+    auto start = clock::now();
+    for(int i = 0; i < edits; i++)
+    {
+        const auto to_b = u::encode_text_ops(a.set(type(a.str(), i * 7919 % doc_size, 'x')));
+        const auto to_a = u::encode_text_ops(b.set(type(b.str(), i * 104729 % doc_size, 'y')));
+        sent += to_b.size() + to_a.size();
+
+        a.apply(u::decode_text_ops(to_a));
+        b.apply(u::decode_text_ops(to_b));
+    }
+    std::cout << "cr_text: " << per_second(edits, start) << " edits/s " << sent / edits << " bytes/edit" << std::endl;
+    CHECK(a.str() == b.str());
+}
+
 int main(int argc, char *argv[])
 {
     auto desc = create_descriptions();
@@ -101,13 +831,105 @@ int main(int argc, char *argv[])
     auto total_iterations = iterations;
     auto robust = vm["robust"].as<bool>();
     size_t bytes_per_message = vm["size"].as<int>();
+    auto batch = vm["batch"].as<int>();
+    auto mtu = vm["mtu"].as<int>();
+    auto idle = vm["idle"].as<int>();
+    auto concurrent = std::max(1, vm["concurrent"].as<int>());
+    auto shards = std::max(1, vm["shards"].as<int>());
+    auto senders = std::max(1, vm["senders"].as<int>());
+    auto crypto = vm["crypto"].as<int>();
+    auto tcp = vm["tcp"].as<bool>();
+    auto legacy = vm["legacy"].as<bool>();
+    auto queues = vm["queues"].as<int>();
+    auto schedule = vm["schedule"].as<bool>();
+    auto post = vm["post"].as<int>();
+    auto mencode = vm["mencode"].as<bool>();
+    auto group = vm["group"].as<int>();
+    auto store = vm["store"].as<int>();
+    auto text = vm["text"].as<int>();
+
+    if(crypto > 0)
+    {
+        crypto_throughput(u::to_bytes(std::string(bytes_per_message, 'm')), crypto, iterations);
+        return 0;
+    }
+
+    if(queues > 0)
+    {
+        queue_contention(queues, iterations);
+        return 0;
+    }
 
-    n::connection_manager src{POOL_SIZE, static_cast<n::port_type>(SRC_PORT)};
-    n::connection_manager dst{POOL_SIZE, static_cast<n::port_type>(DST_PORT)};
+    if(schedule)
+    {
+        schedule_order(u::to_bytes(std::string(bytes_per_message, 'm')), iterations);
+        return 0;
+    }
+
+    if(mencode)
+    {
+        mencode_speed(u::to_bytes(std::string(bytes_per_message, 'm')), iterations);
+        value_round_trip(u::to_bytes(std::string(bytes_per_message, 'm')), iterations);
+        return 0;
+    }
+
+    if(store > 0)
+    {
+        store_speed(store, bytes_per_message);
+        return 0;
+    }
+
+    if(text > 0)
+    {
+        text_merge(text, iterations);
+        return 0;
+    }
+
+    if(group > 1)
+    {
+        group_fanout(u::to_bytes(std::string(bytes_per_message, 'm')), group, iterations);
+        return 0;
+    }
+
+    if(post > 0)
+    {
+        post_throughput(u::to_bytes(std::string(bytes_per_message, 'm')), post, 
+                std::max(1, vm["senders"].as<int>()), iterations);
+        return 0;
+    }
+
+    if(tcp)
+    {
+        tcp_throughput(u::to_bytes(std::string(bytes_per_message, 'm')), iterations, legacy);
+        return 0;
+    }
+
+    n::queue_options udp_options = {
+        {"batch", std::to_string(batch)},
+        {"mtu", std::to_string(mtu)}};
+    n::queue_options dst_options = udp_options;
+    dst_options["shards"] = std::to_string(shards);
+
+    std::vector<std::unique_ptr<n::connection_manager>> srcs;
+    for(int i = 0; i < senders; i++)
+    {
+        auto port = static_cast<n::port_type>(i == 0 ? SRC_PORT : EXTRA_SRC_PORT + i);
+        srcs.emplace_back(new n::connection_manager{POOL_SIZE, port, true, udp_options});
+    }
+    auto& src = *srcs.front();
+    n::connection_manager dst{POOL_SIZE, static_cast<n::port_type>(DST_PORT), true, dst_options};
 
 
     auto data = u::to_bytes(std::string(bytes_per_message, 'm'));
 
+    if(idle > 0)
+    {
+        std::cout << "messages: " << total_iterations << " idle: " << idle << "ms" << std::endl;
+        print_latency("udp", udp_idle_latency(src, dst, data, robust, idle, total_iterations));
+        print_latency("post office", post_idle_latency(data, idle, total_iterations));
+        return 0;
+    }
+
     u::bytes got_data;
 
     n::endpoint ep;
@@ -116,11 +938,18 @@ int main(int argc, char *argv[])
     while(iterations)
     try
     {
-        src.send(DST_ADDR, data, robust);
-        while(!dst.receive(ep, got_data)); //spin until we get something
+        //keep a burst of messages in flight at once
+        auto burst = std::min(iterations, concurrent);
+        for(int i = 0; i < burst; i++) 
+            srcs[i % senders]->send(DST_ADDR, data, robust);
 
-        CHECK(got_data == data);
-        iterations--;
+        for(int i = 0; i < burst; i++)
+        {
+            while(!dst.receive(ep, got_data)); //spin until we get something
+
+            CHECK(got_data == data);
+            iterations--;
+        }
     }
     catch(std::exception& e)
     {
@@ -138,11 +967,33 @@ int main(int argc, char *argv[])
     auto time_per_byte = duration / total_bytes_sent;
     auto kb_per_sec = (total_bytes_sent/1024) / sec;
     auto time_per_message = (duration / total_iterations) / 1000000.0;
-    std::cout << "messages: " << total_iterations << " time: " << sec << "s" << std::endl;
+    std::cout << "messages: " << total_iterations << " concurrent: " << concurrent 
+        << " senders: " << senders << " shards: " << shards << " time: " << sec << "s" << std::endl;
     std::cout << "bytes per message: " << bytes_per_message << std::endl;
     std::cout << "sent bytes: " << total_bytes_sent<< std::endl;
     std::cout << "kb per sec: " << kb_per_sec << std::endl;
     std::cout << "time/byte: " << time_per_byte << "ns" << std::endl;
     std::cout << "time/message: " << time_per_message << "ms" << std::endl;
 
+    n::udp_stats ss = src.get_udp_stats();
+    for(int i = 1; i < senders; i++)
+    {
+        const auto& s = srcs[i]->get_udp_stats();
+        ss.packets_sent += s.packets_sent;
+        ss.send_calls += s.send_calls;
+        ss.dropped += s.dropped;
+        ss.losses += s.losses;
+        ss.fast_resends += s.fast_resends;
+        ss.bytes_copied += s.bytes_copied;
+    }
+    const auto& ds = dst.get_udp_stats();
+    std::cout << "batch: " << batch << std::endl;
+    std::cout << "packets sent: " << ss.packets_sent << " in " << ss.send_calls << " send calls" << std::endl;
+    std::cout << "packets recv: " << ds.packets_recv << " in " << ds.recv_calls << " recv calls" << std::endl;
+    std::cout << "dropped: " << ss.dropped << " losses: " << ss.losses << " fast resends: " << ss.fast_resends << std::endl;
+    std::cout << "acks sent: " << ds.acks_sent << std::endl;
+    std::cout << "copies per byte: sender " << static_cast<double>(ss.bytes_copied) / total_bytes_sent 
+        << " receiver " << static_cast<double>(ds.bytes_copied) / total_bytes_sent << std::endl;
+    std::cout << "cwnd: " << ss.cwnd << " srtt: " << ss.srtt << "ms rto: " << ss.rto << "ms" << std::endl;
+
 }
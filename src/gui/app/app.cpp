@@ -56,6 +56,7 @@ namespace fire
             namespace 
             {
                 const std::string APP_MESSAGE = "app_message";
+                const std::string APP_MANIFEST = "app_manifest";
                 const std::string METADATA_FILE = "metadata";
                 const std::string CODE_FILE = "code.lua";
                 const std::string DATA_PATH = "data";
@@ -386,6 +387,87 @@ namespace fire
                 u::save_to_file(file, b);
             }
 
+            m::message make_manifest(const app& a, blob_cache& cache)
+            {
+                m::message m;
+
+                m.meta.type = APP_MANIFEST;
+                m.meta.extra["app_id"] = a.id();
+                m.meta.extra["app_name"] = a.name();
+                m.meta.extra["code"] = cache.put(u::to_bytes(a.code()));
+
+                //each value is chunked on its own so unchanged keys cost nothing
+                u::dict data;
+                a.data().export_to(data);
+
+                u::dict hashes;
+                for(const auto& p : data)
+                    hashes[p.first] = cache.put(u::encode(p.second));
+
+                m.data = u::encode(hashes);
+
+                ENSURE(is_manifest(m));
+                return m;
+            }
+
+            bool is_manifest(const m::message& m)
+            {
+                return m.meta.type == APP_MANIFEST;
+            }
+
+            void missing_chunks(const m::message& manifest, const blob_cache& cache, hash_set& missing)
+            {
+                REQUIRE(is_manifest(manifest));
+
+                cache.missing(manifest.meta.extra["code"].as_array(), missing);
+
+                auto hashes = u::decode<u::dict>(manifest.data);
+                for(const auto& p : hashes)
+                    cache.missing(p.second.as_array(), missing);
+            }
+
+            void add_hashes(const hash_list& hashes, hash_set& s)
+            {
+                for(const auto& h : hashes)
+                    if(h.is_bytes()) s.insert(h.as_string());
+            }
+
+            //every chunk the manifest names
+            void manifest_chunks(const m::message& manifest, hash_set& s)
+            {
+                REQUIRE(is_manifest(manifest));
+
+                add_hashes(manifest.meta.extra["code"].as_array(), s);
+
+                auto hashes = u::decode<u::dict>(manifest.data);
+                for(const auto& p : hashes)
+                    add_hashes(p.second.as_array(), s);
+            }
+
+            bool unpack_manifest(const m::message& manifest, const blob_cache& cache, m::message& m)
+            {
+                REQUIRE(is_manifest(manifest));
+
+                u::bytes code;
+                if(!cache.get(manifest.meta.extra["code"].as_array(), code)) return false;
+
+                u::dict data;
+                u::bytes value;
+                auto hashes = u::decode<u::dict>(manifest.data);
+                for(const auto& p : hashes)
+                {
+                    if(!cache.get(p.second.as_array(), value)) return false;
+                    data[p.first] = u::decode<u::value>(value);
+                }
+
+                m.meta.type = APP_MESSAGE;
+                m.meta.extra["app_id"] = manifest.meta.extra["app_id"];
+                m.meta.extra["app_name"] = manifest.meta.extra["app_name"];
+                m.meta.extra["code"] = u::to_str(code);
+                m.data = u::encode(data);
+                return true;
+            }
+
             m::message import_app_as_message(const std::string& file)
             {
                 u::bytes b;
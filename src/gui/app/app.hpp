@@ -32,6 +32,7 @@
 #ifndef FIRESTR_GUI_APP_APP_H
 #define FIRESTR_GUI_APP_APP_H
 
+#include "gui/app/blob_cache.hpp"
 #include "message/message.hpp"
 #include "util/disk_store.hpp"
 
@@ -110,6 +111,17 @@ namespace fire
 
             void export_app_as_message(const std::string& file, const app&);
 
+            //a manifest names the app's code and data by the hashes of their
+            //chunks, which are stored in the cache
+            fire::message::message make_manifest(const app&, blob_cache&);
+            bool is_manifest(const fire::message::message&);
+            void missing_chunks(const fire::message::message& manifest, const blob_cache&, hash_set&);
+            void manifest_chunks(const fire::message::message& manifest, hash_set&);
+            bool unpack_manifest(
+                    const fire::message::message& manifest, 
+                    const blob_cache&, 
+                    fire::message::message& app_message);
+
             fire::message::message import_app_as_message(util::bytes compressed_app);
             fire::message::message import_app_as_message(const std::string& file);
         }
@@ -986,11 +986,7 @@ namespace fire
                 INVARIANT(_conversation);
                 INVARIANT(_sender);
 
-                for(auto c : _conversation->contacts().list())
-                {
-                    CHECK(c);
-                    _sender->send(c->id(), m); 
-                }
+                _sender->send(_conversation->contacts(), m); 
             }
 
             void app_editor::send_script(bool send_data)
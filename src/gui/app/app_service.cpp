@@ -61,6 +61,7 @@ namespace fire
                 const std::string LOCAL_DATA = "data";
                 const std::string TMP_APP_HOME = "tmp";
                 const std::string DATA_DIR = "data";
+                const std::string BLOB_DIR = "blobs";
             }
 
             std::string get_app_home(bf::path home)
@@ -103,6 +104,10 @@ namespace fire
                 u::create_directory(_app_home);
                 load_apps();
 
+                //setup chunk cache, it has no metadata so load_apps skips it
+                bf::path blob_dir = bf::path{_app_home} / BLOB_DIR;
+                _blobs.load(blob_dir.string());
+
                 init_handlers();
                 start();
 
@@ -304,6 +309,51 @@ namespace fire
                 return create_app(m);
             }
 
+            m::message app_service::app_manifest(const app& a) const
+            {
+                return make_manifest(a, _blobs);
+            }
+
+            app_ptr app_service::create_app_from_manifest(const m::message& manifest, hash_set& missing) const
+            {
+                REQUIRE(is_manifest(manifest));
+
+                missing_chunks(manifest, _blobs, missing);
+                if(!missing.empty()) return nullptr;
+
+                m::message m;
+                if(!unpack_manifest(manifest, _blobs, m)) return nullptr;
+
+                return create_app(m);
+            }
+
+            blob_cache& app_service::blobs()
+            {
+                return _blobs;
+            }
+
+            void app_service::heard_manifests(const std::string& contact_id)
+            {
+                if(contact_id.empty()) return;
+
+                u::mutex_scoped_lock l(_manifest_mutex);
+                _manifest_contacts.insert(contact_id);
+            }
+
+            bool app_service::speaks_manifests(const std::string& contact_id) const
+            {
+                u::mutex_scoped_lock l(_manifest_mutex);
+                return _manifest_contacts.count(contact_id) > 0;
+            }
+
+            m::message app_service::app_message_for(const app& a, const std::string& contact_id) const
+            {
+                if(speaks_manifests(contact_id)) return app_manifest(a);
+
+                m::message m = a;
+                return m;
+            }
+
             void app_service::fire_apps_updated_event()
             {
                 event::apps_updated e;
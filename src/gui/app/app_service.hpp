@@ -69,6 +69,19 @@ namespace fire
                     bool remove_app(const std::string& id);
                     app_ptr import_app(const std::string& file);
 
+                public:
+                    //apps are sent to peers as manifests and the chunks
+                    //they are missing are pulled from the blob cache
+                    fire::message::message app_manifest(const app&) const;
+                    app_ptr create_app_from_manifest(const fire::message::message&, hash_set& missing) const;
+                    blob_cache& blobs();
+
+                    //contacts get a manifest only once they have shown they
+                    //understand one, until then they get the whole app
+                    void heard_manifests(const std::string& contact_id);
+                    bool speaks_manifests(const std::string& contact_id) const;
+                    fire::message::message app_message_for(const app&, const std::string& contact_id) const;
+
                 public:
                     user::user_service_ptr user_service();
 
@@ -89,7 +102,11 @@ namespace fire
                     messages::sender_ptr _sender;
 
                     mutable util::disk_store _local_data;
+                    mutable blob_cache _blobs;
                     mutable std::mutex _mutex;
+
+                    std::set<std::string> _manifest_contacts;
+                    mutable std::mutex _manifest_mutex;
             };
 
             using app_service_ptr = std::shared_ptr<app_service>;
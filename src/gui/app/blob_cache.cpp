@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#include "gui/app/blob_cache.hpp"
+
+#include "security/security.hpp"
+#include "util/dbc.hpp"
+#include "util/filesystem.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <array>
+#include <fstream>
+#include <stdexcept>
+
+namespace u = fire::util;
+namespace sc = fire::security;
+namespace bf = boost::filesystem;
+
+namespace fire
+{
+    namespace gui
+    {
+        namespace app
+        {
+            namespace 
+            {
+                const size_t MIN_CHUNK = 1024; //bytes
+                const size_t MAX_CHUNK = 16384; //bytes
+                const uint64_t CUT_MASK = 0xfff0000000000000; //cuts every 4k bytes on average past the minimum
+                const size_t HASH_DIR_SIZE = 2; //chunks are spread over directories by hash prefix
+                const std::string TMP_SUFFIX = ".tmp";
+
+                using gear_table = std::array<uint64_t, 256>;
+
+                //splitmix64 from a fixed seed. every peer must have the same
+                //table or their chunks will not line up.
+                gear_table make_gear_table()
+                {
+                    gear_table t;
+                    uint64_t x = 0;
+                    for(auto& g : t)
+                    {
+                        x += 0x9e3779b97f4a7c15;
+                        uint64_t z = x;
+                        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+                        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+                        g = z ^ (z >> 31);
+                    }
+                    return t;
+                }
+
+                const gear_table GEAR = make_gear_table();
+
+                //gear rolling hash, the high bits depend on the last 64 bytes
+                //so cuts come back in the same places after an edit
+                size_t next_cut(const char* data, size_t size)
+                {
+                    if(size <= MIN_CHUNK) return size;
+
+                    const auto end = std::min(size, MAX_CHUNK);
+                    uint64_t h = 0;
+                    for(size_t i = MIN_CHUNK; i < end; i++)
+                    {
+                        h = (h << 1) + GEAR[static_cast<unsigned char>(data[i])];
+                        if((h & CUT_MASK) == 0) return i + 1;
+                    }
+                    return end;
+                }
+            }
+
+            blob_cache::blob_cache() {}
+
+            blob_cache::blob_cache(const std::string& dir)
+            {
+                load(dir);
+            }
+
+            void blob_cache::load(const std::string& dir)
+            {
+                REQUIRE_FALSE(dir.empty());
+
+                u::mutex_scoped_lock l(_mutex);
+                u::create_directory(dir);
+                _dir = dir;
+
+                ENSURE_FALSE(_dir.empty());
+            }
+
+            std::string blob_cache::chunk_file(const std::string& hash) const
+            {
+                //hashes come from peers, only a real hash is a safe file name
+                REQUIRE(sc::is_content_hash(hash));
+                INVARIANT_FALSE(_dir.empty());
+
+                bf::path p = _dir;
+                p /= hash.substr(0, HASH_DIR_SIZE);
+                p /= hash;
+                return p.string();
+            }
+
+            void blob_cache::store(const std::string& hash, const char* data, size_t size)
+            {
+                const auto file = chunk_file(hash);
+                if(bf::exists(file)) return;
+
+                u::create_directory(bf::path{file}.parent_path().string());
+
+                //write to the side first so a half written chunk is never trusted
+                const auto tmp = file + TMP_SUFFIX;
+                {
+                    std::ofstream out(tmp.c_str(), std::fstream::out | std::fstream::binary);
+                    if(!out.good()) 
+                        throw std::runtime_error{"unable to save `" + tmp + "'"};
+
+                    out.write(data, size);
+                }
+                bf::rename(tmp, file);
+            }
+
+            hash_list blob_cache::put(const u::bytes& b)
+            {
+                hash_list hashes;
+
+                u::mutex_scoped_lock l(_mutex);
+
+                size_t pos = 0;
+                while(pos < b.size())
+                {
+                    const auto cut = next_cut(b.data() + pos, b.size() - pos);
+                    CHECK_GREATER(cut, 0);
+
+                    u::bytes chunk(b.begin() + pos, b.begin() + pos + cut);
+                    auto hash = sc::content_hash(chunk);
+                    store(hash, chunk.data(), chunk.size());
+                    hashes.add(hash);
+
+                    pos += cut;
+                }
+
+                ENSURE_EQUAL(pos, b.size());
+                return hashes;
+            }
+
+            bool blob_cache::put_chunk(const std::string& hash, const u::bytes& chunk)
+            {
+                if(!sc::is_content_hash(hash) || sc::content_hash(chunk) != hash) return false;
+
+                u::mutex_scoped_lock l(_mutex);
+                store(hash, chunk.data(), chunk.size());
+                return true;
+            }
+
+            bool blob_cache::has(const std::string& hash) const
+            {
+                if(!sc::is_content_hash(hash)) return false;
+
+                u::mutex_scoped_lock l(_mutex);
+                return bf::exists(chunk_file(hash));
+            }
+
+            bool blob_cache::get_chunk(const std::string& hash, u::bytes& chunk) const
+            {
+                if(!sc::is_content_hash(hash)) return false;
+
+                u::mutex_scoped_lock l(_mutex);
+
+                std::ifstream in(chunk_file(hash).c_str(), std::fstream::in | std::fstream::binary);
+                if(!in.good()) return false;
+
+                chunk.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+                return true;
+            }
+
+            bool blob_cache::get(const hash_list& hashes, u::bytes& b) const
+            {
+                b.clear();
+
+                u::bytes chunk;
+                for(const auto& h : hashes)
+                {
+                    if(!h.is_bytes() || !get_chunk(h.as_string(), chunk)) return false;
+                    b.insert(b.end(), chunk.begin(), chunk.end());
+                }
+                return true;
+            }
+
+            void blob_cache::missing(const hash_list& hashes, hash_set& m) const
+            {
+                //a manifest naming something that is not a hash can never
+                //be filled, so it is not asked for. get fails on it later.
+                for(const auto& h : hashes)
+                {
+                    if(!h.is_bytes()) continue;
+
+                    auto hash = h.as_string();
+                    if(sc::is_content_hash(hash) && !has(hash)) m.insert(hash);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#ifndef FIRESTR_GUI_APP_BLOB_CACHE_H
+#define FIRESTR_GUI_APP_BLOB_CACHE_H
+
+#include "util/mencode.hpp"
+#include "util/thread.hpp"
+
+#include <string>
+#include <set>
+
+namespace fire
+{
+    namespace gui
+    {
+        namespace app
+        {
+            //hashes of the chunks that make up a blob, in order
+            using hash_list = util::array;
+            using hash_set = std::set<std::string>;
+
+            /**
+             * Content addressed store of chunks kept under the app home.
+             * Blobs are cut into chunks at content defined boundaries so an
+             * edit only changes the chunks around it and peers only need to
+             * fetch those.
+             */
+            class blob_cache
+            {
+                public:
+                    blob_cache();
+                    blob_cache(const std::string& dir);
+
+                public:
+                    void load(const std::string& dir);
+
+                    //stores the blob and returns the hashes of its chunks
+                    hash_list put(const util::bytes&);
+
+                    //stores a chunk from a peer, false if it does not match the hash.
+                    //every entry point refuses hashes that are not content hashes
+                    //before touching the filesystem.
+                    bool put_chunk(const std::string& hash, const util::bytes&);
+
+                    bool has(const std::string& hash) const;
+                    bool get_chunk(const std::string& hash, util::bytes&) const;
+
+                    //joins the chunks back into the blob, false if any are missing
+                    bool get(const hash_list&, util::bytes&) const;
+                    void missing(const hash_list&, hash_set&) const;
+
+                private:
+                    void store(const std::string& hash, const char* data, size_t size);
+                    std::string chunk_file(const std::string& hash) const;
+
+                private:
+                    std::string _dir;
+                    mutable std::mutex _mutex;
+            };
+        }
+    }
+}
+
+#endif
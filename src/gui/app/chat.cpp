@@ -196,11 +196,7 @@ namespace fire
 
             void chat_app::send_all(const m::message& m)
             {
-                for(auto c : _conversation->contacts().list())
-                {
-                    CHECK(c);
-                    _sender->send(c->id(), m); 
-                }
+                _sender->send(_conversation->contacts(), m); 
             }
 
             void chat_app::join()
@@ -183,6 +183,8 @@ namespace fire
             m.type = n.type();
             m.address = n.id();
 
+            if(n.manifests()) _app_service->heard_manifests(n.from_id());
+
             if(_conversation->has_app(m.address)) return false;
             if(m.type.empty() || m.address.empty()) return false;
 
@@ -219,7 +221,28 @@ namespace fire
             {
                 if(auto post = _conversation->parent_post().lock())
                 {
-                    app = _app_service->create_app(u::decode<m::message>(n.data()));
+                    auto am = u::decode<m::message>(n.data());
+                    if(a::is_manifest(am))
+                    {
+                        //pull the chunks we don't have from whoever sent it
+                        //and finish adding the app once they arrive
+                        a::hash_set missing;
+                        app = _app_service->create_app_from_manifest(am, missing);
+                        if(!app)
+                        {
+                            if(missing.empty()) return false;
+
+                            LOG << "app " << n.id() << " needs " << missing.size() << " chunks" << std::endl;
+                            _pending_apps.erase(n.id());
+                            _pending_apps.emplace(n.id(), pending_app{n, missing});
+
+                            ms::request_chunks r{n.id(), {missing.begin(), missing.end()}};
+                            _conversation->send(n.from_id(), r);
+                            return false;
+                        }
+                    }
+                    else app = _app_service->create_app(am);
+
                     if(app->id().empty()) return false;
 
                     c = new a::script_app{
@@ -248,6 +271,44 @@ namespace fire
             return true;
         }
 
+        bool app_area::add_app_chunks(const ms::app_chunks& c) 
+        {
+            INVARIANT(_app_service);
+
+            //only chunks we asked the sender for are stored so a peer
+            //can't fill the disk with chunks nobody wants
+            auto pending = _pending_apps.find(c.app_address);
+            if(pending == _pending_apps.end()) return false;
+            if(pending->second.app.from_id() != c.from_id) return false;
+
+            auto& blobs = _app_service->blobs();
+            auto& missing = pending->second.missing;
+            size_t stored = 0;
+            for(const auto& p : c.chunks)
+            {
+                if(missing.count(p.first) == 0) 
+                {
+                    LOG << "dropping chunk that was not asked for " << p.first << std::endl;
+                    continue;
+                }
+
+                if(!blobs.put_chunk(p.first, p.second.as_bytes()))
+                {
+                    LOG << "dropping chunk that does not match hash " << p.first << std::endl;
+                    continue;
+                }
+                missing.erase(p.first);
+                stored++;
+            }
+
+            //nothing new arrived so asking again would loop
+            if(stored == 0) return false;
+
+            auto n = pending->second.app;
+            _pending_apps.erase(pending);
+            return add_new_app(n);
+        }
+
         void app_area::add_chat_app()
         {
             INVARIANT(_conversation);
@@ -321,19 +382,41 @@ namespace fire
                 //add widget mailbox to master
                 post->add(t->mail());
 
+                app_pair p{app, t};
+                _apps[t->mail()->address()] = p;
+
                 //send new app message to contacts in conversation
-                u::bytes encoded_app;
-                if(app)
+                if(!app)
                 {
-                    m::message app_message = *app;
-                    encoded_app = u::encode(app_message);
+                    ms::new_app n{t->id(), t->type()}; 
+                    _conversation->send(n);
+                    return;
                 }
 
-                app_pair p{app, t};
-                _apps[t->mail()->address()] = p;
+                //script apps go as a manifest to contacts that understand
+                //one and they pull the chunks they lack. everyone else gets
+                //the whole app.
+                us::users manifest_contacts;
+                us::users full_contacts;
+                for(auto c : _conversation->contacts().list())
+                {
+                    CHECK(c);
+                    if(_app_service->speaks_manifests(c->id())) manifest_contacts.push_back(c);
+                    else full_contacts.push_back(c);
+                }
+
+                if(!manifest_contacts.empty())
+                {
+                    ms::new_app n{t->id(), t->type(), u::encode(_app_service->app_manifest(*app))}; 
+                    _conversation->sender()->send(us::contact_list{manifest_contacts}, n);
+                }
 
-                ms::new_app n{t->id(), t->type(), encoded_app}; 
-                _conversation->send(n);
+                if(!full_contacts.empty())
+                {
+                    m::message app_message = *app;
+                    ms::new_app n{t->id(), t->type(), u::encode(app_message)}; 
+                    _conversation->sender()->send(us::contact_list{full_contacts}, n);
+                }
             }
         }
 
@@ -58,6 +58,14 @@ namespace fire
 
         using app_map = std::unordered_map<std::string, app_pair>; 
 
+        //a new app waiting on chunks and the chunks it asked for
+        struct pending_app
+        {
+            messages::new_app app;
+            app::hash_set missing;
+        };
+        using pending_app_map = std::unordered_map<std::string, pending_app>; 
+
         class app_sub_window : public QMdiSubWindow
         {
             Q_OBJECT
@@ -111,6 +119,7 @@ namespace fire
                     void add_script_app(const std::string& id);
                     void add(app::generic_app*);
                     bool add_new_app(const messages::new_app&); 
+                    bool add_app_chunks(const messages::app_chunks&); 
 
                     public slots:
                         void clear_alerts();
@@ -128,6 +137,9 @@ namespace fire
                     app::app_service_ptr _app_service;
                     app::app_reaper_ptr _app_reaper;
                     app_map _apps;
+
+                    //new apps waiting on chunks, by app address
+                    pending_app_map _pending_apps;
             };
         }
 }
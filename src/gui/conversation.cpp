@@ -200,6 +200,10 @@ namespace fire
                     bind(&conversation_widget::received_new_app, this, _1));
             _sm.handle(ms::REQ_APP, 
                     bind(&conversation_widget::received_req_app, this, _1));
+            _sm.handle(ms::REQ_CHUNKS, 
+                    bind(&conversation_widget::received_req_chunks, this, _1));
+            _sm.handle(ms::APP_CHUNKS, 
+                    bind(&conversation_widget::received_app_chunks, this, _1));
             _sm.handle(s::event::CONVERSATION_SYNCED, 
                     bind(&conversation_widget::received_conversation_synced, this, _1));
             _sm.handle(s::event::CONTACT_REMOVED, 
@@ -239,6 +243,30 @@ namespace fire
             got_req_app_message(m);
         }
 
+        void conversation_widget::received_req_chunks(const m::message& m)
+        {
+            REQUIRE_EQUAL(m.meta.type, ms::REQ_CHUNKS);
+
+            m::expect_remote(m);
+            m::expect_symmetric(m);
+            got_req_chunks_message(m);
+        }
+
+        void conversation_widget::received_app_chunks(const m::message& m)
+        {
+            REQUIRE_EQUAL(m.meta.type, ms::APP_CHUNKS);
+
+            INVARIANT(_app_area);
+            INVARIANT(_conversation);
+            INVARIANT(_conversation_service);
+
+            m::expect_remote(m);
+            m::expect_symmetric(m);
+
+            if(!_app_area->add_app_chunks(m)) return;
+            _conversation_service->fire_conversation_alert(_conversation->id(), false);
+        }
+
         void conversation_widget::received_conversation_synced(const m::message& m)
         {
             REQUIRE_EQUAL(m.meta.type, s::event::CONVERSATION_SYNCED);
@@ -376,6 +404,10 @@ namespace fire
             INVARIANT(_conversation);
             INVARIANT(_app_area);
 
+            auto service = _app_area->app_service();
+            CHECK(service);
+            if(m.manifests) service->heard_manifests(m.from_id);
+
             //find the app in the current conversation with the address specified
             auto a = _conversation->apps().find(m.app_address);
 
@@ -383,7 +415,8 @@ namespace fire
 
             const auto& ad = a->second;
 
-            //encode app from app catalog if it is a script app
+            //encode app from app catalog if it is a script app, as a 
+            //manifest if the requester understands one
             u::bytes encoded_app;
             if(ad.type == SCRIPT_APP)
             {
@@ -391,8 +424,7 @@ namespace fire
                 if(ap == _app_area->apps().end()) return;
 
                 CHECK(ap->second.app);
-                m::message app_message = *ap->second.app;
-                encoded_app = u::encode(app_message);
+                encoded_app = u::encode(service->app_message_for(*ap->second.app, m.from_id));
             }
 
             //send the app back to the person who requested it.
@@ -400,6 +432,34 @@ namespace fire
             _conversation->send(m.from_id, n);
         }
 
+        void conversation_widget::got_req_chunks_message(const messages::request_chunks& m)
+        {
+            INVARIANT(_conversation);
+            INVARIANT(_app_area);
+
+            //only serve chunks of the app named, so a member can't pull
+            //chunks of apps in other conversations or probe the cache
+            if(!_conversation->has_app(m.app_address)) return;
+
+            auto ap = _app_area->apps().find(m.app_address);
+            if(ap == _app_area->apps().end() || !ap->second.app) return;
+
+            auto service = _app_area->app_service();
+            CHECK(service);
+
+            a::hash_set allowed;
+            a::manifest_chunks(service->app_manifest(*ap->second.app), allowed);
+
+            auto& blobs = service->blobs();
+
+            ms::app_chunks r{m.app_address};
+            u::bytes chunk;
+            for(const auto& h : m.hashes)
+                if(allowed.count(h) && blobs.get_chunk(h, chunk)) r.chunks[h] = chunk;
+
+            _conversation->send(m.from_id, r);
+        }
+
         void conversation_widget::add_chat_app()
         {
             INVARIANT(_app_area);
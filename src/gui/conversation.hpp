@@ -84,6 +84,8 @@ namespace fire
             private:
                 void init_handlers();
                 void received_new_app(const fire::message::message&);
+                void received_req_chunks(const fire::message::message&);
+                void received_app_chunks(const fire::message::message&);
                 void received_req_app(const fire::message::message&);
                 void received_conversation_synced(const fire::message::message&);
                 void received_contact_removed(const fire::message::message&);
@@ -93,6 +95,7 @@ namespace fire
                 void received_contact_activity_changed(const fire::message::message&);
                 void sync_apps();
                 void got_req_app_message(const messages::request_app&);
+                void got_req_chunks_message(const messages::request_chunks&);
                 void notify_apps_contact_quit(const std::string& id);
 
             private:
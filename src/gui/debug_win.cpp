@@ -291,7 +291,12 @@ namespace fire
 
             s << " sent: " << (_udp_stats.bytes_sent / 1024) << "kb (" << (bytes_sent_per_second / 1024) << "/s)" 
               << " recv: " << (_udp_stats.bytes_recv / 1024) << " kb (" << (bytes_recv_per_second / 1024) << "/s)"
-              << " dropped: " << _udp_stats.dropped << " (" << dropped_per_second << "/s)";
+              << " dropped: " << _udp_stats.dropped << " (" << dropped_per_second << "/s)"
+              << " cwnd: " << _udp_stats.cwnd 
+              << " srtt: " << _udp_stats.srtt << "ms"
+              << " losses: " << _udp_stats.losses
+              << " queued: " << (_udp_stats.queued_bytes / 1024) << "kb"
+              << " rejected: " << _udp_stats.send_rejected;
             _udp_stat_text->setText(s.str().c_str());
             _prev_udp_stats = _udp_stats;
         }
@@ -34,6 +34,7 @@
 #include "util/dbc.hpp"
 #include "util/env.hpp"
 #include "util/log.hpp"
+#include "util/uuid.hpp"
 
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
@@ -143,6 +144,7 @@ namespace fire
                     .set("audio_encoder", &lua_api::make_audio_encoder)
                     .set("audio_decoder", &lua_api::make_audio_decoder)
                     .set("vclock", &lua_api::make_vclock)
+                    .set("shared_text", &lua_api::make_shared_text)
                     .set("place", &lua_api::place)
                     .set("place_across", &lua_api::place_across)
                     .set("height", &lua_api::height)
@@ -216,6 +218,9 @@ namespace fire
                     .set("set_vclock", &store_ref::set_vclock)
                     .set("has", &store_ref::has)
                     .set("remove", &store_ref::remove)
+                    .set("begin", &store_ref::begin)
+                    .set("commit", &store_ref::commit)
+                    .set("rollback", &store_ref::rollback)
                     .set("set", store_ref_set)
                     .set("get", store_ref_get);
 
@@ -407,6 +412,15 @@ namespace fire
                     .set("comp", &vclock_wrapper::compare)
                     .set("equals", &vclock_wrapper::same);
 
+                SLB::Class<shared_text_wrapper>{"shared_text", &manager}
+                    .set("str", &shared_text_wrapper::str)
+                    .set("size", &shared_text_wrapper::size)
+                    .set("insert", &shared_text_wrapper::insert)
+                    .set("remove", &shared_text_wrapper::remove)
+                    .set("set", &shared_text_wrapper::set)
+                    .set("apply", &shared_text_wrapper::apply)
+                    .set("state", &shared_text_wrapper::state);
+
                 state = std::make_shared<SLB::Script>(&manager);
                 state->set("app", this);
                 state->set("store", local_data.get());
@@ -664,22 +678,14 @@ namespace fire
             {
                 INVARIANT(sender);
                 INVARIANT(conversation);
-                for(auto c : conversation->contacts().list())
-                {
-                    CHECK(c);
-                    sender->send(c->id(), m);
-                }
+                sender->send(conversation->contacts(), m);
             }
 
             void lua_api::send(const event_message& m)
             {
                 INVARIANT(sender);
                 INVARIANT(conversation);
-                for(auto c : conversation->contacts().list())
-                {
-                    CHECK(c);
-                    sender->send(c->id(), m);
-                }
+                sender->send(conversation->contacts(), m);
             }
 
             void lua_api::send_simple_event(const std::string& name, const std::string& type)
@@ -1235,6 +1241,13 @@ namespace fire
                 return vclock_wrapper{conversation->user_service()->user().info().id()};
             }
 
+            shared_text_wrapper lua_api::make_shared_text()
+            {
+                //each text gets its own site so a restarted app never
+                //reuses the sequence numbers of its earlier ops
+                return shared_text_wrapper{u::uuid()};
+            }
+
             speaker_ref lua_api::make_speaker(const std::string& codec)
             {
                 INVARIANT(front);
@@ -162,6 +162,7 @@ namespace fire
                     opus_encoder_wrapper make_audio_encoder();
                     opus_decoder_wrapper make_audio_decoder();
                     vclock_wrapper make_vclock();
+                    shared_text_wrapper make_shared_text();
 
                     //grid
                     grid_ref make_grid();
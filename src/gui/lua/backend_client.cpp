@@ -382,12 +382,7 @@ namespace fire
                 INVARIANT(_api->conversation);
 
                 contact_joined_msg j;
-                auto m = j.to_message();
-                for(auto c : _api->conversation->contacts().list())
-                {
-                    CHECK(c);
-                    _api->sender->send(c->id(), m);
-                }
+                _api->sender->send(_api->conversation->contacts(), j.to_message());
             }
 
             void backend_client::received_contact_joined(const m::message& m)
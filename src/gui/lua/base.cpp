@@ -458,45 +458,49 @@ namespace fire
             }
 
 
-            store_ref::store_ref(u::disk_store& d) : _d(d){}
+            store_ref::store_ref(u::disk_store& d) : _d(d)
+            {
+                //the app thread should never wait on the disk
+                _d.write_behind(true);
+            }
 
             std::string store_ref::get(const std::string& k) const
             {
-                if(!_d.has(k)) return "";
-                return _d.get(k).as_string();
+                if(!has(k)) return "";
+                return get_value(k).as_string();
             }
 
             void store_ref::set(const std::string& k, const std::string& v) 
             {
-                _d.set(k, v);
+                set_value(k, v);
             }
 
             bin_data store_ref::get_bin(const std::string& k) const
 
             {
-                if(!_d.has(k)) return bin_data{};
+                if(!has(k)) return bin_data{};
 
-                auto v = _d.get(k);
+                auto v = get_value(k);
                 if(!v.is_bytes()) return bin_data{};
                 return bin_data{v.as_bytes()};
             }
 
             void store_ref::set_bin(const std::string& k, const bin_data& v) 
             {
-                _d.set(k,v.data);
+                set_value(k,v.data);
             }
 
             void store_ref::set_vclock(const std::string& k, const vclock_wrapper& c)
             {
-                _d.set(k, u::to_dict(c.clock()));
+                set_value(k, u::to_dict(c.clock()));
             }
 
             vclock_wrapper store_ref::get_vclock(const std::string& k) const
             try
             {
-                if(!_d.has(k)) return vclock_wrapper{};
+                if(!has(k)) return vclock_wrapper{};
                 
-                auto v = _d.get(k);
+                auto v = get_value(k);
                 if(!v.is_dict()) return vclock_wrapper{};
                 return vclock_wrapper{u::to_tracked_sclock(v.as_dict())};
             }
@@ -507,17 +511,87 @@ namespace fire
 
             bool store_ref::has(const std::string& k) const
             {
+                if(_in_tx)
+                {
+                    auto w = _tx.find(k);
+                    if(w != _tx.end()) return !w->second.removed;
+                }
                 return _d.has(k);
             }
 
             bool store_ref::remove(const std::string& k)
             {
-                return _d.remove(k);
+                if(!_in_tx) return _d.remove(k);
+                if(!has(k)) return false;
+
+                auto& w = _tx[k];
+                w.v = u::value{};
+                w.removed = true;
+                return true;
             }
 
             size_t store_ref::size() const
             {
-                return _d.size();
+                auto n = _d.size();
+                if(!_in_tx) return n;
+
+                for(const auto& p : _tx)
+                {
+                    const bool stored = _d.has(p.first);
+                    if(p.second.removed && stored) n--;
+                    else if(!p.second.removed && !stored) n++;
+                }
+                return n;
+            }
+
+            void store_ref::begin()
+            {
+                //transactions don't nest, a second begin joins the first
+                _in_tx = true;
+            }
+
+            bool store_ref::commit()
+            {
+                if(!_in_tx) return false;
+
+                _d.apply(_tx);
+                _tx.clear();
+                _in_tx = false;
+                return true;
+            }
+
+            void store_ref::rollback()
+            {
+                _tx.clear();
+                _in_tx = false;
+            }
+
+            bool store_ref::in_transaction() const
+            {
+                return _in_tx;
+            }
+
+            u::value store_ref::get_value(const std::string& k) const
+            {
+                if(_in_tx)
+                {
+                    auto w = _tx.find(k);
+                    if(w != _tx.end()) return w->second.v;
+                }
+                return _d.get(k);
+            }
+
+            void store_ref::set_value(const std::string& k, const u::value& v)
+            {
+                if(!_in_tx) 
+                {
+                    _d.set(k, v);
+                    return;
+                }
+
+                auto& w = _tx[k];
+                w.v = v;
+                w.removed = false;
             }
 
             const util::disk_store& store_ref::store() const
@@ -677,7 +751,7 @@ namespace fire
 
                 //set value
                 u::value v = to_value(L, 3);
-                r->store().set(key, v);
+                r->set_value(key, v);
 
                 return 0;
             }
@@ -696,10 +770,10 @@ namespace fire
 
                 //get key
                 std::string key = lua_tostring(L, 2);
-                if(!r->store().has(key)) { lua_pushnil(L); return 1;} 
+                if(!r->has(key)) { lua_pushnil(L); return 1;} 
 
                 //return value
-                auto v = r->store().get(key);
+                auto v = r->get_value(key);
                 push_value(L, v);
                 return 1;
             }
@@ -794,6 +868,49 @@ namespace fire
             {
                 return _c.identical(o._c);
             }
+
+            shared_text_wrapper::shared_text_wrapper(const std::string& site) : _t{site} {}
+
+            std::string shared_text_wrapper::str() const
+            {
+                return _t.str();
+            }
+
+            size_t shared_text_wrapper::size() const
+            {
+                return _t.size();
+            }
+
+            bin_data shared_text_wrapper::insert(size_t pos, const std::string& s)
+            {
+                return {u::encode_text_ops(_t.insert(pos, s))};
+            }
+
+            bin_data shared_text_wrapper::remove(size_t pos, size_t size)
+            {
+                return {u::encode_text_ops(_t.remove(pos, size))};
+            }
+
+            bin_data shared_text_wrapper::set(const std::string& s)
+            {
+                return {u::encode_text_ops(_t.set(s))};
+            }
+
+            bool shared_text_wrapper::apply(const bin_data& d)
+            try
+            {
+                return _t.apply(u::decode_text_ops(d.data));
+            }
+            catch(std::exception& e)
+            {
+                LOG << "error applying shared text ops: " << e.what() << std::endl;
+                return false;
+            }
+
+            bin_data shared_text_wrapper::state() const
+            {
+                return {u::encode_text_ops(_t.state())};
+            }
         }
     }
 }
@@ -40,6 +40,7 @@
 #include "messages/sender.hpp"
 
 #include "util/audio.hpp"
+#include "util/crtext.hpp"
 #include "util/vclock.hpp"
 #include "util/disk_store.hpp"
 
@@ -213,12 +214,26 @@ namespace fire
                     bool remove(const std::string&);
                     size_t size() const;
 
+                public:
+                    //writes between begin and commit are applied together
+                    //or not at all. reads in between see them.
+                    void begin();
+                    bool commit();
+                    void rollback();
+                    bool in_transaction() const;
+
+                public:
+                    util::value get_value(const std::string&) const;
+                    void set_value(const std::string&, const util::value&);
+
                 public:
                     const util::disk_store& store() const;
                     util::disk_store& store();
 
                 private:
                     util::disk_store& _d;
+                    util::store_batch _tx;
+                    bool _in_tx = false;
             };
 
             class opus_encoder_wrapper
@@ -262,6 +277,27 @@ namespace fire
                     util::tracked_sclock _c;
             };
 
+            class shared_text_wrapper
+            {
+                public:
+                    shared_text_wrapper(const std::string& site);
+
+                public:
+                    std::string str() const;
+                    size_t size() const;
+
+                    //edits return the ops to send to the other replicas
+                    bin_data insert(size_t pos, const std::string&);
+                    bin_data remove(size_t pos, size_t size);
+                    bin_data set(const std::string&);
+
+                    bool apply(const bin_data&);
+                    bin_data state() const;
+
+                private:
+                    util::cr_text _t;
+            };
+
             int store_ref_set(lua_State* L);
             int store_ref_get(lua_State* L);
             int script_message_set(lua_State* L);
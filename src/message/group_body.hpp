@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#ifndef FIRESTR_MESSAGE_GROUP_BODY_H
+#define FIRESTR_MESSAGE_GROUP_BODY_H
+
+#include "message/message.hpp"
+#include "security/security.hpp"
+
+#include <mutex>
+
+namespace fire
+{
+    namespace message
+    {
+        /**
+         * The body of a group message shared by the copies going to each
+         * peer. The first copy through the pipeline encodes, compresses
+         * and encrypts it under the group key. The rest only wrap the key
+         * for their peer.
+         */
+        struct group_body
+        {
+            message m;
+            security::group_secret_ptr secret;
+            util::bytes sealed;
+            bool is_sealed = false;
+            std::mutex mutex;
+        };
+    }
+}
+
+#endif
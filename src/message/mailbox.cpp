@@ -31,6 +31,8 @@
 #include "message/mailbox.hpp"
 #include "util/dbc.hpp"
 
+#include <algorithm>
+
 namespace fire
 {
     namespace message
@@ -40,6 +42,9 @@ namespace fire
             in_pop_count{0},
             out_push_count{0},
             out_pop_count{0},
+            out_rejected{0},
+            out_over{0},
+            out_peak{0},
             on{false}
         {
         }
@@ -51,6 +56,9 @@ namespace fire
             out_push_count = 0;
             in_pop_count = 0;
             out_pop_count = 0;
+            out_rejected = 0;
+            out_over = 0;
+            out_peak = 0;
         }
 
         mailbox::mailbox() : _m{} { }
@@ -75,6 +83,12 @@ namespace fire
             _m.push_inbox(m);
         }
 
+        void mailbox::push_inbox(message&& m)
+        {
+            if(_stats.on) _stats.in_push_count++;
+            _m.push_inbox(std::move(m));
+        }
+
         bool mailbox::pop_inbox(message& m, bool wait)
         {
             const bool p = _m.pop_inbox(m, wait);
@@ -82,10 +96,20 @@ namespace fire
             return p;
         }
 
-        void mailbox::push_outbox(const message& m)
+        util::push_result mailbox::push_outbox(const message& m)
         {
-            if(_stats.on) _stats.out_push_count++;
-            _m.push_outbox(m);
+            const auto r = _m.push_outbox(m);
+            if(!_stats.on) return r;
+
+            switch(r)
+            {
+                case util::push_result::rejected: _stats.out_rejected++; return r;
+                case util::push_result::over: _stats.out_over++; break;
+                default: break;
+            }
+            _stats.out_push_count++;
+            _stats.out_peak = std::max(_stats.out_peak, _m.out_size());
+            return r;
         }
 
         bool mailbox::pop_outbox(message& m, bool wait)
@@ -95,6 +119,21 @@ namespace fire
             return p;
         }
 
+        void mailbox::notify_outbox(util::event_ptr e)
+        {
+            _m.notify_outbox(e);
+        }
+
+        void mailbox::limits(const util::watermarks& w)
+        {
+            _m.out_limits(w);
+        }
+
+        util::watermarks mailbox::limits() const
+        {
+            return _m.out_occupancy().limits();
+        }
+
         size_t mailbox::in_size() const
         {
             return _m.in_size();
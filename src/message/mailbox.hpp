@@ -52,6 +52,9 @@ namespace fire
             size_t in_pop_count;
             size_t out_push_count;
             size_t out_pop_count;
+            size_t out_rejected; //pushes dropped over the high watermark
+            size_t out_over; //pushes taken over the high watermark
+            size_t out_peak; //most messages in the outbox
             bool on;
 
             void reset();
@@ -69,11 +72,17 @@ namespace fire
 
             public:
                 void push_inbox(const message&);
+                void push_inbox(message&&);
                 bool pop_inbox(message&, bool wait = false);
 
             public:
-                void push_outbox(const message&);
+                util::push_result push_outbox(const message&);
                 bool pop_outbox(message&, bool wait = false);
+                void notify_outbox(util::event_ptr);
+
+                //bounds the outbox, in messages
+                void limits(const util::watermarks&);
+                util::watermarks limits() const;
 
             public:
                 const mailbox_stats& stats() const;
@@ -88,7 +97,11 @@ namespace fire
                 void done();
 
             private:
+#ifdef FIRESTR_RING_QUEUES
+                util::mailbox<message, util::mpsc_queue> _m;
+#else
                 util::mailbox<message> _m;
+#endif
                 mailbox_stats _stats;
         };
 
@@ -29,11 +29,16 @@
  * also delete it here.
  */
 #include "message/master_post.hpp"
+#include "message/message_view.hpp"
 #include "util/bytes.hpp"
 #include "util/compress.hpp"
 #include "util/dbc.hpp"
 #include "util/log.hpp"
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <functional>
 #include <sstream>
 
 namespace n = fire::network;
@@ -47,11 +52,31 @@ namespace fire
 
         namespace
         {
-            const double MIN_THREAD_SLEEP = 1; //in milliseconds 
-            const double MAX_THREAD_SLEEP = 51; //in milliseconds 
-            const double SLEEP_STEP = 5;
-            const double QUIT_SLEEP = 500;
             const size_t POOL_SIZE = 30; //small pool size for now
+            const size_t MAX_PIPELINE_THREADS = 16; //in threads
+            const size_t LANES_PER_THREAD = 4; //peers hash to lanes, more lanes means fewer collisions
+            const size_t IN_FLIGHT_PER_THREAD = 4; //in messages, keeps every stage busy
+            const std::string MENCODE_KEY = "mencode"; //extra key text messages offer binary mencode with
+            const std::string GROUP_KEY = "group"; //extra key messages offer group encryption with
+            const size_t MAX_GROUP_SECRETS = 1024; //in groups, the cache starts over past this
+            const size_t PEER_QUEUE_LIMIT = 8*1024*1024; //in bytes a destination may have waiting in the scheduler
+            const size_t PEER_SEND_LIMIT = 8*1024*1024; //in bytes a peer may have waiting in the udp queue
+        }
+
+        //sends run on the pipeline threads, so a full peer drops the
+        //message instead of blocking every lane behind it
+        n::queue_options pipeline_udp_options()
+        {
+            return {
+                {"peer_high", std::to_string(PEER_SEND_LIMIT)},
+                {"peer_overflow", "reject"}};
+        }
+
+        using pipeline_clock = std::chrono::steady_clock;
+
+        double micros_since(pipeline_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::micro>(pipeline_clock::now() - start).count();
         }
 
         metadata::encryption_type to_message_encryption_type(sc::encryption_type s)
@@ -71,74 +96,129 @@ namespace fire
         try
         {
             REQUIRE(o);
-            REQUIRE(o->_encrypted_channels);
+            REQUIRE(o->_io);
 
-            double thread_sleep = MIN_THREAD_SLEEP;
-
-            n::endpoint ep;
             while(!o->_done)
             try
             {
-                //get data from outside world
-                u::bytes data;
-                if(!o->_connections.receive(ep, data))
-                {
-                    u::sleep_thread(thread_sleep);
-                    thread_sleep = std::min(MAX_THREAD_SLEEP, thread_sleep + SLEEP_STEP);
-                    continue;
-                }
-                thread_sleep = MIN_THREAD_SLEEP;
+                //get data from outside world, waits until something arrives
+                auto w = std::make_shared<incoming_work>();
+                if(!o->_connections.receive(w->ep, w->data, true)) continue;
 
                 if(o->_outside_stats.on) o->_outside_stats.in_push_count++;
 
-                //construct address as conversation id and decrypt message
-                auto sid = n::make_address_str(ep);
+                //a peer's data always goes through the same lane so it
+                //is decrypted and delivered in order
+                w->started = pipeline_clock::now();
+                w->address = n::make_address_str(w->ep);
+                w->lane = o->lane_for(w->address);
+                o->_lanes[w->lane]->decrypt.post(boost::bind(&master_post_office::decrypt_stage, o, w));
+            }
+            catch(std::exception& e)
+            {
+                LOG << "error recieving message: " << e.what() << std::endl;
+            }
+            catch(...)
+            {
+                LOG << "error recieving message: unknown error." << std::endl;
+            }
+        }
+        catch(...)
+        {
+            LOG << "exit: master_post::in_thread" << std::endl;
+        }
+
+        void master_post_office::decrypt_stage(incoming_work_ptr w)
+        try
+        {
+            REQUIRE(w);
+            REQUIRE(_encrypted_channels);
+
+            const auto start = pipeline_clock::now();
 
-                sc::encryption_type et;
-                data = o->_encrypted_channels->decrypt(sid, data, et);
+            //construct address as conversation id and decrypt message
+            w->group = !w->data.empty() && w->data.front() == sc::encryption_type::group;
+            w->data = _encrypted_channels->decrypt(w->address, w->data, w->et);
+            _stats.decrypt.add(micros_since(start));
 
-                //could not decrypt, skip
-                if(data.empty()) continue;
+            //could not decrypt, skip
+            if(w->data.empty()) return;
 
-                //uncompress decrypted data
-                data = u::uncompress(data);
+            _lanes[w->lane]->decode.post(boost::bind(&master_post_office::decode_stage, this, w));
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error decrypting message from " << w->ep.address << ":" << w->ep.port << ". " << e.what() << std::endl;
+        }
+        catch(...)
+        {
+            LOG << "error decrypting message from " << w->ep.address << ":" << w->ep.port << ". unknown error." << std::endl;
+        }
 
-                //unable to decompress, skip
-                if(data.empty()) continue;
+        void master_post_office::decode_stage(incoming_work_ptr w)
+        try
+        {
+            REQUIRE(w);
 
-                //parse message
-                message m;
-                u::decode(data, m);
+            const auto start = pipeline_clock::now();
+            const auto& ep = w->ep;
 
-                //skip bad message
-                if(m.meta.to.empty()) continue;
+            //uncompress decrypted data
+            auto data = std::make_shared<u::bytes>(u::uncompress(w->data));
+            w->data.clear();
 
-                //insert the from_ip, from_port and other metadata
-                m.meta.extra["from_protocol"] = ep.protocol;
-                m.meta.extra["from_ip"] = ep.address;
-                m.meta.extra["from_port"] = ep.port;
-                m.meta.encryption = to_message_encryption_type(et);
-                m.meta.source = metadata::remote;
+            //unable to decompress, skip
+            if(data->empty()) return;
 
-                //pop off master address
-                m.meta.to.pop_front();
+            //parse the addresses only
+            message_view v{data};
+            data.reset();
 
-                //send message to interal component
-                o->send(m);
-                if(o->_outside_stats.on) o->_outside_stats.in_pop_count++;
-            }
-            catch(std::exception& e)
-            {
-                LOG << "error recieving message from " << ep.address << ":" << ep.port << ". " << e.what() << std::endl;
-            }
-            catch(...)
+            //skip bad message and messages nothing here can receive
+            //before decoding the rest of it
+            if(v.to().empty()) return;
+            if(!has_route(std::next(v.to().begin()), v.to().end())) return;
+
+            //what the peer understands, answer with it from now on
+            int features = 0;
+            if(v.version() == MENCODE_V2 || v.extra().has(MENCODE_KEY)) features |= binary_mencode;
+            if(v.extra().has(GROUP_KEY)) features |= group_encryption;
+            if(w->group) features |= group_encryption | sent_group;
+
+            message m;
+            v.move_to(m);
+
+            if(features) 
             {
-                LOG << "error recieving message from " << ep.address << ":" << ep.port << ". unknown error." << std::endl;
+                heard(w->address, features);
+                m.meta.extra.remove(MENCODE_KEY);
+                m.meta.extra.remove(GROUP_KEY);
             }
+
+            //insert the from_ip, from_port and other metadata
+            m.meta.extra["from_protocol"] = ep.protocol;
+            m.meta.extra["from_ip"] = ep.address;
+            m.meta.extra["from_port"] = ep.port;
+            m.meta.encryption = to_message_encryption_type(w->et);
+            m.meta.source = metadata::remote;
+
+            //pop off master address
+            m.meta.to.pop_front();
+
+            //send message to interal component
+            send(std::move(m));
+            if(_outside_stats.on) _outside_stats.in_pop_count++;
+
+            _stats.decode.add(micros_since(start));
+            _stats.incoming.add(micros_since(w->started));
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error recieving message from " << w->ep.address << ":" << w->ep.port << ". " << e.what() << std::endl;
         }
         catch(...)
         {
-            LOG << "exit: master_post::in_thread" << std::endl;
+            LOG << "error recieving message from " << w->ep.address << ":" << w->ep.port << ". unknown error." << std::endl;
         }
 
         void encrypt_message(
@@ -175,97 +255,375 @@ namespace fire
         }
 
 
-        void out_thread(master_post_office* o)
+        //encodes, compresses and encrypts a group body the first time
+        //a copy of it gets here
+        void seal(group_body& b)
+        {
+            std::lock_guard<std::mutex> lock(b.mutex);
+            if(b.is_sealed) return;
+
+            REQUIRE(b.secret);
+            b.sealed = b.secret->encrypt(u::compress(encode_message(b.m, MENCODE_V2)));
+            b.is_sealed = true;
+        }
+
+        void dispatch_thread(master_post_office* o)
         try
         {
             REQUIRE(o);
-
-            std::string last_address;
+            REQUIRE(o->_dispatch_event);
 
             while(!o->_done)
-            try
             {
-                //get message from queue
-                message m;
-                if(!o->_out.pop(m, true))
-                    continue;
+                //take the count before looking so a new message or room
+                //in the pipeline wakes us up again
+                const auto seen = o->_dispatch_event->count();
 
-                REQUIRE_GREATER_EQUAL(m.meta.from.size(), 1);
-                REQUIRE_GREATER_EQUAL(m.meta.to.size(), 1);
+                //only let a few messages into the pipeline at once so the
+                //scheduler still decides the order they go out in
+                while(o->_in_flight < o->_max_in_flight)
+                {
+                    auto w = std::make_shared<outgoing_work>();
+                    if(!o->_out.pop(w->m)) break;
 
-                const std::string outside_queue_address = m.meta.to.front();
-                last_address = outside_queue_address;
+                    CHECK_FALSE(w->m.meta.to.empty());
 
-                //encode, compress, and encrypt message
-                auto data = u::encode(m);
-                data = u::compress(data);
+                    o->_in_flight++;
+                    w->started = pipeline_clock::now();
+                    w->lane = o->lane_for(w->m.meta.to.front());
+                    o->_lanes[w->lane]->encode.post(boost::bind(&master_post_office::encode_stage, o, w));
+                }
 
-                encrypt_message(
-                        data, 
-                        m, 
-                        outside_queue_address,
-                        *o->_encrypted_channels);
+                if(!o->_dispatch_event->wait(seen)) break;
+            }
+        }
+        catch(...)
+        {
+            LOG << "exit: master_post::dispatch_thread" << std::endl;
+        }
 
-                //send message over wire
-                o->_connections.send(outside_queue_address, data, m.meta.robust);
+        void master_post_office::encode_stage(outgoing_work_ptr w)
+        try
+        {
+            REQUIRE(w);
+            REQUIRE_GREATER_EQUAL(w->m.meta.from.size(), 1);
+            REQUIRE_GREATER_EQUAL(w->m.meta.to.size(), 1);
 
-                if(o->_outside_stats.on) o->_outside_stats.out_pop_count++;
+            //a group copy's body is encoded once for every peer when it 
+            //is encrypted
+            if(w->m.meta.body)
+            {
+                _lanes[w->lane]->encrypt.post(boost::bind(&master_post_office::encrypt_stage, this, w));
+                return;
             }
-            catch(std::exception& e)
+
+            const auto start = pipeline_clock::now();
+            encode(*w);
+            _stats.encode.add(micros_since(start));
+            _lanes[w->lane]->encrypt.post(boost::bind(&master_post_office::encrypt_stage, this, w));
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error encoding message to " << (w->m.meta.to.empty() ? "" : w->m.meta.to.front()) << ": " << e.what() << std::endl;
+            sent();
+        }
+        catch(...)
+        {
+            LOG << "error encoding message to " << (w->m.meta.to.empty() ? "" : w->m.meta.to.front()) << ": unknown error." << std::endl;
+            sent();
+        }
+
+        void master_post_office::encode(outgoing_work& w)
+        {
+            const auto& peer = w.m.meta.to.front();
+
+            //offered until the peer sends a group message, which shows
+            //it heard the offer
+            if(!speaks(peer, sent_group)) w.m.meta.extra[GROUP_KEY] = 1;
+
+            //binary mencode once the peer has shown it understands it,
+            //until then text mencode offering it
+            if(speaks(peer, binary_mencode)) w.data = encode_message(w.m, MENCODE_V2);
+            else
             {
-                LOG << "error sending message to " << last_address << ": " << e.what() << std::endl;
+                w.m.meta.extra[MENCODE_KEY] = MENCODE_V2;
+                w.data = encode_message(w.m, MENCODE_V1);
             }
-            catch(...)
+
+            //compress message
+            w.data = u::compress(w.data);
+        }
+
+        void master_post_office::encrypt_stage(outgoing_work_ptr w)
+        try
+        {
+            REQUIRE(w);
+            REQUIRE(_encrypted_channels);
+
+            const auto start = pipeline_clock::now();
+
+            if(w->m.meta.body)
             {
-                LOG << "error sending message to " << last_address << ": unknown error." << std::endl;
+                auto& b = *w->m.meta.body;
+                seal(b);
+                w->data = _encrypted_channels->encrypt_group(w->m.meta.to.front(), *b.secret, b.sealed);
+
+                //no channel to wrap the key with, so the peer gets its
+                //own copy instead and the key never leaves unwrapped. it
+                //is encoded right here so it keeps its place in the lane.
+                if(w->data.empty())
+                {
+                    message c;
+                    c.meta = b.m.meta;
+                    c.meta.to.front() = w->m.meta.to.front();
+                    c.meta.body = nullptr;
+                    c.data = b.m.data;
+                    w->m = c;
+
+                    encode(*w);
+                    encrypt_message(
+                            w->data, 
+                            w->m, 
+                            w->m.meta.to.front(),
+                            *_encrypted_channels);
+                }
             }
-            u::sleep_thread(QUIT_SLEEP);
+            else encrypt_message(
+                    w->data, 
+                    w->m, 
+                    w->m.meta.to.front(),
+                    *_encrypted_channels);
+
+            _stats.encrypt.add(micros_since(start));
+            _lanes[w->lane]->send.post(boost::bind(&master_post_office::send_stage, this, w));
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error encrypting message to " << w->m.meta.to.front() << ": " << e.what() << std::endl;
+            sent();
         }
         catch(...)
         {
-            LOG << "exit: master_post::out_thread" << std::endl;
+            LOG << "error encrypting message to " << w->m.meta.to.front() << ": unknown error." << std::endl;
+            sent();
+        }
+
+        void master_post_office::send_stage(outgoing_work_ptr w)
+        try
+        {
+            REQUIRE(w);
+
+            const auto start = pipeline_clock::now();
+
+            //send message over wire. a full peer drops the message
+            //rather than block, see pipeline_udp_options
+            _connections.send(w->m.meta.to.front(), w->data, w->m.meta.robust);
+
+            _stats.send.add(micros_since(start));
+            _stats.outgoing.add(micros_since(w->started));
+            if(_outside_stats.on) _outside_stats.out_pop_count++;
+            sent();
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error sending message to " << w->m.meta.to.front() << ": " << e.what() << std::endl;
+            sent();
+        }
+        catch(...)
+        {
+            LOG << "error sending message to " << w->m.meta.to.front() << ": unknown error." << std::endl;
+            sent();
+        }
+
+        void master_post_office::sent()
+        {
+            INVARIANT(_dispatch_event);
+            CHECK_GREATER(_in_flight, 0);
+
+            //room for the next message
+            _in_flight--;
+            _dispatch_event->signal();
+        }
+
+        size_t pipeline_thread_count(size_t threads)
+        {
+            size_t n = threads > 0 ? threads : std::thread::hardware_concurrency();
+            if(n == 0) n = 1;
+            return std::min(n, MAX_PIPELINE_THREADS);
+        }
+
+        void pipeline_thread(boost::asio::io_service* io)
+        try
+        {
+            REQUIRE(io);
+            io->run();
+        }
+        catch(...)
+        {
+            LOG << "exit: master_post::pipeline_thread" << std::endl;
         }
 
         master_post_office::master_post_office(
                 const std::string& in_host,
                 n::port_type in_port,
-                sc::encrypted_channels_ptr sl) : 
+                sc::encrypted_channels_ptr sl,
+                size_t threads) : 
             _in_host(in_host),
             _in_port{in_port},
-            _connections{POOL_SIZE, in_port, false},
-            _encrypted_channels{sl}
+            _connections{POOL_SIZE, in_port, false, pipeline_udp_options()},
+            _encrypted_channels{sl},
+            _dispatch_event{std::make_shared<u::event>()},
+            _io{new boost::asio::io_service}
         {
             _address = n::make_udp_address(_in_host,_in_port);
 
+            const auto pool = pipeline_thread_count(threads);
+            _max_in_flight = pool * IN_FLIGHT_PER_THREAD;
+
+            _work.reset(new boost::asio::io_service::work{*_io});
+            for(size_t i = 0; i < pool * LANES_PER_THREAD; i++) 
+                _lanes.emplace_back(new pipeline_lane{*_io});
+            for(size_t i = 0; i < pool; i++) 
+                _pool.emplace_back(new std::thread{pipeline_thread, _io.get()});
+
+            _out.limit(PEER_QUEUE_LIMIT);
+            _out.notify(_dispatch_event);
+            _dispatch_thread.reset(new std::thread{dispatch_thread, this});
             _in_thread.reset(new std::thread{in_thread, this});
-            _out_thread.reset(new std::thread{out_thread, this});
 
             ENSURE(_in_thread);
-            ENSURE(_out_thread);
+            ENSURE(_dispatch_thread);
+            ENSURE_FALSE(_lanes.empty());
+            ENSURE_FALSE(_pool.empty());
             ENSURE_FALSE(_address.empty());
         }
 
         master_post_office::~master_post_office()
         {
             INVARIANT(_in_thread);
-            INVARIANT(_out_thread);
+            INVARIANT(_dispatch_thread);
+            INVARIANT(_io);
 
             _done = true;
-            _out.done();
+            _dispatch_event->done();
+            _connections.done();
+            _dispatch_thread->join();
             _in_thread->join();
-            _out_thread->join();
+
+            _work.reset();
+            _io->stop();
+            for(auto& t : _pool) t->join();
+        }
+
+        size_t master_post_office::lane_for(const std::string& address) const
+        {
+            INVARIANT_FALSE(_lanes.empty());
+            return std::hash<std::string>{}(address) % _lanes.size();
+        }
+
+        bool master_post_office::speaks(const std::string& address, peer_feature f) const
+        {
+            u::mutex_scoped_lock l(_features_mutex);
+            auto p = _peer_features.find(address);
+            return p != _peer_features.end() && (p->second & f);
+        }
+
+        void master_post_office::heard(const std::string& address, int features)
+        {
+            u::mutex_scoped_lock l(_features_mutex);
+            _peer_features[address] |= features;
         }
 
         bool master_post_office::send_outside(const message& m)
         {
+            if(m.meta.to.empty()) return false;
+            if(m.meta.group.size() > 1) return send_group(m);
+
             if(_outside_stats.on) _outside_stats.out_push_count++;
-            _out.push(m);
-            return true;
+
+            return _out.push(m);
+        }
+
+        //each peer gets its own copy so the scheduler keeps it fair and in
+        //order with the peer's other messages. copies to peers that 
+        //understand group encryption share one body.
+        bool master_post_office::send_group(const message& m)
+        {
+            REQUIRE_GREATER(m.meta.group.size(), 1);
+
+            message proto;
+            proto.meta = m.meta;
+            proto.meta.group.clear();
+
+            std::vector<std::string> members;
+            if(m.meta.encryption == metadata::conversation)
+                for(const auto& peer : m.meta.group)
+                    if(speaks(peer, group_encryption)) members.push_back(peer);
+
+            group_body_ptr body;
+            if(members.size() > 1)
+            {
+                body = std::make_shared<group_body>();
+                body->m = proto;
+                body->m.meta.to.front().clear();
+                body->m.data = m.data;
+                body->secret = group_secret_for(members);
+            }
+
+            bool queued = false;
+            for(const auto& peer : m.meta.group)
+            {
+                message c;
+                c.meta = proto.meta;
+                c.meta.to.front() = peer;
+                if(body && speaks(peer, group_encryption)) c.meta.body = body;
+                else c.data = m.data;
+
+                if(_outside_stats.on) _outside_stats.out_push_count++;
+                if(_out.push(c)) queued = true;
+            }
+            return queued;
+        }
+
+        //a group keeps its key while its members stay the same, a member
+        //joining or leaving starts a new one
+        sc::group_secret_ptr master_post_office::group_secret_for(const std::vector<std::string>& members)
+        {
+            auto sorted = members;
+            std::sort(sorted.begin(), sorted.end());
+
+            std::string k;
+            for(const auto& a : sorted) k += a + ' ';
+
+            std::lock_guard<std::mutex> lock(_group_mutex);
+            auto p = _group_secrets.find(k);
+            if(p != _group_secrets.end()) return p->second;
+
+            if(_group_secrets.size() >= MAX_GROUP_SECRETS) _group_secrets.clear();
+
+            auto s = std::make_shared<sc::group_secret>();
+            _group_secrets[k] = s;
+            return s;
         }
 
         const network::udp_stats& master_post_office::get_udp_stats() const
         {
             return _connections.get_udp_stats();
         }
+
+        scheduler_stats master_post_office::get_scheduler_stats() const
+        {
+            return _out.stats();
+        }
+
+        const pipeline_stats& master_post_office::get_pipeline_stats() const
+        {
+            return _stats;
+        }
+
+        void master_post_office::send_weight(const std::string& address, size_t weight)
+        {
+            _out.weight(address, weight);
+        }
     }
 }
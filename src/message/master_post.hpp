@@ -31,47 +31,156 @@
 #ifndef FIRESTR_MESSAGE_MASERT_POSTOFFICE_H
 #define FIRESTR_MESSAGE_MASERT_POSTOFFICE_H
 
+#include "message/group_body.hpp"
 #include "message/post_office.hpp"
+#include "message/send_scheduler.hpp"
 
 #include "network/connection_manager.hpp"
 #include "security/security_library.hpp"
 
+#include "util/histogram.hpp"
 #include "util/thread.hpp"
 
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 namespace fire
 {
     namespace message
     {
+        //a message on its way through the outgoing pipeline
+        struct outgoing_work
+        {
+            message m;
+            util::bytes data;
+            size_t lane = 0;
+            std::chrono::steady_clock::time_point started;
+        };
+        using outgoing_work_ptr = std::shared_ptr<outgoing_work>;
+
+        //data on its way through the incoming pipeline
+        struct incoming_work
+        {
+            network::endpoint ep;
+            std::string address;
+            util::bytes data;
+            security::encryption_type et = security::encryption_type::unknown;
+            bool group = false;
+            size_t lane = 0;
+            std::chrono::steady_clock::time_point started;
+        };
+        using incoming_work_ptr = std::shared_ptr<incoming_work>;
+
+        //each stage of a lane is a strand so a peer's messages go through
+        //a stage one at a time and in order, while different stages and 
+        //different lanes run at once on the pool
+        struct pipeline_lane
+        {
+            pipeline_lane(boost::asio::io_service& io) :
+                encode{io}, encrypt{io}, send{io}, decrypt{io}, decode{io} {}
+
+            boost::asio::io_service::strand encode; //encode and compress
+            boost::asio::io_service::strand encrypt;
+            boost::asio::io_service::strand send;
+            boost::asio::io_service::strand decrypt;
+            boost::asio::io_service::strand decode; //uncompress, decode and route
+        };
+        using pipeline_lane_ptr = std::unique_ptr<pipeline_lane>;
+        using pipeline_lanes = std::vector<pipeline_lane_ptr>;
+
+        //time spent in each stage, in microseconds
+        struct pipeline_stats
+        {
+            util::histogram outgoing; //leaving the scheduler to sent, waits included
+            util::histogram incoming; //received to routed, waits included
+            util::histogram encode;
+            util::histogram encrypt;
+            util::histogram send;
+            util::histogram decrypt;
+            util::histogram decode;
+        };
+
+        //what a peer understands beyond text mencode and per peer encryption
+        enum peer_feature 
+        {
+            binary_mencode = 1, 
+            group_encryption = 2,
+            sent_group = 4 //so it knows we understand group encryption
+        };
+
         class master_post_office : public post_office
         {
             public:
                 master_post_office(
                         const std::string& in_host,
                         network::port_type in_port,
-                        security::encrypted_channels_ptr);
+                        security::encrypted_channels_ptr,
+                        size_t threads = 0);
                 virtual ~master_post_office();
 
             public:
                 const network::udp_stats& get_udp_stats() const;
+                scheduler_stats get_scheduler_stats() const;
+                const pipeline_stats& get_pipeline_stats() const;
+
+                //share of outgoing bandwidth a destination gets, 1 by default
+                void send_weight(const std::string& address, size_t weight);
 
             protected:
                 virtual bool send_outside(const message&);
 
+            private:
+                size_t lane_for(const std::string& address) const;
+                void encode_stage(outgoing_work_ptr);
+                void encode(outgoing_work&);
+                void encrypt_stage(outgoing_work_ptr);
+                void send_stage(outgoing_work_ptr);
+                void sent();
+                void decrypt_stage(incoming_work_ptr);
+                void decode_stage(incoming_work_ptr);
+                bool send_group(const message&);
+                security::group_secret_ptr group_secret_for(const std::vector<std::string>& members);
+                bool speaks(const std::string& address, peer_feature) const;
+                void heard(const std::string& address, int features);
+
             private:
                 std::string _in_host;
                 network::port_type _in_port;
                 util::thread_uptr _in_thread;
-                util::thread_uptr _out_thread;
-                queue _out;
+                util::thread_uptr _dispatch_thread;
                 network::connection_manager _connections;
                 security::encrypted_channels_ptr _encrypted_channels;
 
+                //outgoing messages wait in the scheduler until there is
+                //room in the pipeline
+                send_scheduler _out;
+                util::event_ptr _dispatch_event;
+                std::atomic<size_t> _in_flight{0};
+                size_t _max_in_flight;
+
+                network::asio_service_ptr _io;
+                network::asio_work_ptr _work;
+                pipeline_lanes _lanes;
+                std::vector<util::thread_uptr> _pool;
+                pipeline_stats _stats;
+
+                //what each peer has shown it understands
+                std::unordered_map<std::string, int> _peer_features;
+                mutable std::mutex _features_mutex;
+
+                //group keys by the peers that share them
+                std::unordered_map<std::string, security::group_secret_ptr> _group_secrets;
+                std::mutex _group_mutex;
+
             private:
                 friend void in_thread(master_post_office* o);
-                friend void out_thread(master_post_office* o);
+                friend void dispatch_thread(master_post_office* o);
         };
 
     }
@@ -92,6 +92,67 @@ namespace fire
             return i;
         }
 
+        namespace
+        {
+            const size_t BINARY_META_RESERVE = 256; //in bytes, room for the metadata
+        }
+
+        void encode_address(util::byte_writer& w, const address& a)
+        {
+            util::encode_binary_array_size(w, a.size());
+            for(const auto& s : a) util::encode_binary(w, s);
+        }
+
+        void decode_address(util::byte_reader& r, address& a)
+        {
+            //the size comes off the wire, entries are added as they
+            //decode so a bad size runs out of bytes instead of memory
+            const auto size = util::decode_binary_array_size(r);
+            a.clear();
+            for(uint64_t i = 0; i < size; i++)
+            {
+                std::string s;
+                util::decode_binary(r, s);
+                a.push_back(std::move(s));
+            }
+        }
+
+        util::bytes encode_message(const message& m, int mencode_version)
+        {
+            if(mencode_version < MENCODE_V2) return util::encode(m);
+
+            //written straight into the buffer, the metadata is not 
+            //nested like the text version
+            util::bytes b;
+            b.reserve(m.data.size() + m.meta.type.size() + BINARY_META_RESERVE);
+
+            util::byte_writer w{b};
+            w.put(util::BINARY_MENCODE);
+            util::encode_binary(w, m.meta.type);
+            encode_address(w, m.meta.to);
+            encode_address(w, m.meta.from);
+            util::encode_binary(w, m.meta.extra);
+            util::encode_binary(w, m.data);
+            return b;
+        }
+
+        void decode_message(const util::bytes& b, message& m)
+        {
+            if(!util::is_binary(b))
+            {
+                util::decode(b, m);
+                return;
+            }
+
+            util::byte_reader r{b};
+            r.get();
+            util::decode_binary(r, m.meta.type);
+            decode_address(r, m.meta.to);
+            decode_address(r, m.meta.from);
+            util::decode_binary(r, m.meta.extra);
+            util::decode_binary(r, m.data);
+        }
+
         std::string external_address(const std::string& host, const std::string& port)
         {
             return "udp://" + host + ":" + port;
@@ -34,6 +34,8 @@
 #include <string>
 #include <iostream>
 #include <deque>
+#include <memory>
+#include <vector>
 
 #include "util/serialize.hpp"
 #include "util/mencode.hpp"
@@ -45,6 +47,11 @@ namespace fire
     namespace message
     {
         using address = std::deque<std::string>;
+
+        //a group message's body, encrypted once by the master post office
+        struct group_body;
+        using group_body_ptr = std::shared_ptr<group_body>;
+
         struct metadata
         {
             std::string type;
@@ -53,9 +60,16 @@ namespace fire
             util::dict extra;
             enum encryption_type { conversation, asymmetric, symmetric, plaintext};
             enum source_type {local, remote};
+            enum priority_type {normal, control}; //local only, control messages are sent ahead of normal ones
             source_type source = source_type::local;
             encryption_type encryption = encryption_type::conversation;
             bool robust = true;
+            priority_type priority = priority_type::normal;
+
+            //local only. a group message goes out to each of these peers,
+            //the copies to each peer then share one body
+            std::vector<std::string> group;
+            group_body_ptr body;
         };
 
         struct message
@@ -67,6 +81,18 @@ namespace fire
         std::ostream& operator<<(std::ostream&, const message&);
         std::istream& operator>>(std::istream&, message&);
 
+        //version 1 is the text mencode above, version 2 is binary
+        const int MENCODE_V1 = 1;
+        const int MENCODE_V2 = 2;
+        util::bytes encode_message(const message&, int mencode_version = MENCODE_V1);
+
+        //detects the version
+        void decode_message(const util::bytes&, message&);
+
+        //addresses in binary mencode
+        void encode_address(util::byte_writer&, const address&);
+        void decode_address(util::byte_reader&, address&);
+
         std::string external_address(const std::string& host, const std::string& port);
         std::string external_address(const std::string& host_port);
 
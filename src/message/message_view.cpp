@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#include "message/message_view.hpp"
+#include "util/dbc.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace u = fire::util;
+
+namespace fire
+{
+    namespace message
+    {
+        namespace
+        {
+            void truncated(size_t offset)
+            {
+                std::stringstream e;
+                e << "unexpected end of message at byte " << offset;
+                throw std::runtime_error{e.str()};
+            }
+
+            //reads the `size:' header of a text byte string at p and
+            //returns where its bytes start. p is moved past the bytes.
+            size_t text_bytes(const u::bytes& b, size_t& p, size_t& size)
+            {
+                const auto start = p;
+                size = 0;
+                while(p < b.size() && b[p] >= '0' && b[p] <= '9') 
+                {
+                    size = size * 10 + (b[p++] - '0');
+                    if(size > b.size()) truncated(start);
+                }
+
+                if(p == start || p == b.size() || b[p] != ':')
+                {
+                    std::stringstream e;
+                    e << "expected byte string at byte " << start;
+                    throw std::runtime_error{e.str()};
+                }
+                p++;
+
+                if(size > b.size() - p) truncated(p);
+
+                const auto offset = p;
+                p += size;
+                return offset;
+            }
+        }
+
+        message_view::message_view(u::bytes_ptr b) : _b{b}
+        {
+            REQUIRE(b);
+
+            if(u::is_binary(*_b)) parse_binary();
+            else parse_text();
+
+            ENSURE_LESS_EQUAL(_data_offset + _data_size, _b->size());
+        }
+
+        void message_view::parse_text()
+        {
+            const auto& b = *_b;
+
+            size_t p = 0;
+            size_t size = 0;
+            auto offset = text_bytes(b, p, size);
+            _type.assign(b.data() + offset, size);
+
+            //the addresses and extra metadata are nested in a byte string
+            size_t meta_size = 0;
+            const auto meta_offset = text_bytes(b, p, meta_size);
+            std::stringstream ms{std::string{b.data() + meta_offset, meta_size}};
+
+            u::array to;
+            u::array from;
+            ms >> to >> from;
+            for(const auto& s : to) _to.push_back(s.as_string());
+            for(const auto& s : from) _from.push_back(s.as_string());
+
+            const auto extra_start = ms.tellg();
+            _extra_offset = meta_offset + (extra_start < 0 ? meta_size : static_cast<size_t>(extra_start));
+            _extra_size = meta_offset + meta_size - _extra_offset;
+
+            _data_offset = text_bytes(b, p, _data_size);
+        }
+
+        void message_view::parse_binary()
+        {
+            _version = MENCODE_V2;
+
+            u::byte_reader r{*_b};
+            r.get();
+            u::decode_binary(r, _type);
+            decode_address(r, _to);
+            decode_address(r, _from);
+
+            _extra_offset = r.offset();
+            u::skip_binary(r);
+            _extra_size = r.offset() - _extra_offset;
+
+            _data_size = u::decode_binary_bytes_size(r);
+            _data_offset = r.offset();
+            r.raw(_data_size);
+        }
+
+        const u::dict& message_view::extra() const
+        {
+            REQUIRE(_b);
+            if(_has_extra) return _extra;
+
+            const char* p = _b->data() + _extra_offset;
+            if(_version == MENCODE_V2)
+            {
+                u::byte_reader r{p, p + _extra_size};
+                u::decode_binary(r, _extra);
+            }
+            else if(_extra_size > 0)
+            {
+                std::stringstream s{std::string{p, _extra_size}};
+                s >> _extra;
+            }
+
+            _has_extra = true;
+            return _extra;
+        }
+
+        const char* message_view::data() const
+        {
+            REQUIRE(_b);
+            return _b->data() + _data_offset;
+        }
+
+        void message_view::to_message(message& m) const
+        {
+            REQUIRE(_b);
+
+            m.meta.type = _type;
+            m.meta.to = _to;
+            m.meta.from = _from;
+            m.meta.extra = extra();
+            m.data.assign(data(), data() + _data_size);
+        }
+
+        void message_view::move_to(message& m)
+        {
+            REQUIRE(_b);
+
+            extra();
+            m.meta.type = std::move(_type);
+            m.meta.to = std::move(_to);
+            m.meta.from = std::move(_from);
+            m.meta.extra = std::move(_extra);
+
+            if(_b.use_count() == 1)
+            {
+                //the data is the tail of the buffer, drop the header in place
+                auto& b = *_b;
+                b.resize(_data_offset + _data_size);
+                b.erase(b.begin(), b.begin() + _data_offset);
+                m.data = std::move(b);
+            }
+            else m.data.assign(data(), data() + _data_size);
+
+            _b.reset();
+            _has_extra = false;
+            _data_offset = _data_size = _extra_offset = _extra_size = 0;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#ifndef FIRESTR_MESSAGE_MESSAGE_VIEW_H
+#define FIRESTR_MESSAGE_MESSAGE_VIEW_H
+
+#include "message/message.hpp"
+#include "util/bytes.hpp"
+
+namespace fire
+{
+    namespace message
+    {
+        /**
+         * An encoded message read in place over a buffer it shares.
+         * The type and addresses are parsed up front so the message can
+         * be routed, the extra metadata is decoded on first use and the
+         * data is only copied out when the message is materialized.
+         * Not thread safe.
+         */
+        class message_view
+        {
+            public:
+                message_view(util::bytes_ptr);
+
+            public:
+                int version() const { return _version; }
+                const std::string& type() const { return _type; }
+                const address& to() const { return _to; }
+                const address& from() const { return _from; }
+                const util::dict& extra() const;
+
+            public:
+                const char* data() const;
+                size_t data_size() const { return _data_size; }
+                util::bytes_ptr buffer() const { return _b; }
+
+            public:
+                //copies the message out, the view stays valid
+                void to_message(message&) const;
+
+                //moves the message out. when the view is the only owner
+                //of the buffer, the buffer becomes the message data
+                //without a new allocation. the view is empty after.
+                void move_to(message&);
+
+            private:
+                void parse_text();
+                void parse_binary();
+
+            private:
+                util::bytes_ptr _b;
+                int _version = MENCODE_V1;
+                std::string _type;
+                address _to;
+                address _from;
+                size_t _extra_offset = 0;
+                size_t _extra_size = 0;
+                size_t _data_offset = 0;
+                size_t _data_size = 0;
+                mutable bool _has_extra = false;
+                mutable util::dict _extra;
+        };
+    }
+}
+
+#endif
@@ -40,22 +40,18 @@ namespace fire
 {
     namespace message
     {
-        namespace
-        {
-            const double MIN_THREAD_SLEEP = 1; //in milliseconds 
-            const double SLEEP_STEP = 5; //in milliseconds 
-            const double MAX_THREAD_SLEEP = 51; //in milliseconds 
-        }
-
         void send_thread(post_office* o)
         try
         {
             REQUIRE(o);
+            REQUIRE(o->_outbox_event);
 
-            double thread_sleep = MIN_THREAD_SLEEP;
             while(!o->_done)
             try
             {
+                //take the count before looking so mail pushed while we 
+                //look wakes us up again
+                const auto seen = o->_outbox_event->count();
                 bool sent = false;
 
                 auto boxes = o->boxes();
@@ -72,16 +68,11 @@ namespace fire
 
                     CHECK_EQUAL(m.meta.from.size(), 1);
 
-                    o->send(m);
+                    o->send(std::move(m));
                     sent = true;
                 }
 
-                if(!sent) 
-                {
-                    util::sleep_thread(thread_sleep);
-                    thread_sleep = std::min(MAX_THREAD_SLEEP, thread_sleep + SLEEP_STEP);
-                }
-                else thread_sleep = MIN_THREAD_SLEEP;
+                if(!sent) o->_outbox_event->wait(seen);
             }
             catch(std::exception& e)
             {
@@ -103,6 +94,7 @@ namespace fire
                 _boxes{},
                 _offices{},
                 _parent{},
+                _outbox_event{std::make_shared<util::event>()},
                 _done{false}
         {
             _send_thread.reset(new std::thread{send_thread, this});
@@ -115,6 +107,7 @@ namespace fire
                 _boxes{},
                 _offices{},
                 _parent{},
+                _outbox_event{std::make_shared<util::event>()},
                 _done{false}
         {
             _send_thread.reset(new std::thread{send_thread, this});
@@ -125,7 +118,9 @@ namespace fire
         post_office::~post_office()
         {
             INVARIANT(_send_thread);
+            INVARIANT(_outbox_event);
             _done = true;
+            _outbox_event->done();
             _send_thread->join();
         }
 
@@ -154,16 +149,18 @@ namespace fire
                     const auto& to = meta.to.front();
                     auto p = _offices.find(to);
 
+                    //the message is moved down only when the child can
+                    //deliver it, so it is never copied on the way
                     if(p != _offices.end())
                     {
                         auto wp = p->second;
-                        if(auto sp = wp.lock())
+                        auto sp = wp.lock();
+                        if(sp && sp->has_route(std::next(meta.to.begin()), meta.to.end()))
                         {
-                            message cp = m;
-                            cp.meta.to.pop_front();
-                            cp.meta.from.push_front(_address);
+                            m.meta.to.pop_front();
+                            m.meta.from.push_front(_address);
 
-                            if(sp->send(cp)) return true;
+                            return sp->send(std::move(m));
                         }
                     }
                 }
@@ -175,7 +172,7 @@ namespace fire
 
                 //send to parent.
                 //otherwise, try to send message to outside world
-                return _parent ? _parent->send(m) : send_outside(m);
+                return _parent ? _parent->send(std::move(m)) : send_outside(m);
             }
 
             //route to mailbox
@@ -190,7 +187,7 @@ namespace fire
                     auto wb = p->second;
                     if(auto sb = wb.lock())
                     {
-                        sb->push_inbox(m);
+                        sb->push_inbox(std::move(m));
                         return true;
                     }
                 }
@@ -200,6 +197,39 @@ namespace fire
             return false;
         }
 
+        bool post_office::has_route(const fire::message::address& to) const
+        {
+            return has_route(to.begin(), to.end());
+        }
+
+        //follows the same path send does without touching the message
+        bool post_office::has_route(fire::message::address::const_iterator b, fire::message::address::const_iterator e) const
+        {
+            auto size = std::distance(b, e);
+            if(size == 0) return false;
+
+            if(size > 1 && *b == _address) 
+            {
+                b++;
+                size--;
+            }
+
+            if(size > 1)
+            {
+                post_office_ptr sp;
+                {std::lock_guard<std::mutex> lock(_post_m);
+                    auto p = _offices.find(*b);
+                    if(p != _offices.end()) sp = p->second.lock();
+                }
+
+                return sp && sp->has_route(std::next(b), e);
+            }
+
+            std::lock_guard<std::mutex> lock(_box_m);
+            auto p = _boxes.find(*b);
+            return p != _boxes.end() && !p->second.expired();
+        }
+
         void post_office::clean_mailboxes()
         {
             u::string_set to_be_deleted;
@@ -227,6 +257,7 @@ namespace fire
 
             clean_mailboxes();
             _boxes[sp->address()] = p;
+            sp->notify_outbox(_outbox_event);
 
             return true;
         }
@@ -64,6 +64,10 @@ namespace fire
             public:
                 bool send(message);
 
+                //true when a message to this address would reach a mailbox
+                //below this post office
+                bool has_route(const fire::message::address&) const;
+
             public:
                 bool add(mailbox_wptr);
                 bool has(mailbox_wptr) const;
@@ -89,6 +93,7 @@ namespace fire
 
             protected:
                 void clean_mailboxes();
+                bool has_route(fire::message::address::const_iterator, fire::message::address::const_iterator) const;
 
             protected:
                 virtual bool send_outside(const message&);
@@ -100,6 +105,7 @@ namespace fire
                 post_offices _offices;
                 post_office* _parent;
                 util::thread_uptr _send_thread;
+                util::event_ptr _outbox_event; //signaled when a mailbox has mail to send
                 bool _done;
                 mutable std::mutex _box_m;
                 mutable std::mutex _post_m;
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#include "message/send_scheduler.hpp"
+#include "message/group_body.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+
+namespace fire
+{
+    namespace message
+    {
+        namespace
+        {
+            const size_t DEFAULT_QUANTUM = 16*1024; //in bytes per round per unit of weight
+            const size_t MESSAGE_OVERHEAD = 64; //in bytes, so empty messages still cost something
+        }
+
+        void scheduler_stats::add(const scheduler_stats& o)
+        {
+            control_queued += o.control_queued;
+            normal_queued += o.normal_queued;
+            normal_bytes += o.normal_bytes;
+            peers += o.peers;
+            control_sent += o.control_sent;
+            normal_sent += o.normal_sent;
+            normal_rejected += o.normal_rejected;
+            control_wait += o.control_wait;
+            normal_wait += o.normal_wait;
+            max_control_wait = std::max(max_control_wait, o.max_control_wait);
+            max_normal_wait = std::max(max_normal_wait, o.max_normal_wait);
+        }
+
+        send_scheduler::send_scheduler(size_t quantum) :
+            _quantum{quantum == 0 ? DEFAULT_QUANTUM : quantum}
+        {
+            INVARIANT_GREATER(_quantum, 0);
+        }
+
+        //false if the destination is full and the message was dropped.
+        //control messages are small and never dropped.
+        bool send_scheduler::push(const message& m)
+        {
+            scheduled_message s;
+            s.m = m;
+            s.size = m.data.size() + MESSAGE_OVERHEAD;
+            if(m.meta.body) s.size += m.meta.body->m.data.size();
+            s.queued = send_clock::now();
+
+            util::event_ptr e;
+            {
+                std::lock_guard<std::mutex> l(_mutex);
+                if(m.meta.priority == metadata::control)
+                {
+                    _control.emplace_back(std::move(s));
+                    _stats.control_queued++;
+                }
+                else
+                {
+                    const auto& to = m.meta.to.empty() ? std::string{} : m.meta.to.front();
+                    auto di = _destinations.find(to);
+                    const size_t waiting = di != _destinations.end() ? di->second.bytes : 0;
+
+                    //an empty destination always takes one message so a 
+                    //message larger than the limit can still go out
+                    if(_limit > 0 && waiting > 0 && waiting + s.size > _limit)
+                    {
+                        _stats.normal_rejected++;
+                        return false;
+                    }
+
+                    auto& d = _destinations[to];
+                    if(d.q.empty()) _round.push_back(to);
+
+                    _stats.normal_queued++;
+                    _stats.normal_bytes += s.size;
+                    d.bytes += s.size;
+                    d.q.emplace_back(std::move(s));
+                }
+                _stats.peers = _round.size();
+                e = _event;
+            }
+
+            if(e) e->signal();
+            return true;
+        }
+
+        bool send_scheduler::pop(message& m)
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+
+            //control messages are never held behind normal ones
+            if(!_control.empty())
+            {
+                auto& s = _control.front();
+                took(s, true);
+                m = std::move(s.m);
+                _control.pop_front();
+                return true;
+            }
+
+            //deficit round robin. a destination at the front of the round
+            //gets its quantum and sends while its deficit covers the next
+            //message, then goes to the back.
+            while(!_round.empty())
+            {
+                const auto to = _round.front();
+                auto di = _destinations.find(to);
+                CHECK(di != _destinations.end());
+
+                auto& d = di->second;
+                CHECK_FALSE(d.q.empty());
+
+                if(!d.turn)
+                {
+                    auto wi = _weights.find(to);
+                    const size_t weight = wi != _weights.end() ? wi->second : 1;
+                    d.deficit += _quantum * weight;
+                    d.turn = true;
+                }
+
+                auto& s = d.q.front();
+                if(s.size <= d.deficit)
+                {
+                    d.deficit -= s.size;
+                    d.bytes -= s.size;
+                    took(s, false);
+                    m = std::move(s.m);
+                    d.q.pop_front();
+
+                    //a drained destination keeps no credit
+                    if(d.q.empty())
+                    {
+                        _destinations.erase(di);
+                        _round.pop_front();
+                        _stats.peers = _round.size();
+                    }
+                    return true;
+                }
+
+                d.turn = false;
+                _round.pop_front();
+                _round.push_back(to);
+            }
+
+            return false;
+        }
+
+        void send_scheduler::took(const scheduled_message& s, bool control)
+        {
+            const double waited = std::chrono::duration<double, std::milli>(send_clock::now() - s.queued).count();
+            if(control)
+            {
+                CHECK_GREATER(_stats.control_queued, 0);
+                _stats.control_queued--;
+                _stats.control_sent++;
+                _stats.control_wait += waited;
+                _stats.max_control_wait = std::max(_stats.max_control_wait, waited);
+            }
+            else
+            {
+                CHECK_GREATER(_stats.normal_queued, 0);
+                _stats.normal_queued--;
+                _stats.normal_bytes -= std::min(_stats.normal_bytes, s.size);
+                _stats.normal_sent++;
+                _stats.normal_wait += waited;
+                _stats.max_normal_wait = std::max(_stats.max_normal_wait, waited);
+            }
+        }
+
+        void send_scheduler::notify(util::event_ptr e)
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            _event = e;
+        }
+
+        void send_scheduler::weight(const std::string& to, size_t w)
+        {
+            REQUIRE_GREATER(w, 0);
+            std::lock_guard<std::mutex> l(_mutex);
+            _weights[to] = w;
+        }
+
+        void send_scheduler::limit(size_t bytes)
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            _limit = bytes;
+        }
+
+        size_t send_scheduler::size() const
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            return _stats.control_queued + _stats.normal_queued;
+        }
+
+        bool send_scheduler::empty() const
+        {
+            return size() == 0;
+        }
+
+        scheduler_stats send_scheduler::stats() const
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            return _stats;
+        }
+    }
+}
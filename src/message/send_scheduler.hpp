@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2014  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#ifndef FIRESTR_MESSAGE_SEND_SCHEDULER_H
+#define FIRESTR_MESSAGE_SEND_SCHEDULER_H
+
+#include "message/message.hpp"
+#include "util/thread.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fire
+{
+    namespace message
+    {
+        struct scheduler_stats
+        {
+            size_t control_queued = 0; //control messages waiting
+            size_t normal_queued = 0; //normal messages waiting
+            size_t normal_bytes = 0; //bytes of normal messages waiting
+            size_t peers = 0; //destinations with normal messages waiting
+            size_t control_sent = 0;
+            size_t normal_sent = 0;
+            size_t normal_rejected = 0; //dropped because the destination was full
+            double control_wait = 0; //in milliseconds, summed over sent messages
+            double normal_wait = 0; //in milliseconds, summed over sent messages
+            double max_control_wait = 0; //in milliseconds
+            double max_normal_wait = 0; //in milliseconds
+
+            void add(const scheduler_stats&);
+        };
+
+        using send_clock = std::chrono::steady_clock;
+
+        struct scheduled_message
+        {
+            message m;
+            size_t size = 0;
+            send_clock::time_point queued;
+        };
+        using scheduled_queue = std::deque<scheduled_message>;
+
+        struct destination_queue
+        {
+            scheduled_queue q;
+            size_t bytes = 0; //waiting in q
+            size_t deficit = 0; //bytes it may still send this round
+            bool turn = false; //got its quantum this round
+        };
+        using destination_map = std::unordered_map<std::string, destination_queue>;
+
+        //orders outgoing messages. control messages go first in the order
+        //they came. normal messages are queued per destination and taken
+        //with deficit round robin so each destination gets a share of
+        //bytes in proportion to its weight, whatever its message sizes.
+        //a destination can be limited in the bytes it has waiting, past
+        //that its normal messages are dropped so a stalled peer never
+        //grows the queue or holds up whoever is pushing.
+        class send_scheduler
+        {
+            public:
+                send_scheduler(size_t quantum = 0);
+
+            public:
+                bool push(const message&);
+                bool pop(message&);
+                void notify(util::event_ptr);
+
+            public:
+                //share of a destination relative to the others, 1 by default
+                void weight(const std::string& destination, size_t);
+
+                //bytes of normal messages a destination may have waiting,
+                //0 is unbounded
+                void limit(size_t bytes);
+
+            public:
+                size_t size() const;
+                bool empty() const;
+                scheduler_stats stats() const;
+
+            private:
+                void took(const scheduled_message&, bool control);
+
+            private:
+                size_t _quantum;
+                size_t _limit = 0;
+                scheduled_queue _control;
+                destination_map _destinations;
+                std::deque<std::string> _round; //destinations with messages, in turn order
+                std::unordered_map<std::string, size_t> _weights;
+                scheduler_stats _stats;
+                util::event_ptr _event;
+                mutable std::mutex _mutex;
+        };
+    }
+}
+
+#endif
@@ -29,10 +29,14 @@
  * also delete it here.
  */
 #include "messages/new_app.hpp"
+#include "security/security.hpp"
 #include "util/dbc.hpp"
 
+#include <algorithm>
+
 namespace m = fire::message;
 namespace u = fire::util;
+namespace sc = fire::security;
 
 namespace fire
 {
@@ -40,6 +44,9 @@ namespace fire
     {
         const std::string NEW_APP = "new_app";
         const std::string REQ_APP = "req_app";
+        const std::string REQ_CHUNKS = "req_chunks";
+        const std::string APP_CHUNKS = "app_chunks";
+        const std::string MANIFESTS_KEY = "manifests";
 
         new_app::new_app(
                 const std::string& id,
@@ -70,6 +77,7 @@ namespace fire
             _type = m.meta.extra["app_type"].as_string();
             _from_id = m.meta.extra["from_id"].as_string();
             _data = m.data;
+            _manifests = m.meta.extra.has(MANIFESTS_KEY);
         }
 
         new_app::operator message::message() const
@@ -78,6 +86,7 @@ namespace fire
             m.meta.type = NEW_APP;
             m.meta.extra["app_id"] = _id;
             m.meta.extra["app_type"] = _type;
+            if(_manifests) m.meta.extra[MANIFESTS_KEY] = 1;
             m.data = _data;
             return m;
         }
@@ -102,6 +111,11 @@ namespace fire
             return _from_id;
         }
 
+        bool new_app::manifests() const
+        {
+            return _manifests;
+        }
+
         request_app::request_app(std::string a, std::string cid) 
             : app_address(a), conversation_id(cid)
         { }
@@ -113,6 +127,7 @@ namespace fire
             app_address = m.meta.extra["app_addr"].as_string();
             conversation_id = m.meta.extra["conv_id"].as_string();
             from_id = m.meta.extra["from_id"].as_string();
+            manifests = m.meta.extra.has(MANIFESTS_KEY);
         }
 
         request_app::operator message::message() const
@@ -121,6 +136,66 @@ namespace fire
             m.meta.type = REQ_APP;
             m.meta.extra["app_addr"] = app_address;
             m.meta.extra["conv_id"] = conversation_id;
+            if(manifests) m.meta.extra[MANIFESTS_KEY] = 1;
+            return m;
+        }
+
+        request_chunks::request_chunks(std::string a, std::vector<std::string> h) 
+            : app_address(a), hashes(h)
+        { }
+
+        request_chunks::request_chunks(const message::message& m)
+        {
+            REQUIRE_EQUAL(m.meta.type, REQ_CHUNKS);
+
+            app_address = m.meta.extra["app_addr"].as_string();
+            from_id = m.meta.extra["from_id"].as_string();
+            u::from_array(
+                    m.meta.extra["hashes"].as_array(), hashes, 
+                    [](const auto& v)
+                    { 
+                        return v.as_string();
+                    });
+
+            //hashes name files in the blob cache, anything else is dropped
+            hashes.erase(
+                    std::remove_if(hashes.begin(), hashes.end(), 
+                        [](const std::string& h) { return !sc::is_content_hash(h);}),
+                    hashes.end());
+        }
+
+        request_chunks::operator message::message() const
+        {
+            m::message m;
+            m.meta.type = REQ_CHUNKS;
+            m.meta.extra["app_addr"] = app_address;
+            m.meta.extra["hashes"] = u::to_array(hashes);
+            return m;
+        }
+
+        app_chunks::app_chunks(std::string a) : app_address(a) { }
+
+        app_chunks::app_chunks(const message::message& m)
+        {
+            REQUIRE_EQUAL(m.meta.type, APP_CHUNKS);
+
+            app_address = m.meta.extra["app_addr"].as_string();
+            from_id = m.meta.extra["from_id"].as_string();
+            u::decode(m.data, chunks);
+
+            //hashes name files in the blob cache, anything else is dropped
+            std::vector<std::string> bad;
+            for(const auto& p : chunks) 
+                if(!sc::is_content_hash(p.first) || !p.second.is_bytes()) bad.push_back(p.first);
+            for(const auto& h : bad) chunks.remove(h);
+        }
+
+        app_chunks::operator message::message() const
+        {
+            m::message m;
+            m.meta.type = APP_CHUNKS;
+            m.meta.extra["app_addr"] = app_address;
+            m.data = u::encode(chunks);
             return m;
         }
 
@@ -33,8 +33,10 @@
 
 #include "message/message.hpp"
 #include "util/bytes.hpp"
+#include "util/mencode.hpp"
 
 #include <string>
+#include <vector>
 
 namespace fire
 {
@@ -42,6 +44,12 @@ namespace fire
     {
         extern const std::string NEW_APP;
         extern const std::string REQ_APP;
+        extern const std::string REQ_CHUNKS;
+        extern const std::string APP_CHUNKS;
+
+        //new_app and req_app carry this extra when the sender
+        //understands app manifests. peers without it get full apps.
+        extern const std::string MANIFESTS_KEY;
 
         class new_app
         {
@@ -59,12 +67,14 @@ namespace fire
                 const std::string& type() const;
                 const std::string& from_id() const;
                 const util::bytes& data() const;
+                bool manifests() const;
 
             private:
                 std::string _id;
                 std::string _type;
                 std::string _from_id;
                 util::bytes _data;
+                bool _manifests = true;
         };
 
         class request_app
@@ -80,6 +90,39 @@ namespace fire
                 std::string app_address;
                 std::string conversation_id;
                 std::string from_id;
+                bool manifests = true;
+        };
+
+        //asks the peer that sent an app manifest for the chunks we lack
+        class request_chunks
+        {
+            public:
+                request_chunks(std::string address, std::vector<std::string> hashes);
+
+            public:
+                request_chunks(const message::message&);
+                operator message::message() const;
+
+            public:
+                std::string app_address;
+                std::vector<std::string> hashes;
+                std::string from_id;
+        };
+
+        //chunks keyed by their hash
+        class app_chunks
+        {
+            public:
+                app_chunks(std::string address);
+
+            public:
+                app_chunks(const message::message&);
+                operator message::message() const;
+
+            public:
+                std::string app_address;
+                util::dict chunks;
+                std::string from_id;
         };
     }
 }
@@ -59,8 +59,32 @@ namespace fire
             m.meta.to = {contact->address(), _mail->address()};
             m.meta.extra["from_id"] = my_id;
 
-            _mail->push_outbox(m);
-            return true;
+            //false when the outbox is full and rejects
+            return _mail->push_outbox(m) != util::push_result::rejected;
+        }
+
+        bool sender::send(const user::contact_list& to, message::message m)
+        {
+            INVARIANT(_service);
+            INVARIANT(_mail);
+
+            std::vector<std::string> group;
+            for(auto c : to.list())
+            {
+                CHECK(c);
+                auto contact = _service->user().contacts().by_id(c->id());
+                if(contact) group.push_back(contact->address());
+            }
+            if(group.empty()) return false;
+
+            const auto my_id = _service->user().info().id();
+            m.meta.to = {group.front(), _mail->address()};
+            m.meta.extra["from_id"] = my_id;
+            if(group.size() > 1) m.meta.group = std::move(group);
+
+            //one message in the outbox, the master post office sends a 
+            //copy to each peer
+            return _mail->push_outbox(m) != util::push_result::rejected;
         }
 
         bool sender::send_to_local_app(const std::string& address, message::message m)
@@ -74,9 +98,7 @@ namespace fire
             m.meta.extra["from_id"] = my_id;
             m.meta.extra["local_app_id"] = _mail->address();
 
-            _mail->push_outbox(m);
-
-            return true;
+            return _mail->push_outbox(m) != util::push_result::rejected;
         }
 
         user::user_service_ptr sender::user_service()
@@ -52,6 +52,13 @@ namespace fire
                  * @param to Id of user
                  */
                 bool send(const std::string& to, message::message);
+
+                /**
+                 * Send one message to many recipients. The data is
+                 * encoded, compressed and encrypted once for all of them.
+                 * @param to Users in the conversation
+                 */
+                bool send(const user::contact_list& to, message::message);
                 bool send_to_local_app(const std::string& address, message::message);
 
             public:
@@ -78,10 +78,24 @@ namespace fire
             p.block = get_opt(o, "block", 0);
             p.wait = get_opt(o, "wait", 0);
             p.track_incoming = get_opt(o, "track_incoming", 0);
+            p.batch = get_opt<size_t>(o, "batch", 0);
+            p.mtu = get_opt<size_t>(o, "mtu", 0);
+            p.shards = get_opt<size_t>(o, "shards", 1);
+            p.legacy_framing = get_opt(o, "legacy_framing", 0);
+            p.peer_limits = parse_peer_limits(o);
 
             return p;
         }
 
+        util::watermarks parse_peer_limits(const queue_options& o)
+        {
+            util::watermarks w;
+            w.high = get_opt<size_t>(o, "peer_high", 0);
+            w.low = get_opt<size_t>(o, "peer_low", 0);
+            w.policy = util::parse_overflow(get_opt(o, "peer_overflow", std::string("block")));
+            return w;
+        }
+
         std::string make_pro_address(
                 const std::string& proto, 
                 const std::string& host, 
@@ -34,7 +34,10 @@
 #include "network/endpoint.hpp"
 #include "network/util.hpp"
 #include "network/message_queue.hpp"
+#include "util/queue.hpp"
+#include "util/ring_queue.hpp"
 #include "util/thread.hpp"
+#include "util/watermark.hpp"
 
 namespace fire
 {
@@ -55,6 +58,11 @@ namespace fire
             bool block;
             double wait;
             bool track_incoming;
+            size_t batch; //datagrams per sendmmsg/recvmmsg, 0 sends one at a time
+            size_t mtu; //largest udp packet to probe for, 0 uses the default
+            size_t shards; //udp sockets sharing the port, each on its own thread
+            bool legacy_framing; //tcp only, never offer binary frames
+            util::watermarks peer_limits; //bytes queued to a peer before sends push back
         };
 
         class connection
@@ -64,8 +72,28 @@ namespace fire
             virtual endpoint get_endpoint() const = 0;
             virtual bool is_disconnected() const = 0;
         };
+        using connection_ptr = std::shared_ptr<connection>;
+        using connection_wptr = std::weak_ptr<connection>;
+
+        struct endpoint_message
+        {
+            endpoint ep;
+            util::bytes data;
+            bool robust;
+            connection_wptr from; //incoming tcp connection, if tracked
+        };
+
+        //udp and tcp queues can share one of these so a reader 
+        //waits on all of them at once
+#ifdef FIRESTR_RING_QUEUES
+        using endpoint_queue = util::mpsc_queue<endpoint_message>;
+#else
+        using endpoint_queue = util::queue<endpoint_message>;
+#endif
+        using endpoint_queue_ptr = std::shared_ptr<endpoint_queue>;
 
         asio_params parse_params(const address_components& c);
+        util::watermarks parse_peer_limits(const queue_options& o);
         asio_params::endpoint_type determine_type(const std::string& address);
         std::string make_tcp_address(const std::string& host, port_type port, port_type local_port = 0);
         std::string make_udp_address(const std::string& host, port_type port, port_type local_port = 0);
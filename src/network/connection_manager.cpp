@@ -44,11 +44,16 @@ namespace fire
     {
         void tcp_send_thread(connection_manager*);
 
-        connection_manager::connection_manager(size_t size, port_type local_port, bool tcp_listen) :
-            _rstate{receive_state::IN_UDP1},
+        connection_manager::connection_manager(
+                size_t size, 
+                port_type local_port, 
+                bool tcp_listen,
+                const queue_options& udp_options) :
+            _in_queue{std::make_shared<endpoint_queue>()},
             _pool(size),
             _local_port{local_port},
             _tcp_listen{tcp_listen},
+            _udp_options(udp_options),
             _done{false}
         {
             teardown_and_repool_tcp_connections();
@@ -65,10 +70,17 @@ namespace fire
         connection_manager::~connection_manager()
         {
             _done = true;
+            done();
             _tcp_send_queue.done();
             if(_tcp_send_thread) _tcp_send_thread->join();
         }
 
+        void connection_manager::done()
+        {
+            INVARIANT(_in_queue);
+            _in_queue->done();
+        }
+
         void connection_manager::create_udp_endpoint()
         {
             //create listen socket
@@ -82,8 +94,13 @@ namespace fire
                 false, //block;
                 0, // wait;
                 true, //track_incoming;
+                get_opt<size_t>(_udp_options, "batch", 0), //batch;
+                get_opt<size_t>(_udp_options, "mtu", 0), //mtu;
+                get_opt<size_t>(_udp_options, "shards", 1), //shards;
+                false, //legacy_framing;
+                parse_peer_limits(_udp_options) //peer_limits;
             };
-            _udp_con = create_udp_queue(udp_p);
+            _udp_con = create_udp_queue(udp_p, _in_queue);
         }
         void connection_manager::create_tcp_endpoint()
         {
@@ -97,7 +114,7 @@ namespace fire
                 {"block", "0"},
                 {"track_incoming", "1"}};
 
-            _in = create_tcp_queue(listen_address, qo);
+            _in = create_tcp_queue(listen_address, qo, _in_queue);
             ENSURE(_in);
         }
 
@@ -114,14 +131,24 @@ namespace fire
                 false, //block;
                 0, // wait;
                 false, //track_incoming;
+                0, //batch;
+                0, //mtu;
+                1, //shards;
+                false, //legacy_framing;
+                {} //peer_limits;
             };
             return p;
         }
 
+        tcp_queue_ptr connection_manager::new_tcp_queue(const asio_params& par)
+        {
+            return std::make_shared<tcp_queue>(par, _in_queue);
+        }
+
         void connection_manager::create_tcp_pool()
         {
             auto par = create_tcp_params(); 
-            for(auto& p : _pool) p = std::make_shared<tcp_queue>(par);
+            for(auto& p : _pool) p = new_tcp_queue(par);
         }
 
         void connection_manager::cleanup_pool()
@@ -186,7 +213,7 @@ namespace fire
                 if(p) continue;
 
                 auto par = create_tcp_params(); 
-                p = std::make_shared<tcp_queue>(par);
+                p = new_tcp_queue(par);
                 break;
             }
 
@@ -284,107 +311,23 @@ namespace fire
             return false;
         }
 
-        void connection_manager::transition_udp_state()
+        bool connection_manager::receive(endpoint& ep, u::bytes& b, bool wait)
         {
-            REQUIRE(_rstate != IN_TCP);
-            REQUIRE(_rstate != OUT_TCP);
+            INVARIANT(_in_queue);
 
-            auto ps = _rstate; 
-            switch(_rstate)
-            {
-                case receive_state::IN_UDP1: _rstate = receive_state::IN_UDP2; break;
-                case receive_state::IN_UDP2: _rstate = receive_state::IN_UDP3; break;
-                case receive_state::IN_UDP3: _rstate = receive_state::IN_UDP4; break;
-                case receive_state::IN_UDP4: _rstate = receive_state::IN_UDP5; break;
-                case receive_state::IN_UDP5: _rstate = receive_state::IN_UDP6; break;
-                case receive_state::IN_UDP6: _rstate = receive_state::IN_UDP7; break;
-                case receive_state::IN_UDP7: _rstate = receive_state::IN_UDP8; break;
-                case receive_state::IN_UDP8: 
-                                             _rstate = _tcp_listen ? receive_state::IN_TCP : receive_state::OUT_TCP;
-                                             break;
-                default: CHECK(false && "missed case");
-            }
-
-            ENSURE(ps != receive_state::IN_UDP8 || _rstate == receive_state::IN_TCP || _rstate == receive_state::OUT_TCP) 
-            ENSURE(_rstate != ps);
-        }
+            endpoint_message m;
+            if(!_in_queue->pop(m, wait)) return false;
 
-        bool connection_manager::receive(endpoint& ep, u::bytes& b)
-        {
-            //if we quite in prior call and got to done state
-            //or returned with a message in OUT_TCP case, we
-            //reset to IN_UPD and start over
-            if(_rstate == receive_state::DONE) 
-                _rstate = receive_state::IN_UDP1;
-
-            while(_rstate != receive_state::DONE)
+            //remember incoming tcp connections so we reply on them
+            if(!m.from.expired())
             {
-                switch(_rstate)
-                {
-                    case receive_state::IN_UDP1:
-                    case receive_state::IN_UDP2:
-                    case receive_state::IN_UDP3:
-                    case receive_state::IN_UDP4:
-                    case receive_state::IN_UDP5:
-                    case receive_state::IN_UDP6:
-                    case receive_state::IN_UDP7:
-                    case receive_state::IN_UDP8:
-                        {
-                            endpoint_message um;
-                            transition_udp_state();
-                            if(_udp_con->receive(um))
-                            {
-
-                                ep = um.ep;
-                                b = std::move(um.data);
-                                return true;
-                            }
-                        }
-                        break;
-
-                    case receive_state::IN_TCP:
-                        {
-                            _rstate = receive_state::OUT_TCP;
-                            u::mutex_scoped_lock l(_mutex);
-                            INVARIANT(_in);
-                            if(_in->receive(b)) 
-                            {
-                                auto s = _in->get_socket();
-                                CHECK(s);
-                                ep = s->get_endpoint();
-                                _in_connections[make_address_str(ep)] = s;
-                                return true;
-                            }
-                        }
-                        break;
-
-                    case receive_state::OUT_TCP:
-                        {
-                            _rstate = receive_state::DONE;
-                            u::mutex_scoped_lock l(_mutex);
-                            for(auto p : _out)
-                            {
-                                auto i = p.second;
-                                CHECK_RANGE(i, 0, _pool.size());
-
-                                auto c = _pool[i];
-                                CHECK(c);
-                                if(c->receive(b)) 
-                                {
-                                    auto s = c->get_socket();
-                                    CHECK(s);
-                                    ep = s->get_endpoint();
-                                    return true;
-                                }
-                            }
-                        }
-                        break;
-                    default: CHECK(false && "missed case");
-                }
+                u::mutex_scoped_lock l(_mutex);
+                _in_connections[make_address_str(m.ep)] = m.from;
             }
 
-            ENSURE(_rstate == receive_state::DONE);
-            return false;
+            ep = std::move(m.ep);
+            b = std::move(m.data);
+            return true;
         }
 
         bool connection_manager::is_disconnected(const std::string& addr)
@@ -392,8 +335,9 @@ namespace fire
             u::mutex_scoped_lock l(_mutex);
             auto si = _in_connections.find(addr);
             if(si == _in_connections.end()) return true;
-            CHECK(si->second);
-            return si->second->is_disconnected();
+
+            auto c = si->second.lock();
+            return !c || c->is_disconnected();
         }
 
         const udp_stats& connection_manager::get_udp_stats() const
@@ -420,9 +364,8 @@ namespace fire
                     auto inp = m->_in_connections.find(i.to);
                     if(inp != m->_in_connections.end())
                     {
-                        auto o = inp->second;
-                        CHECK(o);
-                        if(!o->is_disconnected()) 
+                        auto o = inp->second.lock();
+                        if(o && !o->is_disconnected()) 
                         {
                             o->send(i.data);
                             continue;
@@ -45,7 +45,7 @@ namespace fire
     {
         using assignment_map = std::unordered_map<std::string, size_t>; 
         using tcp_connection_pool = std::vector<tcp_queue_ptr>;
-        using connection_map = std::unordered_map<std::string, connection*>; 
+        using connection_map = std::unordered_map<std::string, connection_wptr>; 
 
         struct send_item
         {
@@ -57,14 +57,19 @@ namespace fire
         class connection_manager
         {
             public:
-                connection_manager(size_t size, port_type listen_port, bool tcp_listen = true);
+                connection_manager(
+                        size_t size, 
+                        port_type listen_port, 
+                        bool tcp_listen = true, 
+                        const queue_options& udp_options = queue_options());
                 ~connection_manager();
 
             public:
-                bool receive(endpoint& ep, util::bytes& b);
+                bool receive(endpoint& ep, util::bytes& b, bool wait = false);
                 bool send(const std::string& to, const util::bytes& b, bool robust = true);
                 bool is_disconnected(const std::string& addr);
                 const udp_stats& get_udp_stats() const;
+                void done();
 
             private:
                 tcp_queue_ptr get_connected_queue(const std::string& address);
@@ -76,33 +81,20 @@ namespace fire
                 void cleanup_pool();
                 size_t find_next_available();
                 asio_params create_tcp_params();
+                tcp_queue_ptr new_tcp_queue(const asio_params&);
 
-            private:
-                enum receive_state { 
-                    IN_UDP1, 
-                    IN_UDP2, 
-                    IN_UDP3, 
-                    IN_UDP4, 
-                    IN_UDP5, 
-                    IN_UDP6, 
-                    IN_UDP7, 
-                    IN_UDP8, 
-                    IN_TCP, 
-                    OUT_TCP, 
-                    DONE};
-
-                void transition_udp_state();
             private:
 
                 std::mutex _mutex;
+                endpoint_queue_ptr _in_queue; //udp and every tcp connection push here
 
-                receive_state _rstate;
                 assignment_map _out;
                 tcp_connection_pool _pool;
                 port_type _local_port;
                 tcp_queue_ptr _in;
                 udp_queue_ptr _udp_con;
                 bool _tcp_listen;
+                queue_options _udp_options;
 
                 connection_map _in_connections;
 
@@ -39,6 +39,7 @@
 #include <stdexcept>
 #include <sstream>
 #include <algorithm>
+#include <array>
 #include <functional>
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
@@ -59,28 +60,39 @@ namespace fire
     {
         namespace
         {
-            const size_t BLOCK_SLEEP = 10;
-            const size_t THREAD_SLEEP = 40;
-            const size_t KEEP_ALIVE_SLEEP = 2000;
-            const size_t KEEP_ALIVE_THRESH = 30;
+            const size_t KEEP_ALIVE_INTERVAL = 60000; //in milliseconds
             const u::bytes KEEP_ALIVE_MSG {'%', 'k'};
             const u::bytes KEEP_ALIVE_ACK_MSG {'%', 'a'};
             const int RETRIES = 0;
+            const size_t MAX_BATCH_MESSAGES = 64; //per gather write
+            const size_t MAX_BATCH_BYTES = 256*1024; //per gather write
+
+            //binary frames are FRAME_MARK, version, type, flags and a 
+            //big endian 32 bit body size, followed by the body.
+            //the mark is never '!' so they can't be mistaken for a legacy
+            //"!<size>:" frame. peers say they read binary frames by 
+            //sending HELLO_MSG as a legacy frame, which old peers drop.
+            const char FRAME_MARK = '\xfb';
+            const char FRAME_VERSION = 1;
+            const size_t FRAME_HEADER_SIZE = 8; //in bytes
+            const size_t MAX_FRAME_SIZE = 256*1024*1024; //in bytes
+            const size_t BODY_READ_STEP = 64*1024; //in bytes, the body grows by this much at most per read
+            const u::bytes HELLO_MSG {'%', 'b', '1'};
+
+            enum frame_type { data_frame = 0, keep_alive_frame = 1, keep_alive_ack_frame = 2};
         }
 
         tcp_connection::tcp_connection(
                 ba::io_service& io, 
-                byte_queue& in,
-                tcp_connection_ptr_queue& last_in,
-                std::mutex& in_mutex,
+                endpoint_queue& in,
                 bool track,
-                bool con) :
+                bool con,
+                bool legacy_only) :
             _state{ con ? connected : disconnected},
             _io(io),
             _in_queue(in),
-            _in_mutex(in_mutex),
-            _last_in_socket(last_in),
             _track{track},
+            _legacy_only{legacy_only},
             _socket{new tcp::socket{io}},
             _writing{false},
             _retries{RETRIES}
@@ -96,7 +108,11 @@ namespace fire
         void tcp_connection::close()
         {
             _state = disconnected;
-            _writing = false;
+            {
+                u::mutex_scoped_lock ol(_out_mutex);
+                _writing = false;
+            }
+            _out_drained.notify_all();
             _io.post(boost::bind(&tcp_connection::do_close, this));
         }
 
@@ -104,7 +120,6 @@ namespace fire
         {
             u::mutex_scoped_lock l(_mutex);
             _state = disconnected;
-            _writing = false;
             if(_socket && _socket->is_open())
             {
                 boost::system::error_code se;
@@ -192,13 +207,187 @@ namespace fire
             INVARIANT(_socket);
             if(!_socket->is_open()) { close(); return; }
 
-            //read message header
+            //posted so frames already buffered don't recurse
+            if(_in_buffer.size() > 0) 
+            {
+                _io.post(boost::bind(&tcp_connection::read_frame, this));
+                return;
+            }
+
+            //read the start of the next frame
+            ba::async_read(*_socket, _in_buffer, ba::transfer_at_least(1),
+                    boost::bind(&tcp_connection::handle_frame_start, this,
+                        ba::placeholders::error,
+                        ba::placeholders::bytes_transferred));
+        }
+
+        void tcp_connection::handle_frame_start(const boost::system::error_code& error, size_t transferred)
+        {
+            INVARIANT(_socket);
+            if(_state == disconnected) return;
+            if(error) { _error = error; close(); return; }
+            if(!_socket->is_open()) { close(); return; }
+
+            read_frame();
+        }
+
+        void tcp_connection::read_frame()
+        {
+            REQUIRE_GREATER(_in_buffer.size(), 0);
+
+            //the first byte tells binary frames from legacy ones
+            auto first = *ba::buffer_cast<const char*>(*ba::buffer_sequence_begin(_in_buffer.data()));
+            if(first == FRAME_MARK) 
+            {
+                read_binary_header();
+                return;
+            }
+
+            //read legacy message header
             ba::async_read_until(*_socket, _in_buffer, ':',
                     boost::bind(&tcp_connection::handle_header, this,
                         ba::placeholders::error,
                         ba::placeholders::bytes_transferred));
         }
 
+        void tcp_connection::read_binary_header()
+        {
+            if(_in_buffer.size() >= FRAME_HEADER_SIZE)
+            {
+                handle_binary_header(boost::system::error_code(), 0);
+                return;
+            }
+
+            ba::async_read(*_socket, _in_buffer, 
+                    ba::transfer_at_least(FRAME_HEADER_SIZE - _in_buffer.size()),
+                    boost::bind(&tcp_connection::handle_binary_header, this,
+                        ba::placeholders::error,
+                        ba::placeholders::bytes_transferred));
+        }
+
+        u::bytes encode_frame_header(frame_type type, size_t size)
+        {
+            REQUIRE_LESS_EQUAL(size, MAX_FRAME_SIZE);
+
+            u::bytes h(FRAME_HEADER_SIZE);
+            h[0] = FRAME_MARK;
+            h[1] = FRAME_VERSION;
+            h[2] = static_cast<char>(type);
+            h[3] = 0; //flags, none yet
+            for(size_t i = 0; i < 4; i++)
+                h[4 + i] = static_cast<char>((size >> (8 * (3 - i))) & 0xff);
+
+            ENSURE_EQUAL(h.size(), FRAME_HEADER_SIZE);
+            return h;
+        }
+
+        void tcp_connection::handle_binary_header(const boost::system::error_code& error, size_t transferred)
+        {
+            INVARIANT(_socket);
+            if(_state == disconnected) return;
+            if(error) { _error = error; close(); return; }
+            if(!_socket->is_open()) { close(); return; }
+
+            REQUIRE_GREATER_EQUAL(_in_buffer.size(), FRAME_HEADER_SIZE);
+
+            std::array<unsigned char, FRAME_HEADER_SIZE> h;
+            ba::buffer_copy(ba::buffer(h), _in_buffer.data());
+            _in_buffer.consume(FRAME_HEADER_SIZE);
+
+            CHECK_EQUAL(static_cast<char>(h[0]), FRAME_MARK);
+
+            size_t size = 0;
+            for(size_t i = 4; i < FRAME_HEADER_SIZE; i++) size = (size << 8) | h[i];
+
+            if(h[1] != FRAME_VERSION || size > MAX_FRAME_SIZE)
+            {
+                LOG << "bad tcp frame from " << _ep.address << ":" << _ep.port << " version: " << static_cast<int>(h[1]) << " size: " << size << std::endl;
+                close();
+                return;
+            }
+
+            _in_type = h[2];
+            _in_size = size;
+
+            //the body grows as bytes arrive so a header alone, before the
+            //peer is known, can't make us allocate the whole frame
+            const auto buffered = std::min(_in_buffer.size(), size);
+            _in_body.resize(buffered);
+            if(buffered > 0)
+            {
+                ba::buffer_copy(ba::buffer(&_in_body[0], buffered), _in_buffer.data());
+                _in_buffer.consume(buffered);
+            }
+
+            read_binary_body();
+        }
+
+        void tcp_connection::read_binary_body()
+        {
+            const auto have = _in_body.size();
+            REQUIRE_LESS_EQUAL(have, _in_size);
+
+            if(have == _in_size)
+            {
+                handle_binary_frame();
+                return;
+            }
+
+            //read straight into the body, one step at a time
+            const auto step = std::min(BODY_READ_STEP, _in_size - have);
+            _in_body.resize(have + step);
+
+            ba::async_read(*_socket,
+                    ba::buffer(&_in_body[have], step),
+                    boost::bind(&tcp_connection::handle_binary_body, this,
+                        ba::placeholders::error,
+                        ba::placeholders::bytes_transferred));
+        }
+
+        void tcp_connection::handle_binary_body(const boost::system::error_code& error, size_t transferred)
+        {
+            INVARIANT(_socket);
+            if(_state == disconnected) return;
+            if(error) { _error = error; close(); return; }
+            if(!_socket->is_open()) { close(); return; }
+
+            read_binary_body();
+        }
+
+        void tcp_connection::handle_binary_frame()
+        {
+            REQUIRE_EQUAL(_in_body.size(), _in_size);
+
+            switch(_in_type)
+            {
+                case keep_alive_frame: send_keep_alive_ack(); break;
+                case keep_alive_ack_frame: _alive = true; break;
+                case data_frame: 
+                    {
+                        u::bytes data;
+                        data.swap(_in_body);
+                        if(!data.empty()) deliver(data);
+                    }
+                    break;
+                default: 
+                    LOG << "unknown tcp frame type " << static_cast<int>(_in_type) << " from " << _ep.address << ":" << _ep.port << std::endl;
+            }
+
+            _in_body.clear();
+            _in_size = 0;
+
+            //read next message
+            start_read();
+        }
+
+        void tcp_connection::deliver(u::bytes& data)
+        {
+            //the sender travels with the message so it can be replied to
+            endpoint_message m{get_endpoint(), std::move(data), true};
+            if(_track) m.from = shared_from_this();
+            _in_queue.emplace_push(m);
+        }
+
         void tcp_connection::handle_connect(
                 const boost::system::error_code& error,
                 tcp::endpoint endpoint)
@@ -215,12 +404,17 @@ namespace fire
                     _state = connected;
                 }
                 LOG << "new out tcp_connection " << _socket->local_endpoint() << " -> " << _socket->remote_endpoint() << ": " << error.message() << std::endl;
+
+                //writes are batched here, cork() holds them back instead of nagle
+                boost::system::error_code nd;
+                _socket->set_option(tcp::no_delay(true), nd);
+
+                send_hello();
                 start_read();
 
                 //if we have called send already before we connected,
                 //send the data
-                if(!_out_queue.empty()) 
-                    do_send(false);
+                do_send(false);
             }
             else 
             {
@@ -249,31 +443,65 @@ namespace fire
             }
         }
 
-        u::bytes encode_tcp_wire(const u::bytes data)
+        u::bytes encode_legacy_header(size_t size)
         {
-            auto m = u::encode(data);
-            u::bytes encoded;
-            encoded.resize(m.size() + 1);
-            encoded[0] = '!';
-            std::copy(m.begin(), m.end(), encoded.begin() + 1);
-            return encoded;
+            //"!<size>:", the body is sent after it as is
+            auto s = '!' + std::to_string(size) + ':';
+            return u::bytes(s.begin(), s.end());
         }
 
         bool tcp_connection::send(const u::bytes& b, bool block)
         {
             //add message to queue
-            _out_queue.push(b);
+            bool start = false;
+            {
+                u::mutex_scoped_lock l(_out_mutex);
+                _out_queue.push_back(b);
+
+                //only the first message of a burst needs to start a write,
+                //the rest go out with it or when it completes
+                start = !_writing && !_corked && _out_queue.size() == 1;
+            }
 
             //do send if we are connected
-            if(is_connected())
+            if(start && is_connected())
                 _io.post(boost::bind(&tcp_connection::do_send, this, false));
 
-            //if we are blocking, block until all messages are sent
-            while(block && !_out_queue.empty()) u::sleep_thread(BLOCK_SLEEP);
+            //if we are blocking, wait until the write completion says
+            //all messages are sent
+            if(block)
+            {
+                std::unique_lock<std::mutex> l(_out_mutex);
+                while((!_out_queue.empty() || _writing) && !is_disconnected()) 
+                    _out_drained.wait(l);
+            }
 
             return is_connected();
         }
 
+        void tcp_connection::send_hello()
+        {
+            if(_legacy_only) return;
+
+            //goes out before anything else queued
+            {
+                u::mutex_scoped_lock l(_out_mutex);
+                _out_queue.push_front(HELLO_MSG);
+            }
+            _io.post(boost::bind(&tcp_connection::do_send, this, false));
+        }
+
+        void tcp_connection::cork(bool c)
+        {
+            //while corked messages are held back so they can go out 
+            //together once uncorked
+            {
+                u::mutex_scoped_lock l(_out_mutex);
+                _corked = c;
+            }
+            if(!c) _io.post(boost::bind(&tcp_connection::do_send, this, false));
+        }
+
         void tcp_connection::send_keep_alive()
         {
             send(KEEP_ALIVE_MSG);
@@ -294,24 +522,89 @@ namespace fire
             _alive = false;
         }
 
+        size_t tcp_connection::take_batch()
+        {
+            u::mutex_scoped_lock l(_out_mutex);
+            if(_corked || _out_queue.empty()) 
+            {
+                _writing = false;
+                return 0;
+            }
+
+            //take up to MAX_BATCH_MESSAGES or MAX_BATCH_BYTES, 
+            //but always at least one message
+            _writing = true;
+            size_t bytes = 0;
+            while(!_out_queue.empty() 
+                    && _out_batch.size() < MAX_BATCH_MESSAGES
+                    && (_out_batch.empty() || bytes + _out_queue.front().size() <= MAX_BATCH_BYTES))
+            {
+                bytes += _out_queue.front().size();
+                _out_batch.emplace_back(std::move(_out_queue.front()));
+                _out_queue.pop_front();
+            }
+
+            ENSURE(_writing);
+            ENSURE_FALSE(_out_batch.empty());
+            return _out_batch.size();
+        }
+
+        void tcp_connection::frame_batch()
+        {
+            REQUIRE_FALSE(_out_batch.empty());
+
+            //each header is written in front of its body so the
+            //bodies are never copied
+            _out_headers.resize(_out_batch.size());
+            _out_buffers.clear();
+            for(size_t i = 0; i < _out_batch.size(); i++)
+            {
+                auto& b = _out_batch[i];
+                auto& h = _out_headers[i];
+                if(_binary)
+                {
+                    if(b == KEEP_ALIVE_MSG) 
+                    {
+                        h = encode_frame_header(keep_alive_frame, 0);
+                        b.clear();
+                    }
+                    else if(b == KEEP_ALIVE_ACK_MSG) 
+                    {
+                        h = encode_frame_header(keep_alive_ack_frame, 0);
+                        b.clear();
+                    }
+                    else h = encode_frame_header(data_frame, b.size());
+                }
+                else h = encode_legacy_header(b.size());
+
+                _out_buffers.push_back(ba::buffer(h));
+                if(!b.empty()) _out_buffers.push_back(ba::buffer(b));
+            }
+
+            ENSURE_GREATER_EQUAL(_out_buffers.size(), _out_batch.size());
+        }
+
         void tcp_connection::do_send(bool force)
         {
             ENSURE(_socket);
             if(_state == disconnected) return;
-            if(_out_queue.empty()) return;
 
             //check to see if a write is in progress
-            if(!force && _writing) return;
+            {
+                u::mutex_scoped_lock l(_out_mutex);
+                if(!force && _writing) return;
+            }
 
-            REQUIRE_FALSE(_out_queue.empty());
-            _writing = true;
+            if(take_batch() == 0) 
+            {
+                _out_drained.notify_all();
+                return;
+            }
 
-            //encode bytes to wire format
-            _out_buffer = encode_tcp_wire(_out_queue.front());
+            frame_batch();
 
-            ENSURE(_writing);
-            ba::async_write(*_socket,
-                    ba::buffer(&_out_buffer[0], _out_buffer.size()),
+            //one gather write for the whole batch
+            ba::async_write(*_socket, _out_buffers,
                         boost::bind(&tcp_connection::handle_write, this,
                             ba::placeholders::error,
                             ba::placeholders::bytes_transferred));
@@ -319,26 +612,16 @@ namespace fire
 
         void tcp_connection::handle_write(const boost::system::error_code& error, size_t transferred)
         {
-            if(_state == disconnected) { CHECK_FALSE(_writing); return;}
+            _out_batch.clear();
+            if(_state == disconnected) return;
             if(error) { _error = error; close(); return; }
             if(!_socket->is_open()) { close(); return; }
 
             INVARIANT(_socket);
-            REQUIRE_FALSE(_out_queue.empty());
-
-            //remove sent message
-            _out_queue.pop_front();
-
-            //if we are done sending finish the async write chain
-            if(_out_queue.empty()) 
-            {
-                _writing = false;
-                return;
-            }
 
-            //otherwise do another async write
+            //write what queued up meanwhile, or finish the 
+            //async write chain and wake blocked senders
             do_send(true);
-            ENSURE(_writing);
         }
 
         void tcp_connection::handle_header(const boost::system::error_code& error, size_t transferred)
@@ -422,21 +705,17 @@ namespace fire
                 return;
             }
 
-            u::bytes data;
-            data.resize(size);
-            std::istream in(&_in_buffer);
-            in.read(&data[0], size);
+            u::bytes data(size);
+            ba::buffer_copy(ba::buffer(data), _in_buffer.data());
+            _in_buffer.consume(size);
 
             //got keepalive or ack
             if(data == KEEP_ALIVE_MSG) send_keep_alive_ack();
             else if (data == KEEP_ALIVE_ACK_MSG) _alive = true;
+            //peer reads binary frames, send them from now on
+            else if (data == HELLO_MSG) _binary = !_legacy_only;
             //otherwise add message to in queue
-            else
-            {
-                u::mutex_scoped_lock l(_in_mutex);
-                _in_queue.emplace_push(data);
-                if(_track) _last_in_socket.push(this);
-            }
+            else deliver(data);
 
             //read next message
             start_read();
@@ -480,10 +759,13 @@ namespace fire
         }
 
         void tcp_run_thread(tcp_queue*);
-        void keep_alive_thread(tcp_queue*);
-        tcp_queue::tcp_queue(const asio_params& p) : 
+        tcp_queue::tcp_queue(const asio_params& p, endpoint_queue_ptr in) : 
             _p(p), 
             _io{new ba::io_service},
+            _work{new ba::io_service::work{*_io}},
+            _keep_alive_timer{*_io},
+            _in_queue{in ? in : std::make_shared<endpoint_queue>()},
+            _shared_in{in != nullptr},
             _done{false}
         {
             switch(_p.mode)
@@ -497,11 +779,11 @@ namespace fire
             if(_p.mode != asio_params::delayed_connect)
             {
                 _run_thread.reset(new std::thread{tcp_run_thread, this});
-                _keep_alive_thread.reset(new std::thread{keep_alive_thread, this});
+                start_keep_alive();
             }
 
             INVARIANT(_io);
-            INVARIANT(_p.mode == asio_params::delayed_connect || (_run_thread && _keep_alive_thread));
+            INVARIANT(_p.mode == asio_params::delayed_connect || _run_thread);
         }
 
         tcp_queue::~tcp_queue() 
@@ -510,11 +792,11 @@ namespace fire
             if(_out) _out->close();
 
             _done = true;
+            _work.reset();
             _io->stop();
-            if(_p.block) _in_queue.done();
+            if(_p.block && !_shared_in) _in_queue->done();
             if(_p.wait > 0) u::sleep_thread(_p.wait);
             if(_run_thread) _run_thread->join();
-            if(_keep_alive_thread) _keep_alive_thread->join();
         }
 
         bool tcp_queue::send(const u::bytes& b)
@@ -531,8 +813,19 @@ namespace fire
 
         bool tcp_queue::receive(u::bytes& b)
         {
+            INVARIANT(_in_queue);
+
             //return true if we got message
-            return _in_queue.pop(b, _p.block);
+            endpoint_message m;
+            if(!_in_queue->pop(m, _p.block)) return false;
+
+            b = std::move(m.data);
+            if(_p.track_incoming)
+            {
+                u::mutex_scoped_lock l(_mutex);
+                _last_in_socket = m.from;
+            }
+            return true;
         }
 
         void tcp_queue::connect(const std::string& host, port_type port)
@@ -551,9 +844,13 @@ namespace fire
 
             //start up engine
             _run_thread.reset(new std::thread{tcp_run_thread, this});
-            _keep_alive_thread.reset(new std::thread{keep_alive_thread, this});
+            start_keep_alive();
             ENSURE(_run_thread);
-            ENSURE(_keep_alive_thread);
+        }
+
+        void tcp_queue::cork(bool c)
+        {
+            if(_out) _out->cork(c);
         }
 
         bool tcp_queue::is_connected()
@@ -571,13 +868,44 @@ namespace fire
             return _out && _out->is_disconnected();
         }
 
+        void tcp_queue::start_keep_alive()
+        {
+            if(!_out) return;
+
+            _out->send_keep_alive();
+            _io->post(boost::bind(&tcp_queue::arm_keep_alive, this));
+        }
+
+        void tcp_queue::arm_keep_alive()
+        {
+            _keep_alive_timer.expires_from_now(std::chrono::milliseconds(KEEP_ALIVE_INTERVAL));
+            _keep_alive_timer.async_wait(boost::bind(&tcp_queue::handle_keep_alive, this, ba::placeholders::error));
+        }
+
+        void tcp_queue::handle_keep_alive(const boost::system::error_code& error)
+        {
+            if(error == ba::error::operation_aborted) return;
+            if(!_out || _out->is_disconnected()) return;
+
+            //close the connection if the other side did not answer the last one
+            if(!_out->is_alive()) 
+            {
+                _out->close();
+                return;
+            }
+
+            _out->send_keep_alive();
+            _out->reset_alive();
+            arm_keep_alive();
+        }
+
         void tcp_queue::delayed_connect()
         try
         {
             INVARIANT(_io);
             REQUIRE(!_out);
 
-            _out.reset(new tcp_connection{*_io, _in_queue, _last_in_socket, _mutex});
+            _out.reset(new tcp_connection{*_io, *_in_queue, false, false, _p.legacy_framing});
             if(_p.local_port > 0) _out->bind(_p.local_port);
 
             ENSURE(_out);
@@ -643,7 +971,7 @@ namespace fire
             }
 
             //prepare incoming tcp_connection
-            tcp_connection_ptr new_connection{new tcp_connection{*_io, _in_queue, _last_in_socket, _mutex, _p.track_incoming, true}};
+            tcp_connection_ptr new_connection{new tcp_connection{*_io, *_in_queue, _p.track_incoming, true, _p.legacy_framing}};
             _acceptor->async_accept(new_connection->socket(),
                     bind(&tcp_queue::handle_accept, this, new_connection,
                         ba::placeholders::error));
@@ -665,11 +993,14 @@ namespace fire
             LOG << "new in tcp_connection " << nc->socket().remote_endpoint() << " " << error.message() << std::endl;
 
             _in_connections.push_back(nc);
+            boost::system::error_code nd;
+            nc->socket().set_option(tcp::no_delay(true), nd);
             nc->update_endpoint();
+            nc->send_hello();
             nc->start_read();
 
             //prepare next incoming tcp_connection
-            tcp_connection_ptr new_connection{new tcp_connection{*_io, _in_queue, _last_in_socket, _mutex, _p.track_incoming, true}};
+            tcp_connection_ptr new_connection{new tcp_connection{*_io, *_in_queue, _p.track_incoming, true, _p.legacy_framing}};
             _acceptor->async_accept(new_connection->socket(),
                     boost::bind(&tcp_queue::handle_accept, this, new_connection,
                         ba::placeholders::error));
@@ -677,14 +1008,19 @@ namespace fire
             ENSURE(new_connection);
         }
 
-        connection* tcp_queue::get_socket() const
+        connection_ptr tcp_queue::get_socket() const
         {
-            tcp_connection* p = nullptr;
+            connection_ptr p;
             switch(_p.mode)
             {
-                case asio_params::bind: if(_p.track_incoming) _last_in_socket.pop(p); break;
+                case asio_params::bind: 
+                    {
+                        u::mutex_scoped_lock l(_mutex);
+                        if(_p.track_incoming) p = _last_in_socket.lock(); 
+                    }
+                    break;
                 case asio_params::delayed_connect:
-                case asio_params::connect: p = _out.get(); break;
+                case asio_params::connect: p = _out; break;
                 default:
                     CHECK(false && "missed case");
             }
@@ -695,53 +1031,12 @@ namespace fire
         {
             CHECK(q);
             CHECK(q->_io);
-            if(q->_out) q->_out->send_keep_alive();
 
+            //work keeps run from returning until the queue is destroyed
             while(!q->_done) 
             try
             {
                 q->_io->run();
-                u::sleep_thread(THREAD_SLEEP);
-                if(q->_out && q->_out->is_disconnected())
-                    break;
-            }
-            catch(std::exception& e)
-            {
-                LOG << "error in tcp thread. " << e.what() << std::endl;
-                if(q->_out) q->_out->close();
-            }
-            catch(...)
-            {
-                LOG << "unknown error in tcp thread." << std::endl;
-                if(q->_out) q->_out->close();
-            }
-        }
-
-        void keep_alive_thread(tcp_queue* q)
-        {
-            CHECK(q);
-            size_t ticks = 0;
-            if(q->_out) q->_out->send_keep_alive();
-
-            while(!q->_done) 
-            try
-            {
-                //do keepalive
-                if(q->_out && !q->_out->is_disconnected() && ticks > KEEP_ALIVE_THRESH)
-                {
-                    if(q->_out->is_alive()) 
-                    {
-                        q->_out->send_keep_alive();
-                        q->_out->reset_alive();
-                    }
-                    else q->_out->close();
-                    ticks = 0;
-                }
-                ticks++;
-                u::sleep_thread(KEEP_ALIVE_SLEEP);
-
-                if(q->_out && q->_out->is_disconnected())
-                    break;
             }
             catch(std::exception& e)
             {
@@ -755,18 +1050,19 @@ namespace fire
             }
         }
 
-        tcp_queue_ptr create_tcp_queue(const address_components& c)
+        tcp_queue_ptr create_tcp_queue(const address_components& c, endpoint_queue_ptr in)
         {
             auto p = parse_params(c);
-            return tcp_queue_ptr{new tcp_queue{p}};
+            return tcp_queue_ptr{new tcp_queue{p, in}};
         }
 
         tcp_queue_ptr create_tcp_queue(
                 const std::string& address, 
-                const queue_options& defaults)
+                const queue_options& defaults,
+                endpoint_queue_ptr in)
         {
             auto c = parse_address(address, defaults); 
-            tcp_queue_ptr p = create_tcp_queue(c);
+            tcp_queue_ptr p = create_tcp_queue(c, in);
             ENSURE(p);
             return p;
         }
@@ -36,6 +36,10 @@
 #include "network/message_queue.hpp"
 #include "util/thread.hpp"
 
+#include <boost/asio/steady_timer.hpp>
+
+#include <deque>
+
 namespace fire
 {
     namespace network
@@ -46,21 +50,20 @@ namespace fire
 
         class tcp_connection;
         class tcp_queue;
-        using tcp_connection_ptr_queue = util::queue<tcp_connection*>;
-        using connection_ptr_queue = util::queue<connection*>;
 
-        class tcp_connection : public connection
+        class tcp_connection : 
+            public connection, 
+            public std::enable_shared_from_this<tcp_connection>
         {
             public:
                 enum con_state{connecting, connected, disconnected};
 
                 tcp_connection(
                         boost::asio::io_service& io, 
-                        byte_queue& in,
-                        tcp_connection_ptr_queue& last_in,
-                        std::mutex& in_mutex,
+                        endpoint_queue& in,
                         bool track = false,
-                        bool con = false);
+                        bool con = false,
+                        bool legacy_only = false);
                 ~tcp_connection();
             public:
                 virtual bool send(const fire::util::bytes& b, bool block = false);
@@ -71,6 +74,8 @@ namespace fire
             public:
                 void send_keep_alive();
                 void send_keep_alive_ack();
+                void send_hello();
+                void cork(bool);
                 bool is_alive(); 
                 void reset_alive(); 
                 void bind(port_type port);
@@ -93,19 +98,42 @@ namespace fire
                         boost::asio::ip::tcp::endpoint e);
                 void handle_punch(const boost::system::error_code& error);
                 void do_send(bool);
+                size_t take_batch();
+                void frame_batch();
                 void handle_write(const boost::system::error_code& error, size_t);
+                void read_frame();
+                void read_binary_header();
+                void handle_frame_start(const boost::system::error_code& error, size_t);
                 void handle_header(const boost::system::error_code& error, size_t);
                 void handle_body(const boost::system::error_code& error, size_t, size_t);
+                void handle_binary_header(const boost::system::error_code& error, size_t);
+                void read_binary_body();
+                void handle_binary_body(const boost::system::error_code& error, size_t);
+                void handle_binary_frame();
+                void deliver(util::bytes& data);
             private:
 
                 con_state _state;
                 boost::asio::io_service& _io;
-                byte_queue& _in_queue;
-                std::mutex& _in_mutex;
-                byte_queue _out_queue;
-                tcp_connection_ptr_queue& _last_in_socket;
+                endpoint_queue& _in_queue;
                 bool _track;
-                util::bytes _out_buffer;
+                bool _legacy_only; //never offer binary frames
+                bool _binary = false; //peer said it reads binary frames
+
+                //messages wait here and are written in batches, one 
+                //gather write per batch. _writing is guarded by the same 
+                //mutex so blocked senders are woken when the queue drains.
+                std::deque<util::bytes> _out_queue;
+                std::mutex _out_mutex;
+                std::condition_variable _out_drained;
+                bool _corked = false;
+                std::vector<util::bytes> _out_batch;
+                std::vector<util::bytes> _out_headers;
+                std::vector<boost::asio::const_buffer> _out_buffers;
+
+                util::bytes _in_body; //grows as the body arrives
+                size_t _in_size = 0; //body size from the frame header
+                unsigned char _in_type = 0;
                 endpoint _ep;
                 boost::asio::streambuf _in_buffer;
                 tcp_socket_ptr _socket;
@@ -125,7 +153,7 @@ namespace fire
         class tcp_queue : public message_queue
         {
             public:
-                tcp_queue(const asio_params& p);
+                tcp_queue(const asio_params& p, endpoint_queue_ptr in = nullptr);
                 virtual ~tcp_queue();
 
             public:
@@ -133,8 +161,9 @@ namespace fire
                 virtual bool receive(util::bytes& b);
 
             public:
-                connection* get_socket() const;
+                connection_ptr get_socket() const;
                 void connect(const std::string& host, port_type port);
+                void cork(bool);
                 bool is_connected();
                 bool is_connecting();
                 bool is_disconnected();
@@ -143,35 +172,42 @@ namespace fire
                 void connect();
                 void delayed_connect();
                 void accept();
+                void start_keep_alive();
+                void arm_keep_alive();
 
             private:
                 void handle_accept(tcp_connection_ptr nc, const boost::system::error_code& error);
+                void handle_keep_alive(const boost::system::error_code& error);
 
             private:
                 asio_params _p;
                 asio_service_ptr _io;
+                asio_work_ptr _work;
+                boost::asio::steady_timer _keep_alive_timer;
                 tcp_resolver_ptr _resolver;
                 tcp_acceptor_ptr _acceptor;
                 util::thread_uptr _run_thread;
-                util::thread_uptr _keep_alive_thread;
 
                 tcp_connection_ptr _out;
-                mutable tcp_connection_ptr_queue _last_in_socket;
+                connection_wptr _last_in_socket;
                 tcp_connections _in_connections;
-                byte_queue _in_queue;
+                endpoint_queue_ptr _in_queue;
+                bool _shared_in; //someone else owns the in queue
                 mutable std::mutex _mutex;
 
                 bool _done;
 
             private:
                 friend void tcp_run_thread(tcp_queue*);
-                friend void keep_alive_thread(tcp_queue*);
         };
 
         using tcp_queue_ptr = std::shared_ptr<tcp_queue>;
 
-        tcp_queue_ptr create_tcp_queue(const address_components& c);
-        tcp_queue_ptr create_tcp_queue(const std::string& address, const queue_options& defaults);
+        tcp_queue_ptr create_tcp_queue(const address_components& c, endpoint_queue_ptr in = nullptr);
+        tcp_queue_ptr create_tcp_queue(
+                const std::string& address, 
+                const queue_options& defaults, 
+                endpoint_queue_ptr in = nullptr);
     }
 }
 
@@ -36,11 +36,22 @@
 #include "util/dbc.hpp"
 #include "util/log.hpp"
 
+#include <array>
 #include <stdexcept>
 #include <sstream>
 #include <functional>
+#include <cmath>
 #include <boost/bind.hpp>
 
+#ifdef __linux__
+#include <sys/socket.h>
+#include <cerrno>
+#define FIRESTR_UDP_MMSG
+#ifdef SO_REUSEPORT
+#define FIRESTR_UDP_REUSEPORT
+#endif
+#endif
+
 namespace u = fire::util;
 namespace ba = boost::asio;
 using namespace boost::asio::ip;
@@ -51,49 +62,145 @@ namespace fire
     {
         namespace
         {
-            const size_t MAX_FLIGHT = 4;
-            const size_t BLOCK_SLEEP = 10;
-            const size_t THREAD_SLEEP = 40;
-            const size_t RESEND_THREAD_SLEEP = 1000;
-            const size_t RESEND_TICK_THRESHOLD = 1; //resend after 1 seconds
-            const size_t RESEND_THRESHOLD = 5; //purge message after 5 seconds
-            const size_t UDP_PACKET_SIZE = 512; //in bytes
-            const size_t MAX_UDP_BUFF_SIZE = UDP_PACKET_SIZE*2; 
+            const double INITIAL_CWND = 4; //in chunks
+            const double MIN_CWND = 2; //in chunks
+            const double MAX_CWND = 4096; //in chunks
+            const double INITIAL_RTO = 1000; //in milliseconds
+            const double MIN_RTO = 200; //in milliseconds
+            const double MAX_RTO = 60000; //in milliseconds
+            const double RTT_ALPHA = 1.0 / 8.0;
+            const double RTT_BETA = 1.0 / 4.0;
+            const size_t PURGE_TIMEOUT = 5000; //in milliseconds, give up on a message without acks this long
+            const size_t DUP_THRESH = 3; //chunks acked past an unacked one before it is fast resent
+            const size_t MAX_TAIL_PROBES = 2; //resends without an ack before waiting for the rto
+            const double MIN_PROBE_TIMEOUT = 10; //in milliseconds
+            const size_t MAX_COMPLETED = 1024; //completed incoming messages remembered
+            const size_t PROBE_TIMEOUT = 500; //in milliseconds, before an mtu probe is retried
+            const int SOCKET_BUFFER_SIZE = 4*1024*1024; //in bytes, room for large congestion windows
+            const size_t ACK_DELAY = 5; //in milliseconds, how long selective acks are coalesced
+            const size_t ACK_EVERY = 8; //send a selective ack at least every this many chunks
+            const size_t MAX_SACK_BYTES = 128; //bitmap covers 1024 chunks past the cumulative ack
+            const size_t UDP_PACKET_SIZE = 512; //in bytes, every peer understands this size
+            const size_t DEFAULT_MTU = 1400; //in bytes, largest packet probed for by default
+            const size_t MAX_PACKET_SIZE = 1472; //in bytes, ethernet mtu minus ip and udp headers
+            const size_t MAX_UDP_BUFF_SIZE = MAX_PACKET_SIZE*2; 
+            const util::bytes PADDING(MAX_PACKET_SIZE); //zeros probes are padded with
+
+#ifdef FIRESTR_UDP_REUSEPORT
+            using reuse_port_option = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+            const size_t PROBE_RETRIES = 2;
             const size_t SEQUENCE_BASE = 1;
             const size_t CHUNK_TOTAL_BASE = SEQUENCE_BASE + sizeof(sequence_type);
             const size_t CHUNK_BASE = CHUNK_TOTAL_BASE + sizeof(chunk_total_type);
             const size_t MESSAGE_BASE = CHUNK_BASE + sizeof(chunk_id_type);
+            const size_t CHUNK_SIZE_BASE = MESSAGE_BASE;
+            const size_t SIZED_MESSAGE_BASE = CHUNK_SIZE_BASE + sizeof(chunk_size_type);
 
             //<mark> <sequence num> <message_chunk total> <message_chunk>
             const size_t HEADER_SIZE = MESSAGE_BASE;
             const size_t UDP_CHuNK_SIZE = UDP_PACKET_SIZE - HEADER_SIZE; //in bytes
 
+            //<mark> <sequence num> <message_chunk total> <message_chunk> <chunk size>
+            //used once a peer acked a larger mtu probe
+            const size_t SIZED_HEADER_SIZE = SIZED_MESSAGE_BASE;
+            const size_t MAX_CHUNK_SIZE = MAX_PACKET_SIZE - SIZED_HEADER_SIZE;
+
             const size_t MAX_CHUNKS = std::pow(2,sizeof(chunk_total_type)*8);
             const size_t MAX_MESSAGE_SIZE = MAX_CHUNKS * UDP_CHuNK_SIZE;
+            const size_t MAX_BATCH = 1024; //datagrams per sendmmsg/recvmmsg
         }
 
-        udp_queue_ptr create_udp_queue(const asio_params& p)
+        struct udp_batch
+        {
+            udp_batch(size_t s) : 
+                size{s}, 
+                out(s), 
+                out_chunk(s),
+                out_ep(s),
+                in(s, util::bytes(MAX_UDP_BUFF_SIZE)),
+                in_ep(s)
+#ifdef FIRESTR_UDP_MMSG
+                , out_hdr(s), out_iov(2*s), in_hdr(s), in_iov(s)
+#endif
+            {
+                REQUIRE_GREATER(size, 0);
+            }
+
+            size_t size;
+
+            //encoded headers and their chunks waiting for the socket
+            std::vector<util::bytes> out;
+            std::vector<message_chunk> out_chunk;
+            std::vector<udp::endpoint> out_ep;
+            size_t out_count = 0;
+            size_t out_next = 0;
+
+            //datagrams read in one call
+            std::vector<util::bytes> in;
+            std::vector<udp::endpoint> in_ep;
+
+#ifdef FIRESTR_UDP_MMSG
+            std::vector<mmsghdr> out_hdr;
+            std::vector<iovec> out_iov;
+            std::vector<mmsghdr> in_hdr;
+            std::vector<iovec> in_iov;
+#endif
+        };
+
+        udp_queue_ptr create_udp_queue(const asio_params& p, endpoint_queue_ptr in)
         {
-            return udp_queue_ptr{new udp_queue{p}};
+            return udp_queue_ptr{new udp_queue{p, in}};
         }
 
         udp_connection::udp_connection(
                 endpoint_queue& in,
-                boost::asio::io_service& io) :
+                boost::asio::io_service& io,
+                size_t batch,
+                size_t mtu,
+                const udp_connections* shards,
+                const util::watermarks& peer_limits) :
             _in_buffer(MAX_UDP_BUFF_SIZE),
             _in_queue(in),
             _io(io),
             _socket{new udp::socket{io}},
-            _writing{false}
+            _writing{false},
+            _mtu{mtu == 0 ? DEFAULT_MTU : std::max(UDP_PACKET_SIZE, std::min(mtu, MAX_PACKET_SIZE))},
+            _ack_timer{io},
+            _probe_timer{io},
+            _shards{shards},
+            _peer_limits(peer_limits)
         {
             boost::system::error_code error;
             _socket->open(udp::v4(), error);
 
+            if(batch > 1)
+            {
+#ifdef FIRESTR_UDP_MMSG
+                _batch.reset(new udp_batch{std::min(batch, MAX_BATCH)});
+#else
+                LOG << "udp batching is not supported on this platform, sending one datagram at a time" << std::endl;
+#endif
+            }
+
             INVARIANT(_socket);
+            INVARIANT_BETWEEN(_mtu, UDP_PACKET_SIZE, MAX_PACKET_SIZE);
         }
 
+        udp_connection::~udp_connection() {}
+
         void udp_connection::close()
         {
+            //senders blocked on a full peer give up
+            {
+                u::mutex_scoped_lock l(_rooms_mutex);
+                for(auto& r : _rooms) r.second->done();
+            }
+            {
+                u::mutex_scoped_lock l(_out_mutex);
+                _closed = true;
+            }
+            _out_drained.notify_all();
             _io.post(boost::bind(&udp_connection::do_close, this));
         }
 
@@ -104,31 +211,273 @@ namespace fire
             _writing = false;
         }
 
-        void udp_connection::init_working(message_chunk& proto, util::bytes& data)
+        void init_congestion(congestion& cc)
+        {
+            cc.cwnd = INITIAL_CWND;
+            cc.ssthresh = MAX_CWND;
+            cc.rto = INITIAL_RTO;
+        }
+
+        size_t window(const congestion& cc)
+        {
+            return static_cast<size_t>(cc.cwnd);
+        }
+
+        void rtt_sample(congestion& cc, double rtt)
+        {
+            REQUIRE_GREATER_EQUAL(rtt, 0);
+
+            //first sample initializes the estimate
+            if(cc.srtt == 0)
+            {
+                cc.srtt = rtt;
+                cc.rttvar = rtt / 2;
+            }
+            else
+            {
+                cc.rttvar = (1 - RTT_BETA) * cc.rttvar + RTT_BETA * std::abs(cc.srtt - rtt);
+                cc.srtt = (1 - RTT_ALPHA) * cc.srtt + RTT_ALPHA * rtt;
+            }
+
+            cc.rto = std::max(MIN_RTO, std::min(MAX_RTO, cc.srtt + 4 * cc.rttvar));
+            ENSURE_BETWEEN(cc.rto, MIN_RTO, MAX_RTO);
+        }
+
+        void grow_window(congestion& cc)
+        {
+            //slow start doubles the window every round trip,
+            //congestion avoidance adds a chunk per round trip
+            if(cc.cwnd < cc.ssthresh) cc.cwnd += 1;
+            else cc.cwnd += 1 / cc.cwnd;
+
+            cc.cwnd = std::min(cc.cwnd, MAX_CWND);
+        }
+
+        void shrink_window(congestion& cc)
+        {
+            cc.ssthresh = std::max(MIN_CWND, cc.cwnd / 2);
+            cc.cwnd = cc.ssthresh;
+            cc.losses++;
+
+            ENSURE_GREATER_EQUAL(cc.cwnd, MIN_CWND);
+        }
+
+        void backoff_rto(congestion& cc)
+        {
+            cc.rto = std::min(MAX_RTO, cc.rto * 2);
+        }
+
+        double probe_timeout(const congestion& cc)
+        {
+            //a couple round trips plus the time the receiver may hold its ack
+            if(cc.srtt == 0) return cc.rto;
+            return std::min(cc.rto, std::max(MIN_PROBE_TIMEOUT, 2 * cc.srtt + ACK_DELAY));
+        }
+
+        udp_clock::duration to_duration(double milliseconds)
+        {
+            using ms = std::chrono::duration<double, std::milli>;
+            return std::chrono::duration_cast<udp_clock::duration>(ms(milliseconds));
+        }
+
+        working_message& message_slots::add(sequence_type sequence)
+        {
+            REQUIRE_FALSE(_index.count(sequence));
+
+            slot_index i = _slots.size();
+            if(_free.empty()) _slots.emplace_back();
+            else
+            {
+                i = _free.back();
+                _free.pop_back();
+            }
+
+            auto& s = _slots[i];
+            CHECK_FALSE(s.used);
+            CHECK_FALSE(s.ring);
+            s.used = true;
+
+            _index[sequence] = i;
+
+            ENSURE(_slots[i].used);
+            return s.wm;
+        }
+
+        void message_slots::remove(sequence_type sequence)
+        {
+            auto si = _index.find(sequence);
+            if(si == _index.end()) return;
+
+            const auto i = si->second;
+            _index.erase(si);
+
+            auto& s = _slots[i];
+            CHECK(s.used);
+            if(s.ring) unlink_slot(i);
+
+            //release the message memory and timer but keep the slot
+            s.wm = working_message{};
+            s.used = false;
+            _free.push_back(i);
+        }
+
+        working_message* message_slots::find(sequence_type sequence)
+        {
+            auto si = _index.find(sequence);
+            if(si == _index.end()) return nullptr;
+
+            CHECK_RANGE(si->second, 0, _slots.size());
+            return &_slots[si->second].wm;
+        }
+
+        size_t message_slots::size() const
+        {
+            return _index.size();
+        }
+
+        void message_slots::link(sequence_type sequence, send_ring& r)
+        {
+            auto si = _index.find(sequence);
+            REQUIRE(si != _index.end());
+
+            const auto i = si->second;
+            auto& s = _slots[i];
+            if(s.ring) return;
+
+            //link in just behind the current slot so it is visited last
+            if(r.size == 0)
+            {
+                s.prev = s.next = i;
+                r.current = i;
+            }
+            else
+            {
+                auto& c = _slots[r.current];
+                s.next = r.current;
+                s.prev = c.prev;
+                _slots[c.prev].next = i;
+                c.prev = i;
+            }
+
+            s.ring = &r;
+            r.size++;
+
+            ENSURE(_slots[i].ring == &r);
+        }
+
+        void message_slots::unlink(sequence_type sequence)
+        {
+            auto si = _index.find(sequence);
+            REQUIRE(si != _index.end());
+
+            if(_slots[si->second].ring) unlink_slot(si->second);
+        }
+
+        void message_slots::unlink_slot(slot_index i)
+        {
+            auto& s = _slots[i];
+            REQUIRE(s.ring);
+
+            auto& r = *s.ring;
+            REQUIRE_GREATER(r.size, 0);
+
+            //round robin picks up after the removed slot
+            _slots[s.prev].next = s.next;
+            _slots[s.next].prev = s.prev;
+            if(r.current == i) r.current = s.prev;
+
+            r.size--;
+            s.ring = nullptr;
+        }
+
+        bool message_slots::linked(sequence_type sequence) const
+        {
+            auto si = _index.find(sequence);
+            return si != _index.end() && _slots[si->second].ring;
+        }
+
+        working_message& message_slots::next(send_ring& r)
+        {
+            REQUIRE_GREATER(r.size, 0);
+
+            r.current = _slots[r.current].next;
+
+            ENSURE(_slots[r.current].used);
+            ENSURE(_slots[r.current].ring == &r);
+            return _slots[r.current].wm;
+        }
+
+        void udp_connection::init_working(message_chunk& proto, util::bytes_ptr data, udp_peer& peer)
         {
             REQUIRE_GREATER(proto.total_chunks, 0);
+            REQUIRE(data);
 
-            //add to working map
-            auto& wm = _out_working[proto.sequence];
+            //add to working set
+            auto& wm = _out_working.add(proto.sequence);
 
             wm.proto = std::move(proto);
             wm.data = std::move(data);
-            wm.set.resize(proto.total_chunks);
-            wm.sent.resize(proto.total_chunks);
 
-            message_ring_item ri = { &wm,  chunk_id_queue()};
-            _message_ring.emplace_back(ri);
+            const auto chunks = wm.proto.total_chunks;
+            wm.set.resize(chunks);
+            wm.sent.resize(chunks);
+            wm.resent.resize(chunks);
+            wm.flying.resize(chunks);
+            wm.sent_at.resize(chunks);
+            wm.peer = &peer;
+            wm.last_ack = udp_clock::now();
+
+            //robust messages get a retransmit timer. it is armed right
+            //away so a message to a peer that stops acking is purged.
+            if(wm.proto.type == message_chunk::msg)
+            {
+                wm.timer.reset(new udp_timer{_io});
+                arm_resend_timer(wm);
+            }
+
+            start_sending(wm);
+        }
+
+        void udp_connection::start_sending(working_message& wm)
+        {
+            REQUIRE(wm.peer);
+
+            auto& p = *wm.peer;
+            auto& r = wm.proto.type == message_chunk::msg ? p.robust : p.unreliable;
+            _out_working.link(wm.proto.sequence, r);
+
+            if(p.sending) return;
+            p.sending = true;
+            _sending.push_back(&p);
         }
 
         void udp_connection::cleanup_message(sequence_type s)
         {
-            //cleanup ring buffer
-            auto ring_iter = std::find_if(_message_ring.begin(), _message_ring.end(), 
-                    [s](const message_ring_item& i){ return i.wm->proto.sequence == s;});
-            CHECK(ring_iter != _message_ring.end());
+            auto wm = _out_working.find(s);
+            CHECK(wm);
+
+            //chunks never acked no longer count against the peer window
+            if(wm->peer) wm->peer->cc.in_flight -= std::min(wm->peer->cc.in_flight, wm->in_flight);
 
-            _message_ring.erase(ring_iter);
-            _out_working.erase(s);
+            //make room for senders waiting on the peer
+            if(wm->room) 
+            {
+                CHECK(wm->data);
+                u::mutex_scoped_lock l(_rooms_mutex);
+                wm->room->remove(wm->data->size());
+                _stats.queued_bytes -= std::min(_stats.queued_bytes, wm->data->size());
+            }
+
+            if(wm->left)
+            {
+                {
+                    u::mutex_scoped_lock l(_out_mutex);
+                    *wm->left = true;
+                }
+                _out_drained.notify_all();
+            }
+
+            _out_working.remove(s);
         }
 
         bool all_sent(working_message& wm)
@@ -136,51 +485,293 @@ namespace fire
             return wm.sent.count() == wm.proto.total_chunks;
         }
 
+        bool is_data(const message_chunk& c)
+        {
+            return c.type == message_chunk::msg || c.type == message_chunk::qmsg;
+        }
+
+        bool is_ack(const message_chunk& c)
+        {
+            return c.type == message_chunk::ack || 
+                c.type == message_chunk::sack || 
+                c.type == message_chunk::probe_ack;
+        }
+
+        const char* payload_of(const message_chunk& ch)
+        {
+            //data chunks point into their message or the read buffer
+            if(ch.payload) return ch.payload;
+
+            //chunks that own their payload, like selective acks, write it from data
+            if(!ch.data.empty())
+            {
+                CHECK_EQUAL(ch.payload_size, ch.data.size());
+                return ch.data.data();
+            }
+
+            //probes are padding
+            CHECK_LESS_EQUAL(ch.payload_size, PADDING.size());
+            return PADDING.data();
+        }
+
         void udp_connection::sent_chunk(const message_chunk& c)
         {
-            REQUIRE(c.type != message_chunk::ack);
-            REQUIRE_FALSE(c.resent);
+            REQUIRE(is_data(c));
+
+            auto wmp = _out_working.find(c.sequence);
+            if(!wmp) return;
+
+            auto& wm = *wmp;
+            CHECK(wm.peer);
 
-            auto& wm = _out_working[c.sequence];
-            wm.sent[c.chunk] = 1;
             if(wm.queued > 0) wm.queued--;
+            if(!c.resent) wm.sent[c.chunk] = 1;
 
             bool robust = wm.proto.type == message_chunk::msg;
-            if(robust) wm.in_flight++;
+            if(robust) 
+            {
+                if(!wm.flying[c.chunk])
+                {
+                    wm.flying[c.chunk] = 1;
+                    wm.in_flight++;
+                    wm.peer->cc.in_flight++;
+                }
+                const auto now = udp_clock::now();
+                wm.sent_at[c.chunk] = now;
+                wm.last_sent = now;
+
+                //bring the timer in if it is waiting on something later
+                //than this chunk's probe timeout
+                const auto due = now + to_duration(probe_timeout(wm.peer->cc));
+                if(wm.deadline == udp_clock::time_point{} || wm.deadline > due) arm_resend_timer(wm);
+            }
             else if(all_sent(wm)) cleanup_message(c.sequence);
         }
 
-        void udp_connection::validate_chunk(const message_chunk& c)
+        bool udp_connection::ack_chunk(working_message& wm, chunk_id_type chunk_n)
         {
-            REQUIRE(c.type == message_chunk::ack);
+            REQUIRE_LESS(chunk_n, wm.proto.total_chunks);
+            REQUIRE(wm.peer);
 
-            auto& w = _out_working;
+            if(wm.set[chunk_n]) return false;
 
-            auto chunk_n = c.chunk;
-            auto sequence_n = c.sequence;
+            auto& peer = *wm.peer;
+
+            wm.set[chunk_n] = 1;
+            wm.last_ack = udp_clock::now();
+            wm.tail_probes = 0;
+            while(wm.acked_base < wm.proto.total_chunks && wm.set[wm.acked_base]) wm.acked_base++;
 
-            auto wmi = w.find(sequence_n);
-            if(wmi == w.end()) return;
+            if(chunk_n + 1u > wm.highest_acked) wm.highest_acked = chunk_n + 1;
+            wm.newest_acked_sent = std::max(wm.newest_acked_sent, wm.sent_at[chunk_n]);
 
-            auto& wm = wmi->second;
+            if(wm.flying[chunk_n])
+            {
+                wm.flying[chunk_n] = 0;
+                if(wm.in_flight > 0) wm.in_flight--;
+                if(peer.cc.in_flight > 0) peer.cc.in_flight--;
+            }
+            grow_window(peer.cc);
+            return true;
+        }
 
-            if(chunk_n >= wm.proto.total_chunks) return;
-            if(c.total_chunks != wm.proto.total_chunks) return;
-            if(wm.set[chunk_n]) return;
+        void udp_connection::acked(working_message& wm, udp_clock::time_point newest_sent)
+        {
+            REQUIRE(wm.peer);
+            auto& peer = *wm.peer;
 
-            wm.set[chunk_n] = 1;
-            wm.ticks = 0;
-            if(wm.in_flight > 0 ) wm.in_flight--;
+            //one rtt sample per ack, taken from the newest chunk it covered
+            if(newest_sent != udp_clock::time_point{})
+            {
+                using ms = std::chrono::duration<double, std::milli>;
+                rtt_sample(peer.cc, ms(udp_clock::now() - newest_sent).count());
+            }
+            update_congestion_stats(peer);
 
             //if message is not complete yet, return 
-            if(wm.set.count() != wm.proto.total_chunks) return;
+            if(wm.set.count() != wm.proto.total_chunks) 
+            {
+                fast_resend(wm);
+                return;
+            }
 
             CHECK_EQUAL(wm.sent.count(), wm.proto.total_chunks);
             CHECK_EQUAL(wm.in_flight, 0);
             CHECK_EQUAL(wm.queued, 0);
 
             //remove message from working
-            cleanup_message(sequence_n);
+            cleanup_message(wm.proto.sequence);
+        }
+
+        void udp_connection::validate_chunk(const message_chunk& c)
+        {
+            REQUIRE(c.type == message_chunk::ack);
+
+            auto chunk_n = c.chunk;
+            auto sequence_n = c.sequence;
+
+            auto wmp = _out_working.find(sequence_n);
+            if(!wmp) return;
+
+            auto& wm = *wmp;
+
+            if(chunk_n >= wm.proto.total_chunks) return;
+            if(c.total_chunks != wm.proto.total_chunks) return;
+            if(!ack_chunk(wm, chunk_n)) return;
+
+            //only time chunks that were not resent since we cannot tell
+            //which send the ack is for
+            udp_clock::time_point newest_sent;
+            if(!wm.resent[chunk_n]) newest_sent = wm.sent_at[chunk_n];
+
+            acked(wm, newest_sent);
+        }
+
+        void udp_connection::validate_sack(const message_chunk& c)
+        {
+            REQUIRE(c.type == message_chunk::sack);
+
+            auto wmp = _out_working.find(c.sequence);
+            if(!wmp) return;
+
+            auto& wm = *wmp;
+            const size_t total = wm.proto.total_chunks;
+            if(c.total_chunks != total) return;
+
+            udp_clock::time_point newest_sent;
+            auto ack = [&](size_t n)
+            {
+                if(!ack_chunk(wm, n)) return;
+                if(!wm.resent[n]) newest_sent = std::max(newest_sent, wm.sent_at[n]);
+            };
+
+            //every chunk before the cumulative ack was received
+            const size_t cumulative = std::min<size_t>(c.chunk, total);
+            for(size_t n = wm.acked_base; n < cumulative; n++) ack(n);
+            wm.acked_base = std::max(wm.acked_base, cumulative);
+
+            //bitmap has a bit for each chunk after the cumulative ack
+            const char* bitmap = payload_of(c);
+            for(size_t b = 0; b < c.payload_size; b++)
+            {
+                const auto byte = static_cast<unsigned char>(bitmap[b]);
+                if(byte == 0) continue;
+                for(size_t i = 0; i < 8; i++)
+                {
+                    const size_t n = cumulative + b * 8 + i;
+                    if(n >= total) break;
+                    if(byte & (1 << i)) ack(n);
+                }
+            }
+
+            acked(wm, newest_sent);
+        }
+
+        void udp_connection::send_sack(const endpoint& ep, sequence_type sequence, const working_message& wm)
+        {
+            const size_t total = wm.proto.total_chunks;
+            REQUIRE_GREATER(total, 0);
+
+            //cumulative ack is the first chunk we are missing
+            auto cumulative = (~wm.set).find_first();
+            if(cumulative == boost::dynamic_bitset<>::npos) cumulative = total;
+
+            message_chunk ack;
+            ack.type = message_chunk::sack;
+            ack.host = ep.address;
+            ack.port = ep.port;
+            ack.sequence = sequence;
+            ack.total_chunks = total;
+            ack.chunk = cumulative;
+
+            //mark chunks past the gap we already have
+            const size_t bits = std::min(total - cumulative, MAX_SACK_BYTES * 8);
+            size_t used = 0;
+            ack.data.resize((bits + 7) / 8, 0);
+            for(size_t i = 0; i < bits; i++)
+                if(wm.set[cumulative + i]) 
+                {
+                    ack.data[i / 8] |= (1 << (i % 8));
+                    used = i / 8 + 1;
+                }
+            ack.data.resize(used);
+            ack.payload_size = ack.data.size();
+
+            _stats.acks_sent++;
+            send_right_away(ack);
+        }
+
+        void udp_connection::send_complete_sack(const endpoint& ep, sequence_type sequence, chunk_total_type total)
+        {
+            message_chunk ack;
+            ack.type = message_chunk::sack;
+            ack.host = ep.address;
+            ack.port = ep.port;
+            ack.sequence = sequence;
+            ack.total_chunks = total;
+            ack.chunk = total;
+
+            _stats.acks_sent++;
+            send_right_away(ack);
+        }
+
+        void udp_connection::queue_sack(const endpoint& ep, sequence_type sequence, bool duplicate)
+        {
+            auto& in_working = add_peer(ep.address, ep.port).in_working;
+            auto wmi = in_working.find(sequence);
+            if(wmi == in_working.end()) return;
+
+            auto& wm = wmi->second;
+            wm.unacked++;
+
+            //ack right away when chunks arrive out of order so the sender 
+            //learns about the gap, or twice since our ack was lost. 
+            //otherwise wait to cover more chunks 
+            const bool gap = wm.set.count() > (~wm.set).find_first();
+            if(duplicate || gap || wm.unacked >= ACK_EVERY)
+            {
+                wm.unacked = 0;
+                wm.ack_pending = false;
+                send_sack(ep, sequence, wm);
+                return;
+            }
+
+            if(!wm.ack_pending)
+            {
+                wm.ack_pending = true;
+                _pending_acks.emplace_back(ep, sequence);
+            }
+
+            if(_ack_timer_armed) return;
+
+            _ack_timer_armed = true;
+            _ack_timer.expires_from_now(std::chrono::milliseconds(ACK_DELAY));
+            _ack_timer.async_wait(boost::bind(&udp_connection::handle_ack_timer, this, ba::placeholders::error));
+        }
+
+        void udp_connection::send_pending_sacks()
+        {
+            for(const auto& p : _pending_acks)
+            {
+                auto& in_working = add_peer(p.first.address, p.first.port).in_working;
+                auto wmi = in_working.find(p.second);
+                if(wmi == in_working.end()) continue;
+
+                auto& wm = wmi->second;
+                if(!wm.ack_pending) continue;
+
+                wm.ack_pending = false;
+                wm.unacked = 0;
+                send_sack(p.first, p.second, wm);
+            }
+            _pending_acks.clear();
+        }
+
+        void udp_connection::handle_ack_timer(const boost::system::error_code& error)
+        {
+            _ack_timer_armed = false;
+            if(error == ba::error::operation_aborted) return;
+            send_pending_sacks();
         }
 
         void udp_connection::send_right_away(message_chunk& c)
@@ -190,41 +781,51 @@ namespace fire
         }
 
 
-        message_chunk nth_chunk(size_t n, const message_chunk& prototype, const util::bytes& data)
+        message_chunk nth_chunk(size_t n, const message_chunk& prototype, const util::bytes_ptr& data)
         {
             REQUIRE_LESS(n, prototype.total_chunks);
+            REQUIRE_GREATER(prototype.chunk_size, 0);
+            REQUIRE(data);
 
-            size_t start = n * UDP_CHuNK_SIZE;
-            size_t end = std::min(data.size(), start + UDP_CHuNK_SIZE);
+            size_t start = n * prototype.chunk_size;
+            size_t end = std::min(data->size(), start + prototype.chunk_size);
             size_t size = end - start; 
 
             CHECK_GREATER(size, 0);
 
+            //chunk points into the message instead of copying it
             message_chunk c = prototype;
             c.chunk = n;
-            c.write_size = size;
-            c.write_data = data.data() + start;
+            c.owner = data;
+            c.payload_size = size;
+            c.payload = data->data() + start;
 
             ENSURE_EQUAL(c.chunk, n);
-            ENSURE(c.write_data);
-            ENSURE_GREATER(c.write_size, 0);
+            ENSURE(c.payload);
+            ENSURE_GREATER(c.payload_size, 0);
             return c;
         }
 
-        bool udp_connection::get_next_chunk(working_message& wm, message_chunk& queued_chunk)
+        bool can_send(const working_message& wm)
         {
-            REQUIRE_GREATER(wm.proto.total_chunks, 0);
+            REQUIRE(wm.peer);
             bool robust = wm.proto.type == message_chunk::msg;
 
-            auto in_flight = robust ? wm.in_flight : 0;
+            //robust messages to the same peer share its congestion window
+            auto in_flight = robust ? wm.peer->cc.in_flight : 0;
+            return in_flight + wm.queued < window(wm.peer->cc);
+        }
 
-            if(in_flight + wm.queued > MAX_FLIGHT) return false;
+        bool udp_connection::get_next_chunk(working_message& wm, message_chunk& queued_chunk)
+        {
+            REQUIRE_GREATER(wm.proto.total_chunks, 0);
 
-            auto t = MAX_FLIGHT - (in_flight + wm.queued);
-            CHECK_GREATER_EQUAL(t, 0);
-            if(t == 0 || wm.next_send >= wm.proto.total_chunks) 
+            if(wm.next_send >= wm.proto.total_chunks) 
                 return false;
 
+            //the purge clock starts once the message gets room to send
+            if(wm.next_send == 0) wm.last_ack = udp_clock::now();
+
             queued_chunk = nth_chunk(wm.next_send, wm.proto, wm.data);
 
             wm.next_send++;
@@ -232,98 +833,427 @@ namespace fire
             return true;
         }
 
-        void udp_connection::queue_resend(message_ring_item& r, chunk_id_type nth)
+        bool udp_connection::get_resend_chunk(working_message& wm, message_chunk& queued_chunk)
+        {
+            while(!wm.resends.empty())
+            {
+                const auto resend_id = wm.resends.front();
+                wm.resends.pop_front();
+
+                //acked while waiting to be resent
+                if(wm.set[resend_id]) continue;
+
+                queued_chunk = nth_chunk(resend_id, wm.proto, wm.data);
+                queued_chunk.resent = true;
+                wm.queued++;
+                return true;
+            }
+            return false;
+        }
+
+        void udp_connection::queue_resend(working_message& wm, chunk_id_type nth)
         {
-            r.resends.emplace_push(nth);
+            wm.resent[nth] = 1;
+            wm.resends.push_back(nth);
+            start_sending(wm);
             post_send();
         }
 
-        bool udp_connection::incr_next_message()
+        void udp_connection::lost_chunk(working_message& wm, chunk_id_type c)
+        {
+            REQUIRE(wm.peer);
+            REQUIRE(wm.flying[c]);
+
+            //lost chunks leave the window and get queued to be resent
+            auto& cc = wm.peer->cc;
+            wm.flying[c] = 0;
+            if(wm.in_flight > 0) wm.in_flight--;
+            if(cc.in_flight > 0) cc.in_flight--;
+
+            _stats.dropped++;
+            queue_resend(wm, c);
+        }
+
+        void udp_connection::loss_event(udp_peer& p, udp_clock::time_point sent, bool timeout)
         {
-            if(_message_ring.empty())
+            //back off once per window. losses of chunks sent before the 
+            //last back off are part of the same event.
+            auto& cc = p.cc;
+            if(sent < cc.recovery) return;
+
+            cc.recovery = udp_clock::now();
+            shrink_window(cc);
+            if(timeout) backoff_rto(cc);
+
+            update_congestion_stats(p);
+            _stats.losses++;
+        }
+
+        void udp_connection::fast_resend(working_message& wm)
+        {
+            REQUIRE(wm.peer);
+            if(wm.highest_acked <= DUP_THRESH) return;
+
+            //a chunk is lost once chunks sent after it were acked far
+            //enough past it that reordering is unlikely
+            const size_t limit = wm.highest_acked - DUP_THRESH;
+            auto n = wm.flying.find_first();
+            for(; n != boost::dynamic_bitset<>::npos && n < limit; n = wm.flying.find_next(n))
             {
-                _next_message = 0;
-                return false;
+                if(wm.sent_at[n] >= wm.newest_acked_sent) continue;
+
+                const auto sent = wm.sent_at[n];
+                lost_chunk(wm, n);
+                loss_event(*wm.peer, sent, false);
+                _stats.fast_resends++;
             }
+        }
 
-            //if at end, go to beginning
-            _next_message = (_next_message + 1) % _message_ring.size();
-            ENSURE_RANGE(_next_message, 0, _message_ring.size());
-            return true;
+        void udp_connection::tail_probe(working_message& wm)
+        {
+            REQUIRE(wm.peer);
+
+            //when acks stop coming, resend the newest chunk in flight
+            //without giving up on the rest. its ack covers every chunk
+            //the peer has, so a lost ack does not cost a whole rto.
+            auto n = wm.flying.find_first();
+            if(n == boost::dynamic_bitset<>::npos) return;
+            for(auto next = wm.flying.find_next(n); next != boost::dynamic_bitset<>::npos; next = wm.flying.find_next(next)) 
+                n = next;
+
+            auto c = nth_chunk(n, wm.proto, wm.data);
+            c.resent = true;
+            wm.resent[n] = 1;
+            wm.queued++;
+            wm.tail_probes++;
+            send_right_away(c);
         }
 
-        using exhausted_messages = std::vector<sequence_type>;
+        void udp_connection::expire_chunks(working_message& wm)
+        {
+            REQUIRE(wm.peer);
+
+            //chunks in flight longer than the peer's rto are lost
+            const auto now = udp_clock::now();
+            const auto rto = to_duration(wm.peer->cc.rto);
+
+            auto n = wm.flying.find_first();
+            for(; n != boost::dynamic_bitset<>::npos; n = wm.flying.find_next(n))
+            {
+                if(now - wm.sent_at[n] < rto) continue;
+
+                const auto sent = wm.sent_at[n];
+                lost_chunk(wm, n);
+                loss_event(*wm.peer, sent, true);
+            }
+        }
+
+        void udp_connection::arm_resend_timer(working_message& wm)
+        {
+            REQUIRE(wm.timer);
+            REQUIRE(wm.peer);
+
+            //fire when the oldest chunk in flight times out, when a tail
+            //probe is due, or when the message should be given up on if 
+            //nothing is in flight
+            auto deadline = wm.last_ack + std::chrono::milliseconds(PURGE_TIMEOUT);
+
+            auto n = wm.flying.find_first();
+            if(n != boost::dynamic_bitset<>::npos)
+            {
+                auto oldest = wm.sent_at[n];
+                for(; n != boost::dynamic_bitset<>::npos; n = wm.flying.find_next(n))
+                    oldest = std::min(oldest, wm.sent_at[n]);
+
+                deadline = std::min(deadline, oldest + to_duration(wm.peer->cc.rto));
+                if(wm.tail_probes < MAX_TAIL_PROBES)
+                    deadline = std::min(deadline, wm.last_sent + to_duration(probe_timeout(wm.peer->cc)));
+            }
+
+            wm.deadline = deadline;
+            wm.timer->expires_at(deadline);
+            wm.timer->async_wait(boost::bind(&udp_connection::handle_resend_timer, this, ba::placeholders::error, wm.proto.sequence));
+        }
+
+        void udp_connection::handle_resend_timer(const boost::system::error_code& error, sequence_type sequence)
+        {
+            if(error == ba::error::operation_aborted) return;
+
+            //message may have completed or been purged while the timer was queued
+            auto wmp = _out_working.find(sequence);
+            if(!wmp) return;
+
+            auto& wm = *wmp;
+            wm.deadline = udp_clock::time_point{};
+
+            const auto now = udp_clock::now();
+            if(now - wm.last_ack >= std::chrono::milliseconds(PURGE_TIMEOUT))
+            {
+                cleanup_message(sequence);
+                return;
+            }
+
+            expire_chunks(wm);
+
+            const auto probe_due = wm.last_sent + to_duration(probe_timeout(wm.peer->cc));
+            if(wm.tail_probes < MAX_TAIL_PROBES && now >= probe_due) tail_probe(wm);
+
+            arm_resend_timer(wm);
+        }
+
+        bool has_chunks_to_send(const working_message& wm)
+        {
+            return !wm.resends.empty() || wm.next_send < wm.proto.total_chunks;
+        }
 
         void udp_connection::queue_next_chunk()
         {
-            //do round robin
-            if(!incr_next_message()) return;
-            auto end = _next_message;
+            //do round robin over peers, then over each peer's messages
+            for(size_t tries = _sending.size(); tries > 0 && !_sending.empty(); tries--)
+            {
+                _next_peer = (_next_peer + 1) % _sending.size();
+                auto& p = *_sending[_next_peer];
+
+                if(queue_next_chunk(p.robust) || queue_next_chunk(p.unreliable)) 
+                    return;
+
+                //nothing left for the peer, drop it until it has more
+                if(p.robust.size == 0 && p.unreliable.size == 0)
+                {
+                    p.sending = false;
+                    _sending[_next_peer] = _sending.back();
+                    _sending.pop_back();
+                }
+            }
+        }
 
+        bool udp_connection::queue_next_chunk(send_ring& r)
+        {
             message_chunk c;
-            chunk_id_type resend_id;
-            do
+            while(r.size > 0)
             {
-                auto& r = _message_ring[_next_message];
-                CHECK(r.wm != nullptr);
-                auto& wm = *r.wm;
-                if(get_next_chunk(wm, c))
+                auto& wm = _out_working.next(r);
+
+                //robust messages share the peer window so when one is
+                //blocked they all are
+                if(!can_send(wm)) return false;
+
+                //resends go first since they are holding up the message
+                bool got = get_resend_chunk(wm, c) || get_next_chunk(wm, c);
+                if(!has_chunks_to_send(wm)) _out_working.unlink(wm.proto.sequence);
+
+                if(got)
                 {
                     _out_queue.emplace_push(c);
-                    break;
+                    return true;
                 }
-                //check to see if there are resends
-                else if(r.resends.pop(resend_id))
-                {
-                    message_chunk mc = nth_chunk(resend_id, wm.proto, wm.data);
-                    mc.resent = true;
-                    _out_queue.emplace_push(mc);
-                    break;
-                }
-                incr_next_message();
             }
-            while(_next_message != end);
+            return false;
         }
 
-        chunk_total_type total_chunks(size_t data_size)
+        chunk_total_type total_chunks(size_t data_size, size_t chunk_size)
         {
             REQUIRE_GREATER(data_size, 0);
+            REQUIRE_GREATER(chunk_size, 0);
 
-            chunk_total_type r = (data_size / UDP_CHuNK_SIZE);
-            if(data_size % UDP_CHuNK_SIZE) r += 1;
+            chunk_total_type r = (data_size / chunk_size);
+            if(data_size % chunk_size) r += 1;
 
             ENSURE_GREATER(r, 0);
             return r;
         }
 
-        message_chunk create_prototype(sequence_type sequence, const endpoint_message& m)
+        size_t chunk_size_for(size_t packet_size)
+        {
+            REQUIRE_BETWEEN(packet_size, UDP_PACKET_SIZE, MAX_PACKET_SIZE);
+            return packet_size == UDP_PACKET_SIZE ? UDP_CHuNK_SIZE : packet_size - SIZED_HEADER_SIZE;
+        }
+
+        message_chunk create_prototype(sequence_type sequence, const endpoint& ep, bool robust, size_t size, size_t packet_size)
         {
             message_chunk c;
             c.valid = true;
-            c.type = m.robust ? message_chunk::msg : message_chunk::qmsg;
-            c.host = m.ep.address;
-            c.port = m.ep.port;
+            c.type = robust ? message_chunk::msg : message_chunk::qmsg;
+            c.host = ep.address;
+            c.port = ep.port;
             c.sequence = sequence;
-            c.total_chunks = total_chunks(m.data.size());
+            c.chunk_size = chunk_size_for(packet_size);
+            c.total_chunks = total_chunks(size, c.chunk_size);
             c.chunk = 0;
 
             return c;
         }
 
+        std::string peer_key(const std::string& host, port_type port)
+        {
+            return host + ":" + port_to_string(port);
+        }
+
+        size_t shard_of(const std::string& host, port_type port, size_t shards)
+        {
+            REQUIRE_GREATER(shards, 0);
+            return std::hash<std::string>{}(peer_key(host, port)) % shards;
+        }
+
+        udp_peer& udp_connection::add_peer(const std::string& host, port_type port)
+        {
+            auto key = peer_key(host, port);
+            auto p = _peers.find(key);
+            if(p != _peers.end()) return p->second;
+
+            //new peer, start with the size everyone understands
+            auto& n = _peers[key];
+            init_congestion(n.cc);
+            n.packet_size = UDP_PACKET_SIZE;
+
+            ENSURE_GREATER_EQUAL(n.packet_size, UDP_PACKET_SIZE);
+            return n;
+        }
+
+        udp_peer& udp_connection::get_peer(const std::string& host, port_type port)
+        {
+            auto& n = add_peer(host, port);
+            if(n.probed) return n;
+
+            //probe up from the default packet size the first time we send
+            n.probed = true;
+            if(_mtu > n.packet_size)
+            {
+                n.probe_size = std::min(_mtu, n.packet_size * 2);
+                send_probe(host, port, n);
+            }
+            return n;
+        }
+
+        void udp_connection::update_congestion_stats(const udp_peer& p)
+        {
+            _stats.cwnd = window(p.cc);
+            _stats.srtt = p.cc.srtt;
+            _stats.rto = p.cc.rto;
+        }
+
+        void udp_connection::send_probe(const std::string& host, port_type port, udp_peer& p)
+        {
+            REQUIRE_GREATER(p.probe_size, p.packet_size);
+            REQUIRE_LESS_EQUAL(p.probe_size, MAX_PACKET_SIZE);
+
+            //probe is padded out to the size being probed
+            message_chunk c;
+            c.valid = true;
+            c.type = message_chunk::probe;
+            c.host = host;
+            c.port = port;
+            c.total_chunks = p.probe_size;
+            c.chunk = 0;
+            c.payload_size = p.probe_size - HEADER_SIZE;
+
+            p.probe_tries++;
+            send_right_away(c);
+
+            if(_probe_timer_armed) return;
+
+            _probe_timer_armed = true;
+            _probe_timer.expires_from_now(std::chrono::milliseconds(PROBE_TIMEOUT));
+            _probe_timer.async_wait(boost::bind(&udp_connection::handle_probe_timer, this, ba::placeholders::error));
+        }
+
+        void udp_connection::handle_probe_timer(const boost::system::error_code& error)
+        {
+            _probe_timer_armed = false;
+            if(error == ba::error::operation_aborted) return;
+            probe_peers();
+        }
+
+        void udp_connection::handle_probe_ack(const message_chunk& c)
+        {
+            REQUIRE(c.type == message_chunk::probe_ack);
+
+            auto pi = _peers.find(peer_key(c.host, c.port));
+            if(pi == _peers.end()) return;
+
+            auto& p = pi->second;
+            const size_t acked = c.total_chunks;
+            if(acked != p.probe_size) return;
+
+            p.packet_size = acked;
+            p.probe_tries = 0;
+            p.probe_size = acked < _mtu ? std::min(_mtu, acked * 2) : 0;
+
+            LOG << "udp packet size to " << c.host << ":" << c.port << " is now " << p.packet_size << " bytes" << std::endl;
+            if(p.probe_size > 0) send_probe(c.host, c.port, p);
+        }
+
+        void udp_connection::probe_peers()
+        {
+            //probes that were not acked are retried a few times before
+            //settling on the last size that worked.
+            for(auto& pp : _peers)
+            {
+                auto& p = pp.second;
+                if(p.probe_size == 0) continue;
+                if(p.probe_tries > PROBE_RETRIES) 
+                {
+                    p.probe_size = 0;
+                    continue;
+                }
+
+                auto hp = parse_host_port(pp.first);
+                send_probe(hp.first, hp.second, p);
+            }
+        }
+
+        void udp_connection::add_completed(const endpoint& ep, sequence_type sequence)
+        {
+            completed_message m{peer_key(ep.address, ep.port), sequence};
+            if(!_completed.insert(m).second) return;
+
+            _completed_order.push_back(m);
+            if(_completed_order.size() <= MAX_COMPLETED) return;
+
+            _completed.erase(_completed_order.front());
+            _completed_order.pop_front();
+
+            ENSURE_EQUAL(_completed.size(), _completed_order.size());
+        }
+
+        bool udp_connection::is_completed(const endpoint& ep, sequence_type sequence) const
+        {
+            return _completed.count(completed_message{peer_key(ep.address, ep.port), sequence}) > 0;
+        }
+
         void udp_connection::post_send()
         {
             _io.post(boost::bind(&udp_connection::do_send, this));
         }
 
-        void udp_connection::add_to_working_set(endpoint_message m)
+        void udp_connection::add_to_working_set(const endpoint& ep, bool robust, util::bytes_ptr data, util::occupancy* room, std::shared_ptr<bool> left)
         {
-            REQUIRE_FALSE(m.data.empty());
+            REQUIRE(data);
+            REQUIRE_FALSE(data->empty());
+            _stats.bytes_copied += data->size();
 
             //update sequence
             _sequence++;
 
-            message_chunk proto = create_prototype(_sequence, m);
-            init_working(proto, m.data);
+            auto& peer = get_peer(ep.address, ep.port);
+            message_chunk proto = create_prototype(_sequence, ep, robust, data->size(), peer.packet_size);
+            const auto sequence = proto.sequence;
+            init_working(proto, data, peer);
+
+            auto wm = _out_working.find(sequence);
+            CHECK(wm);
+            wm->room = room;
+            wm->left = left;
+        }
+
+        util::occupancy& udp_connection::peer_room(const endpoint& ep)
+        {
+            u::mutex_scoped_lock l(_rooms_mutex);
+            auto& r = _rooms[peer_key(ep.address, ep.port)];
+            if(!r) r.reset(new util::occupancy{_peer_limits});
+
+            ENSURE(r);
+            return *r;
         }
 
         bool udp_connection::send(const endpoint_message& m, bool block)
@@ -336,11 +1266,37 @@ namespace fire
                 return false;
             }
 
-            _io.post(boost::bind(&udp_connection::add_to_working_set, this, m));
+            //count the bytes against the peer. a full peer blocks, rejects
+            //or takes the message, depending on its overflow policy.
+            auto& room = peer_room(m.ep);
+            const auto pushed = room.add(m.data.size());
+            {
+                u::mutex_scoped_lock l(_rooms_mutex);
+                if(pushed == u::push_result::rejected) 
+                {
+                    _stats.send_rejected++;
+                    return false;
+                }
+                if(pushed == u::push_result::over) _stats.send_over++;
+                _stats.queued_bytes += m.data.size();
+                _stats.queued_peak = std::max(_stats.queued_peak, room.value());
+            }
+
+            //the only copy on the way out. chunks are sent from it directly.
+            auto data = std::make_shared<u::bytes>(m.data);
+
+            //a blocking send waits until the io thread cleans up its
+            //message, which happens once it is sent, acked or purged
+            auto left = block ? std::make_shared<bool>(false) : std::shared_ptr<bool>{};
+
+            _io.post(boost::bind(&udp_connection::add_to_working_set, this, m.ep, m.robust, data, &room, left));
             _io.post(boost::bind(&udp_connection::do_send, this));
 
-            //if we are blocking, block until all messages are sent
-            while(block && !_out_queue.empty()) u::sleep_thread(BLOCK_SLEEP);
+            if(block)
+            {
+                std::unique_lock<std::mutex> l(_out_mutex);
+                while(!*left && !_closed) _out_drained.wait(l);
+            }
 
             return true;
         }
@@ -448,16 +1404,22 @@ namespace fire
             v = (v2 <<  8) | v1;
         }
 
-        void encode_udp_wire(u::bytes& r, const message_chunk& ch)
+        void encode_udp_header(u::bytes& r, const message_chunk& ch)
         {
-            r.resize(HEADER_SIZE + ch.write_size);
+            //chunks bigger than the default carry their size so the
+            //other side can place them
+            const bool sized = is_data(ch) && ch.chunk_size != UDP_CHuNK_SIZE;
+            r.resize(sized ? SIZED_MESSAGE_BASE : MESSAGE_BASE);
 
             //set mark
             switch(ch.type)
             {
-                case message_chunk::msg: r[0] = '!'; break;
-                case message_chunk::qmsg: r[0] = '='; break;
+                case message_chunk::msg: r[0] = sized ? '$' : '!'; break;
+                case message_chunk::qmsg: r[0] = sized ? '~' : '='; break;
                 case message_chunk::ack: r[0] = '@'; break;
+                case message_chunk::probe: r[0] = '?'; break;
+                case message_chunk::probe_ack: r[0] = '^'; break;
+                case message_chunk::sack: r[0] = '&'; break;
                 default: CHECK(false && "missed case");
             }
 
@@ -470,34 +1432,40 @@ namespace fire
             //write message_chunk number
             write_be_u16(r, CHUNK_BASE, ch.chunk);
 
-            //write message
-            if(ch.write_size > 0 && ch.write_data != nullptr) 
-                std::copy(ch.write_data, ch.write_data + ch.write_size, r.begin() + MESSAGE_BASE);
+            //write chunk size
+            if(sized) write_be_u16(r, CHUNK_SIZE_BASE, ch.chunk_size);
         }
 
-        message_chunk decode_udp_wire(const u::bytes& b)
+        message_chunk decode_udp_wire(const u::bytes& b, size_t size)
         {
-            REQUIRE_GREATER_EQUAL(b.size(), HEADER_SIZE);
+            REQUIRE_LESS_EQUAL(size, b.size());
+            REQUIRE_GREATER_EQUAL(size, HEADER_SIZE);
 
             message_chunk ch;
             ch.valid = false;
 
             //read mark
+            bool sized = false;
             const char mark = b[0];
             switch(mark)
             {
                 case '!': ch.type = message_chunk::msg; break;
                 case '=': ch.type = message_chunk::qmsg; break;
+                case '$': ch.type = message_chunk::msg; sized = true; break;
+                case '~': ch.type = message_chunk::qmsg; sized = true; break;
                 case '@': ch.type = message_chunk::ack; break;
+                case '?': ch.type = message_chunk::probe; break;
+                case '^': ch.type = message_chunk::probe_ack; break;
+                case '&': ch.type = message_chunk::sack; break;
                 default: return ch;
             }
 
             //read sequence number
-            if(b.size() < SEQUENCE_BASE + sizeof(sequence_type)) return ch;
+            if(size < SEQUENCE_BASE + sizeof(sequence_type)) return ch;
             read_be_u64(b, SEQUENCE_BASE, ch.sequence);
 
             //write total chunks 
-            if(b.size() < CHUNK_TOTAL_BASE + sizeof(chunk_total_type)) return ch;
+            if(size < CHUNK_TOTAL_BASE + sizeof(chunk_total_type)) return ch;
             read_be_u16(b, CHUNK_TOTAL_BASE, ch.total_chunks);
 
             //cannot be more than max chunks, this should be impossible because
@@ -505,18 +1473,37 @@ namespace fire
             CHECK_LESS_EQUAL(ch.total_chunks, MAX_CHUNKS);
 
             //read message_chunk number
-            if(b.size() < CHUNK_BASE + sizeof(chunk_id_type)) return ch;
+            if(size < CHUNK_BASE + sizeof(chunk_id_type)) return ch;
             read_be_u16(b, CHUNK_BASE, ch.chunk);
 
-            //copy message
-            CHECK_GREATER_EQUAL(b.size(), HEADER_SIZE);
-            const size_t data_size = b.size() - HEADER_SIZE;
+            //probes are only padding, no need to copy them
+            if(ch.type == message_chunk::probe || ch.type == message_chunk::probe_ack)
+            {
+                ch.valid = true;
+                return ch;
+            }
+
+            //read chunk size
+            size_t message_base = MESSAGE_BASE;
+            ch.chunk_size = UDP_CHuNK_SIZE;
+            if(sized)
+            {
+                if(size < SIZED_MESSAGE_BASE) return ch;
+                read_be_u16(b, CHUNK_SIZE_BASE, ch.chunk_size);
+                if(ch.chunk_size == 0 || ch.chunk_size > MAX_CHUNK_SIZE) return ch;
+                message_base = SIZED_MESSAGE_BASE;
+            }
+
+            //point at the message in the read buffer, it is copied
+            //once when the chunk is placed in its message
+            CHECK_GREATER_EQUAL(size, message_base);
+            const size_t data_size = size - message_base;
 
             if(data_size > 0)
             {
                 if(data_size > MAX_UDP_BUFF_SIZE) return ch;
-                ch.data.resize(data_size);
-                std::copy(b.begin() + MESSAGE_BASE, b.end(), ch.data.begin());
+                ch.payload = b.data() + message_base;
+                ch.payload_size = data_size;
             }
 
             ch.valid = true;
@@ -527,42 +1514,177 @@ namespace fire
         void udp_connection::do_send()
         {
             ENSURE(_socket);
+            if(_batch) 
+            {
+                do_batch_send();
+                return;
+            }
+
+            //one send in flight, _out_buffer and _out_chunk belong to it
+            //until handle_write. posts made meanwhile are picked up there.
+            if(_writing) return;
 
             if(_out_queue.empty()) queue_next_chunk();
             if(_out_queue.empty()) return;
 
-            //encode bytes to wire format
-            message_chunk message_chunk;
-            bool got = _out_queue.pop(message_chunk);
+            //encode header to wire format, the payload is sent from
+            //the chunk which is kept until the write is done
+            bool got = _out_queue.pop(_out_chunk);
             CHECK(got);
 
-            encode_udp_wire(_out_buffer, message_chunk);
-            _stats.bytes_sent += _out_buffer.size();
+            encode_udp_header(_out_buffer, _out_chunk);
+            _stats.bytes_sent += _out_buffer.size() + _out_chunk.payload_size;
+            _stats.packets_sent++;
+            _stats.send_calls++;
 
-            //async send message_chunk
-            udp::endpoint ep(address::from_string(message_chunk.host), message_chunk.port);
-            _socket->async_send_to(ba::buffer(_out_buffer.data(), _out_buffer.size()), ep,
+            //async send header and payload as one datagram
+            std::array<ba::const_buffer, 2> buffers = {{
+                ba::buffer(_out_buffer),
+                ba::buffer(payload_of(_out_chunk), _out_chunk.payload_size)}};
+
+            udp::endpoint ep(address::from_string(_out_chunk.host), _out_chunk.port);
+            _writing = true;
+            _socket->async_send_to(buffers, ep,
                     boost::bind(&udp_connection::handle_write, this, ba::placeholders::error));
 
-            //ignore acks or resends
-            if(!message_chunk.resent && message_chunk.type != message_chunk::ack)
-                sent_chunk(message_chunk);
+            //ignore acks and probes
+            if(is_data(_out_chunk))
+                sent_chunk(_out_chunk);
 
         }
 
         void udp_connection::handle_write(const boost::system::error_code& error)
         {
+            _writing = false;
             _error = error;
             do_send();
         }
 
-        void udp_connection::bind(port_type port)
+        void udp_connection::do_batch_send()
+        {
+            INVARIANT(_socket);
+            REQUIRE(_batch);
+
+            //the socket was full last time, wait for handle_batch_write
+            if(_writing) return;
+
+            auto& b = *_batch;
+            if(b.out_next == b.out_count) 
+            {
+                b.out_count = 0;
+                b.out_next = 0;
+            }
+
+            //drain the out queue and message ring into the batch
+            while(b.out_count < b.size)
+            {
+                if(_out_queue.empty()) queue_next_chunk();
+
+                auto& c = b.out_chunk[b.out_count];
+                if(!_out_queue.pop(c)) break;
+
+                encode_udp_header(b.out[b.out_count], c);
+                b.out_ep[b.out_count] = udp::endpoint(address::from_string(c.host), c.port);
+                _stats.bytes_sent += b.out[b.out_count].size() + c.payload_size;
+                b.out_count++;
+
+                //the chunk keeps its payload alive so it can be marked
+                //sent, which may free the working message for unreliable messages
+                if(is_data(c))
+                    sent_chunk(c);
+            }
+
+            const bool full = b.out_count == b.size;
+            flush_batch();
+
+            //more chunks may be waiting, keep the send loop going
+            if(full && !_writing) post_send();
+        }
+
+        void udp_connection::flush_batch()
+        {
+            INVARIANT(_socket);
+            REQUIRE(_batch);
+
+#ifdef FIRESTR_UDP_MMSG
+            auto& b = *_batch;
+            while(b.out_next < b.out_count)
+            {
+                const size_t n = b.out_count - b.out_next;
+                for(size_t i = 0; i < n; i++)
+                {
+                    auto& d = b.out[b.out_next + i];
+                    auto& c = b.out_chunk[b.out_next + i];
+                    auto& ep = b.out_ep[b.out_next + i];
+                    auto iov = &b.out_iov[2*i];
+                    auto& h = b.out_hdr[i];
+
+                    //gather the header and the payload in place
+                    iov[0].iov_base = d.data();
+                    iov[0].iov_len = d.size();
+                    iov[1].iov_base = const_cast<char*>(payload_of(c));
+                    iov[1].iov_len = c.payload_size;
+
+                    h = mmsghdr{};
+                    h.msg_hdr.msg_name = ep.data();
+                    h.msg_hdr.msg_namelen = ep.size();
+                    h.msg_hdr.msg_iov = iov;
+                    h.msg_hdr.msg_iovlen = 2;
+                }
+
+                const int r = ::sendmmsg(_socket->native_handle(), b.out_hdr.data(), n, MSG_DONTWAIT);
+                _stats.send_calls++;
+
+                if(r < 0)
+                {
+                    if(errno == EINTR) continue;
+                    if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        //wait until the socket can be written to again
+                        _writing = true;
+                        _socket->async_send(ba::null_buffers(),
+                                boost::bind(&udp_connection::handle_batch_write, this, ba::placeholders::error));
+                        return;
+                    }
+
+                    //skip the datagram that failed, robust messages will get resent
+                    _error = boost::system::error_code(errno, boost::system::system_category());
+                    LOG << "error sending udp batch: " << _error.message() << std::endl;
+                    b.out_next++;
+                    continue;
+                }
+
+                CHECK_LESS_EQUAL(static_cast<size_t>(r), n);
+                _stats.packets_sent += r;
+                b.out_next += r;
+            }
+#else
+            CHECK(false && "udp batching is not supported on this platform");
+#endif
+        }
+
+        void udp_connection::handle_batch_write(const boost::system::error_code& error)
+        {
+            _writing = false;
+            _error = error;
+            do_send();
+        }
+
+        void udp_connection::bind(port_type port, bool reuse_port)
         {
             LOG << "bind udp port " << port << std::endl;
             INVARIANT(_socket);
 
             _socket->open(udp::v4(), _error);
             _socket->set_option(udp::socket::reuse_address(true),_error);
+#ifdef FIRESTR_UDP_REUSEPORT
+            //the kernel spreads datagrams over the sockets by source
+            if(reuse_port) _socket->set_option(reuse_port_option(true),_error);
+#else
+            CHECK_FALSE(reuse_port);
+#endif
+            _socket->set_option(ba::socket_base::receive_buffer_size(SOCKET_BUFFER_SIZE),_error);
+            _socket->set_option(ba::socket_base::send_buffer_size(SOCKET_BUFFER_SIZE),_error);
             _socket->bind(udp::endpoint(udp::v4(), port), _error);
 
             if(_error)
@@ -573,6 +1695,15 @@ namespace fire
 
         void udp_connection::start_read()
         {
+            //wait for the socket to be readable and pull many datagrams at once
+            if(_batch)
+            {
+                _socket->async_receive(ba::null_buffers(),
+                        boost::bind(&udp_connection::handle_batch_read, this,
+                            boost::asio::placeholders::error));
+                return;
+            }
+
             _socket->async_receive_from(
                    ba::buffer(_in_buffer, MAX_UDP_BUFF_SIZE), _in_endpoint,
                     boost::bind(&udp_connection::handle_read, this,
@@ -580,20 +1711,24 @@ namespace fire
                         boost::asio::placeholders::bytes_transferred));
         }
 
-        bool insert_chunk(const message_chunk& c, working_messages& w, u::bytes& complete_message)
+        bool insert_chunk(const message_chunk& c, working_messages& w, u::bytes& complete_message, size_t& copied)
         {
-            REQUIRE(c.type == message_chunk::msg || c.type == message_chunk::qmsg);
+            REQUIRE(is_data(c));
             if(c.total_chunks == 0) return false;
+            if(c.chunk_size == 0) return false;
+
+            //the last chunk has to start within the max message size
+            if(static_cast<size_t>(c.total_chunks - 1) * c.chunk_size >= MAX_MESSAGE_SIZE) return false;
 
             auto& wm = w[c.sequence];
             if(wm.proto.total_chunks == 0)
             {
-                const size_t max_size = c.total_chunks * UDP_CHuNK_SIZE;
-                if(max_size > MAX_MESSAGE_SIZE) return false;
+                const size_t max_size = c.total_chunks * c.chunk_size;
 
                 wm.proto = c;
-                wm.proto.data.clear();
-                wm.data.resize(max_size);
+                wm.proto.payload = nullptr;
+                wm.proto.payload_size = 0;
+                wm.data = std::make_shared<u::bytes>(max_size);
                 wm.set.resize(c.total_chunks);
             }
 
@@ -604,29 +1739,33 @@ namespace fire
 
             if(chunk_n >= wm.proto.total_chunks) return false;
             if(c.total_chunks != wm.proto.total_chunks) return false;
+            if(c.chunk_size != wm.proto.chunk_size) return false;
             if(wm.set[chunk_n]) return false;
 
             //potentially resize if we get the last message_chunk
             if(c.chunk == wm.proto.total_chunks - 1)
             {
-                auto extra = UDP_CHuNK_SIZE - c.data.size(); 
+                if(c.payload_size == 0 || c.payload_size > c.chunk_size) return false;
+                auto extra = c.chunk_size - c.payload_size; 
 
                 //should only shrink
                 CHECK_GREATER_EQUAL(extra, 0);
-                wm.data.resize(wm.data.size() - extra);
+                wm.data->resize(wm.data->size() - extra);
             }
-            //only the last message_chunk can be less than the UDP_CHUNK_SIZE. Otherwise something is wrong
-            else if(c.data.size() != UDP_CHuNK_SIZE) return false;
+            //only the last message_chunk can be less than the chunk size. Otherwise something is wrong
+            else if(c.payload_size != c.chunk_size) return false;
             
-            const size_t insert_spot = c.chunk * UDP_CHuNK_SIZE; 
-            std::copy(c.data.begin(), c.data.end(), wm.data.begin() + insert_spot); 
+            //copy straight from the read buffer into place
+            const size_t insert_spot = c.chunk * c.chunk_size; 
+            std::copy(c.payload, c.payload + c.payload_size, wm.data->begin() + insert_spot); 
+            copied += c.payload_size;
             wm.set[chunk_n] = 1;
 
             //if message is not complete yet, return 
             if(wm.set.count() != wm.proto.total_chunks) return false;
 
             //return message
-            complete_message = std::move(wm.data);
+            complete_message = std::move(*wm.data);
 
             //remove message from working
             w.erase(sequence_n);
@@ -643,120 +1782,207 @@ namespace fire
                 return;
             }
 
-            //get bytes
-            CHECK_LESS_EQUAL(transferred, _in_buffer.size());
-            _work_buffer.resize(transferred);
-            std::copy(_in_buffer.begin(), _in_buffer.begin() + transferred, _work_buffer.begin());
+            _stats.recv_calls++;
+            handle_datagram(_in_buffer, transferred, _in_endpoint);
+            start_read();
+        }
+
+        void udp_connection::handle_batch_read(const boost::system::error_code& error)
+        {
+            REQUIRE(_batch);
+            if(error)
+            {
+                _error = error;
+                LOG << "error waiting for udp batch. " << error.message() << std::endl;
+                start_read();
+                return;
+            }
+
+#ifdef FIRESTR_UDP_MMSG
+            auto& b = *_batch;
+            for(size_t i = 0; i < b.size; i++)
+            {
+                auto& iov = b.in_iov[i];
+                auto& h = b.in_hdr[i];
+
+                iov.iov_base = b.in[i].data();
+                iov.iov_len = b.in[i].size();
+
+                h = mmsghdr{};
+                h.msg_hdr.msg_name = b.in_ep[i].data();
+                h.msg_hdr.msg_namelen = b.in_ep[i].capacity();
+                h.msg_hdr.msg_iov = &iov;
+                h.msg_hdr.msg_iovlen = 1;
+            }
+
+            const int r = ::recvmmsg(_socket->native_handle(), b.in_hdr.data(), b.size, MSG_DONTWAIT, nullptr);
+            _stats.recv_calls++;
+
+            if(r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                _error = boost::system::error_code(errno, boost::system::system_category());
+                LOG << "error reading udp batch. " << _error.message() << std::endl;
+            }
+
+            for(int i = 0; i < r; i++)
+            {
+                auto& ep = b.in_ep[i];
+                ep.resize(b.in_hdr[i].msg_hdr.msg_namelen);
+                handle_datagram(b.in[i], b.in_hdr[i].msg_len, ep);
+            }
+#else
+            CHECK(false && "udp batching is not supported on this platform");
+#endif
+            start_read();
+        }
+
+        void udp_connection::handle_datagram(
+                const u::bytes& buffer, 
+                size_t transferred, 
+                const udp::endpoint& from)
+        {
+            CHECK_LESS_EQUAL(transferred, buffer.size());
 
             _stats.bytes_recv += transferred;
+            _stats.packets_recv++;
 
-            //decode message
+            //decode message, the chunk points into the buffer
             message_chunk c;
 
-            if(_work_buffer.size() >= HEADER_SIZE) 
-                c = decode_udp_wire(_work_buffer);
+            if(transferred >= HEADER_SIZE) 
+                c = decode_udp_wire(buffer, transferred);
 
-            if(c.valid)
-            {
-                //add message to in queue if we got complete message
-                endpoint ep = { UDP, _in_endpoint.address().to_string(), _in_endpoint.port()};
+            if(!c.valid) return;
 
-                if(c.type != message_chunk::ack)
-                { 
-                    const bool robust = c.type == message_chunk::msg;
-                    if(robust)
-                    {
-                        message_chunk ack;
-                        ack.type = message_chunk::ack;
-                        ack.host = ep.address;
-                        ack.port = ep.port;
-                        ack.sequence = c.sequence;
-                        ack.total_chunks = c.total_chunks;
-                        ack.chunk = c.chunk;
-                        CHECK(ack.data.empty());
-
-                        //send ack
-                        send_right_away(ack);
-                    }
+            //add message to in queue if we got complete message
+            endpoint ep = { UDP, from.address().to_string(), from.port()};
 
-                    //insert message_chunk to message buffer
-                    bool inserted = insert_chunk(c, _in_working, _work_buffer);
-                    //message_chunk is no longer valid after insert_chunk call because a move is done.
+            //peers that probe or send sized chunks speak selective acks
+            if(c.type != message_chunk::ack && c.type != message_chunk::sack)
+            {
+                const bool new_peer = 
+                    c.type == message_chunk::probe || 
+                    c.type == message_chunk::probe_ack || 
+                    (is_data(c) && c.chunk_size != UDP_CHuNK_SIZE);
+                if(new_peer) add_peer(ep.address, ep.port).sack = true;
+            }
 
-                    if(inserted)
-                    {
-                        endpoint_message em{ep, _work_buffer, robust};
-                        _in_queue.emplace_push(em);
-                    }
+            if(c.type == message_chunk::probe)
+            {
+                //only ack probes that arrived whole
+                if(c.total_chunks != transferred) return;
+
+                message_chunk ack;
+                ack.type = message_chunk::probe_ack;
+                ack.host = ep.address;
+                ack.port = ep.port;
+                ack.total_chunks = c.total_chunks;
+                ack.chunk = 0;
+                send_right_away(ack);
+            }
+            else if(is_ack(c))
+            {
+                c.host = ep.address;
+                c.port = ep.port;
 
+                //acks go to the shard that sent the message
+                auto& owner = owner_of(ep);
+                if(&owner == this) handle_ack(c);
+                else route(owner, c, ep);
+            }
+            else
+            { 
+                CHECK(is_data(c));
+                const bool robust = c.type == message_chunk::msg;
+                auto& peer = add_peer(ep.address, ep.port);
+                const bool sack = robust && peer.sack;
+                if(robust && !sack)
+                {
+                    message_chunk ack;
+                    ack.type = message_chunk::ack;
+                    ack.host = ep.address;
+                    ack.port = ep.port;
+                    ack.sequence = c.sequence;
+                    ack.total_chunks = c.total_chunks;
+                    ack.chunk = c.chunk;
+                    CHECK(ack.data.empty());
+
+                    //send ack
+                    _stats.acks_sent++;
+                    send_right_away(ack);
                 }
-                else 
+
+                const auto sequence = c.sequence;
+                const auto total = c.total_chunks;
+
+                //resend of a message we already have, the ack was lost
+                if(robust && is_completed(ep, sequence))
                 {
-                    validate_chunk(c);
-                    post_send();
+                    if(sack) send_complete_sack(ep, sequence, total);
+                    return;
                 }
 
+                //sequences are per sender so each peer has its own working set
+                auto& in_working = peer.in_working;
+                auto wmi = in_working.find(sequence);
+                const bool duplicate = wmi != in_working.end() 
+                    && c.chunk < wmi->second.set.size() 
+                    && wmi->second.set[c.chunk];
+
+                //insert message_chunk to message buffer
+                bool inserted = insert_chunk(c, in_working, _work_buffer, _stats.bytes_copied);
+
+                if(inserted)
+                {
+                    if(robust) add_completed(ep, sequence);
+                    if(sack) send_complete_sack(ep, sequence, total);
+
+                    endpoint_message em{ep, std::move(_work_buffer), robust};
+                    _in_queue.emplace_push(em);
+                }
+                else if(sack) queue_sack(ep, sequence, duplicate);
             }
-            start_read();
         }
 
-        size_t udp_connection::resend(message_ring_item& r)
+        void udp_connection::handle_ack(const message_chunk& c)
         {
-            REQUIRE(r.wm);
-            auto &wm = *r.wm;
-            
-            REQUIRE_GREATER(wm.proto.total_chunks, 0);
-            REQUIRE_GREATER(wm.data.size(), 0);
+            REQUIRE(is_ack(c));
 
-            if(wm.set.count() == wm.proto.total_chunks) return 0;
-
-            size_t resent_m = 0;
-            size_t cnt = 0;
-            for(chunk_id_type c = 0; c < wm.proto.total_chunks; c++)
+            if(c.type == message_chunk::probe_ack) handle_probe_ack(c);
+            else if(c.type == message_chunk::ack)
             {
-                if(cnt >= wm.next_send) break;
-                cnt++;
-                //skip validated or not sent
-                if(wm.set[c] || !wm.sent[c]) continue;
-                resent_m++;
-                if(resent_m > MAX_FLIGHT) break;
-
-                _stats.dropped++;
-                queue_resend(r, c);
+                validate_chunk(c);
+                post_send();
+            }
+            else
+            {
+                validate_sack(c);
+                post_send();
             }
-            return resent_m;
         }
 
-        void udp_connection::resend()
+        udp_connection& udp_connection::owner_of(const endpoint& ep)
         {
-            bool resent = false;
-            exhausted_messages em;
-            for(auto& r : _message_ring)
-            {
-                CHECK(r.wm);
-                auto& wm = *r.wm;
-                CHECK_GREATER(wm.proto.total_chunks, 0);
-
-                wm.ticks++;
+            if(!_shards || _shards->size() < 2) return *this;
 
-                sequence_type sequence = wm.proto.sequence;
-
-                //check if we should try to resend
-                bool skip = wm.ticks <= RESEND_TICK_THRESHOLD;
-                bool robust = wm.proto.type == message_chunk::msg;
+            auto& owner = (*_shards)[shard_of(ep.address, ep.port, _shards->size())];
+            CHECK(owner);
+            return *owner;
+        }
 
-                //walk working message and resend all chunks that never got
-                //acked
-                if(robust && !skip && resend(r) > 0) 
-                    resent = true;
+        void udp_connection::route(udp_connection& owner, message_chunk& c, const endpoint& ep)
+        {
+            REQUIRE(is_ack(c));
+            REQUIRE(&owner != this);
 
-                bool erase = robust ?  wm.ticks >= RESEND_THRESHOLD : all_sent(wm);
-                if(erase) em.insert(em.end(), sequence);
+            //the payload points into our read buffer, so the owner gets a copy
+            if(c.payload)
+            {
+                c.data.assign(c.payload, c.payload + c.payload_size);
+                c.payload = nullptr;
             }
 
-            for(auto sequence : em) cleanup_message(sequence);
-
-            if(resent) post_send();
+            owner._io.post(boost::bind(&udp_connection::handle_ack, &owner, c));
         }
 
         const udp_stats& udp_connection::stats() const 
@@ -764,67 +1990,91 @@ namespace fire
             return _stats;
         }
 
-        void udp_run_thread(udp_queue*);
-        void resend_thread(udp_queue*);
-        udp_queue::udp_queue(const asio_params& p) :
+        void udp_run_thread(udp_queue*, size_t);
+        udp_queue::udp_queue(const asio_params& p, endpoint_queue_ptr in) :
             _p(p), 
-            _io{new ba::io_service},
+            _in_queue{in ? in : std::make_shared<endpoint_queue>()},
+            _shared_in{in != nullptr},
             _done{false}
         {
             REQUIRE_GREATER(_p.local_port, 0);
-            _resolver.reset(new udp::resolver{*_io});
+
+            size_t shards = std::max<size_t>(_p.shards, 1);
+#ifndef FIRESTR_UDP_REUSEPORT
+            if(shards > 1)
+            {
+                LOG << "udp shards are not supported on this platform, using one socket" << std::endl;
+                shards = 1;
+            }
+#endif
+            _shards.resize(shards);
+            for(auto& s : _shards)
+            {
+                s.io.reset(new ba::io_service);
+                s.work.reset(new ba::io_service::work{*s.io});
+            }
+
+            _resolver.reset(new udp::resolver{*_shards.front().io});
             bind();
-            _run_thread.reset(new std::thread{udp_run_thread, this});
-            _resend_thread.reset(new std::thread{resend_thread, this});
 
-            INVARIANT(_io);
-            INVARIANT(_con);
+            for(size_t i = 0; i < _shards.size(); i++)
+                _shards[i].thread.reset(new std::thread{udp_run_thread, this, i});
+
+            INVARIANT_FALSE(_shards.empty());
+            INVARIANT_EQUAL(_cons.size(), _shards.size());
             INVARIANT(_resolver);
-            INVARIANT(_run_thread);
-            INVARIANT(_resend_thread);
+            INVARIANT(_in_queue);
         }
 
         void udp_queue::bind()
         {
-            CHECK_FALSE(_con);
-            INVARIANT(_io);
+            CHECK(_cons.empty());
 
-            _con = udp_connection_ptr{new udp_connection{_in_queue, *_io}};
-            _con->bind(_p.local_port);
+            //every connection exists before any is read from so acks can be routed
+            for(auto& s : _shards)
+                _cons.push_back(udp_connection_ptr{new udp_connection{*_in_queue, *s.io, _p.batch, _p.mtu, &_cons, _p.peer_limits}});
+
+            const bool reuse_port = _cons.size() > 1;
+            for(auto& c : _cons) c->bind(_p.local_port, reuse_port);
             
-            ENSURE(_con);
+            ENSURE_EQUAL(_cons.size(), _shards.size());
         }
 
         udp_queue::~udp_queue()
         {
-            INVARIANT(_io);
             _done = true;
-            _io->stop();
-            if(_p.block) _in_queue.done();
+            for(auto& s : _shards)
+            {
+                s.work.reset();
+                s.io->stop();
+            }
+            if(_p.block && !_shared_in) _in_queue->done();
             if(_p.wait > 0) u::sleep_thread(_p.wait);
-            if(_con) _con->close();
-            if(_run_thread) _run_thread->join();
-            if(_resend_thread) _resend_thread->join();
+            for(auto& c : _cons) c->close();
+            for(auto& s : _shards) if(s.thread) s.thread->join();
         }
 
         bool udp_queue::send(const endpoint_message& m)
         {
-            INVARIANT(_io);
-            CHECK(_con);
+            CHECK_FALSE(_cons.empty());
 
-            const auto& address = resolve(m.ep);
+            //a peer's messages always go through the same shard so its
+            //congestion state and working set live in one place
+            const auto address = resolve(m.ep);
+            auto& con = *_cons[shard_of(address, m.ep.port, _cons.size())];
             if(address != m.ep.address)
             {
                 endpoint_message cm = m;
                 cm.ep.address = address;
-                return _con->send(cm, _p.block);
+                return con.send(cm, _p.block);
             }
-            return _con->send(m, _p.block);
+            return con.send(m, _p.block);
         }
 
-        const std::string& udp_queue::resolve(const endpoint& ep)
+        std::string udp_queue::resolve(const endpoint& ep)
         {
             INVARIANT(_resolver);
+            u::mutex_scoped_lock l(_rmutex);
 
             auto resolved = _rmap.find(ep.address);
             if(resolved != _rmap.end()) return resolved->second;
@@ -841,44 +2091,59 @@ namespace fire
         bool udp_queue::receive(endpoint_message& m)
         {
             //return true if we got message
-            return _in_queue.pop(m, _p.block);
+            INVARIANT(_in_queue);
+            return _in_queue->pop(m, _p.block);
         }
 
         const udp_stats& udp_queue::stats() const 
         {
-            CHECK(_con);
-            return _con->stats();
-        }
+            CHECK_FALSE(_cons.empty());
+            if(_cons.size() == 1) return _cons.front()->stats();
 
-        void udp_run_thread(udp_queue* q)
-        {
-            CHECK(q);
-            CHECK(q->_io);
-            while(!q->_done) 
-            try
+            //sum the shards, congestion state comes from the busiest sender
+            _stats = udp_stats{};
+            size_t most_sent = 0;
+            for(const auto& c : _cons)
             {
-                q->_io->run();
-                u::sleep_thread(THREAD_SLEEP);
-            }
-            catch(std::exception& e)
-            {
-                LOG << "error in udp thread. " << e.what() << std::endl;
-            }
-            catch(...)
-            {
-                LOG << "unknown error in udp thread." << std::endl;
+                const auto& s = c->stats();
+                _stats.dropped += s.dropped;
+                _stats.bytes_sent += s.bytes_sent;
+                _stats.bytes_recv += s.bytes_recv;
+                _stats.packets_sent += s.packets_sent;
+                _stats.packets_recv += s.packets_recv;
+                _stats.send_calls += s.send_calls;
+                _stats.recv_calls += s.recv_calls;
+                _stats.acks_sent += s.acks_sent;
+                _stats.fast_resends += s.fast_resends;
+                _stats.bytes_copied += s.bytes_copied;
+                _stats.losses += s.losses;
+                _stats.queued_bytes += s.queued_bytes;
+                _stats.queued_peak = std::max(_stats.queued_peak, s.queued_peak);
+                _stats.send_rejected += s.send_rejected;
+                _stats.send_over += s.send_over;
+
+                if(s.packets_sent < most_sent) continue;
+                most_sent = s.packets_sent;
+                _stats.cwnd = s.cwnd;
+                _stats.srtt = s.srtt;
+                _stats.rto = s.rto;
             }
+            return _stats;
         }
 
-        void resend_thread(udp_queue* q)
+        void udp_run_thread(udp_queue* q, size_t shard)
         {
             CHECK(q);
-            CHECK(q->_io);
+            CHECK_RANGE(shard, 0, q->_shards.size());
+
+            auto& io = q->_shards[shard].io;
+            CHECK(io);
+
+            //work keeps run from returning until the queue is destroyed
             while(!q->_done) 
             try
             {
-                q->_io->post(boost::bind(&udp_connection::resend, q->_con));
-                u::sleep_thread(RESEND_THREAD_SLEEP);
+                io->run();
             }
             catch(std::exception& e)
             {
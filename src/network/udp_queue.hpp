@@ -35,28 +35,27 @@
 #include "network/connection.hpp"
 #include "network/message_queue.hpp"
 #include "util/thread.hpp"
+#include "util/watermark.hpp"
+
+#include <boost/asio/steady_timer.hpp>
 
 #include <list>
+#include <set>
+#include <deque>
+#include <chrono>
+#include <condition_variable>
 #include <unordered_map>
 
 namespace fire
 {
     namespace network
     {
-        struct endpoint_message
-        {
-            endpoint ep;
-            util::bytes data;
-            bool robust;
-        };
-
-        using endpoint_queue = util::queue<endpoint_message>;
-
         using udp_resolver_ptr = std::unique_ptr<boost::asio::ip::udp::resolver>;
         using udp_socket_ptr = std::unique_ptr<boost::asio::ip::udp::socket>;
         using sequence_type = uint64_t;
         using chunk_total_type = uint16_t;
         using chunk_id_type = uint16_t;
+        using chunk_size_type = uint16_t;
 
         struct message_chunk
         {
@@ -66,100 +65,288 @@ namespace fire
             sequence_type sequence = 0;
             chunk_total_type total_chunks = 0;
             chunk_id_type chunk;
+            chunk_size_type chunk_size = 0;
             util::bytes data;
             bool resent = false;
-            enum msg_type { qmsg, msg, ack} type;
+            enum msg_type { qmsg, msg, ack, probe, probe_ack, sack} type;
+
+            //payload without a copy. points into the message being
+            //sent, which owner keeps alive, or into the read buffer.
+            util::bytes_ptr owner;
+            const char* payload = nullptr;
+            size_t payload_size = 0;
+        };
+
+
+        using udp_clock = std::chrono::steady_clock;
+        using send_times = std::vector<udp_clock::time_point>;
 
-            //used for writing
-            const char* write_data = nullptr;
-            size_t write_size = 0;
+        //congestion window and rtt estimate for a peer.
+        //rto follows RFC 6298, window growth is slow start then AIMD.
+        struct congestion
+        {
+            double cwnd = 0; //in chunks
+            double ssthresh = 0; //in chunks
+            double srtt = 0; //in milliseconds
+            double rttvar = 0; //in milliseconds
+            double rto = 0; //in milliseconds
+            size_t in_flight = 0; //robust chunks sent and not acked
+            size_t losses = 0;
+            udp_clock::time_point recovery; //chunks sent before this were already backed off for
         };
 
+        //ring of messages with chunks waiting to be sent
+        using slot_index = size_t;
+        struct send_ring
+        {
+            slot_index current = 0;
+            size_t size = 0;
+        };
+
+        struct udp_peer;
+
+        using udp_timer = boost::asio::steady_timer;
+        using udp_timer_ptr = std::unique_ptr<udp_timer>;
 
         struct working_message
         {
             message_chunk proto;
-            util::bytes data;
+            util::bytes_ptr data;
             boost::dynamic_bitset<> set;
             boost::dynamic_bitset<> sent;
-            size_t ticks = 0;
+            boost::dynamic_bitset<> resent;
+            boost::dynamic_bitset<> flying;
+            send_times sent_at;
+            udp_peer* peer = nullptr;
+            util::occupancy* room = nullptr; //the peer's queued bytes, released on cleanup
+            std::shared_ptr<bool> left; //set on cleanup for a blocking send waiting on it
             size_t in_flight = 0;
             size_t queued = 0;
             size_t next_send = 0;
+            size_t acked_base = 0; //every chunk before this is acked
+            std::deque<chunk_id_type> resends; //lost chunks, sent before new ones
+
+            //retransmit timer fires when the oldest chunk in flight is
+            //older than the peer's rto
+            udp_timer_ptr timer;
+            udp_clock::time_point deadline; //when the timer fires, unset when not armed
+            udp_clock::time_point last_ack;
+            udp_clock::time_point last_sent;
+            size_t tail_probes = 0; //chunks resent since the last ack to get one back
+
+            //fast retransmit, chunks sent before a chunk that was acked
+            //further along are lost
+            size_t highest_acked = 0; //one past the highest chunk acked
+            udp_clock::time_point newest_acked_sent;
+
+            //incoming messages waiting on a delayed selective ack
+            bool ack_pending = false;
+            size_t unacked = 0;
         };
 
         //working set for both incoming and outgoing messages
         using hash_type = std::size_t;
         using working_messages = std::unordered_map<sequence_type, working_message>;
+
+        //path mtu and congestion state for each peer we send to, and
+        //messages coming in from it
+        struct udp_peer
+        {
+            size_t packet_size = 0; //largest packet size the peer acked
+            size_t probe_size = 0; //packet size currently being probed, 0 when done
+            size_t probe_tries = 0;
+            bool probed = false;
+            bool sack = false; //peer understands selective acks
+            congestion cc;
+
+            //messages to the peer with chunks to send. robust ones wait
+            //on the congestion window, the rest do not.
+            send_ring robust;
+            send_ring unreliable;
+            bool sending = false;
+
+            //messages being received from the peer
+            working_messages in_working;
+        };
+        using udp_peer_list = std::vector<udp_peer*>;
+        using udp_peer_map = std::unordered_map<std::string, udp_peer>;
+
+        //recently completed incoming messages so late resends are acked 
+        //instead of delivered twice
+        using completed_message = std::pair<std::string, sequence_type>;
+        using completed_set = std::set<completed_message>;
+        using completed_queue = std::deque<completed_message>;
         using resolve_map = std::unordered_map<std::string, std::string>;
 
-        //outgoing chunks are send round robin in the message_ring
-        using chunk_id_queue = util::queue<chunk_id_type>;
-        struct message_ring_item
+        struct message_slot
         {
-            working_message* wm;
-            chunk_id_queue resends; 
+            working_message wm;
+            send_ring* ring = nullptr; //ring the slot is linked in
+            slot_index prev = 0;
+            slot_index next = 0;
+            bool used = false;
         };
 
-        using message_ring = std::vector<message_ring_item>;
+        //outgoing messages live in slots that never move and are found
+        //by sequence. freed slots are reused. slots with chunks to send 
+        //are linked into a send_ring so they are sent round robin.
+        class message_slots
+        {
+            public:
+                working_message& add(sequence_type);
+                void remove(sequence_type);
+                working_message* find(sequence_type);
+                size_t size() const;
+
+            public:
+                void link(sequence_type, send_ring&);
+                void unlink(sequence_type);
+                bool linked(sequence_type) const;
+                working_message& next(send_ring&);
+
+            private:
+                void unlink_slot(slot_index);
+
+            private:
+                using slot_map = std::unordered_map<sequence_type, slot_index>;
+
+                std::deque<message_slot> _slots;
+                std::vector<slot_index> _free;
+                slot_map _index;
+        };
 
         struct udp_stats
         {
             size_t dropped = 0;
             size_t bytes_sent = 0;
             size_t bytes_recv = 0;
+            size_t packets_sent = 0;
+            size_t packets_recv = 0;
+            size_t send_calls = 0;
+            size_t recv_calls = 0;
+            size_t acks_sent = 0;
+            size_t fast_resends = 0;
+            size_t bytes_copied = 0; //message bytes copied on the way in or out
+
+            //congestion state of the peer that was last acked
+            size_t cwnd = 0;
+            double srtt = 0;
+            double rto = 0;
+            size_t losses = 0; //loss events across all peers
+
+            //backpressure from the per peer watermarks
+            size_t queued_bytes = 0; //message bytes waiting to be sent to peers
+            size_t queued_peak = 0; //most bytes waiting on one peer
+            size_t send_rejected = 0; //sends dropped because the peer was full
+            size_t send_over = 0; //sends taken while the peer was over its high watermark
         };
 
+        //buffers used when sending and receiving many datagrams per syscall
+        struct udp_batch;
+        using udp_batch_ptr = std::unique_ptr<udp_batch>;
+
         using chunk_queue = util::queue<message_chunk>;
 
+        //bytes queued to each peer, counted by the sending thread and
+        //released on the io thread. entries are never removed.
+        using peer_room_ptr = std::unique_ptr<util::occupancy>;
+        using peer_rooms = std::unordered_map<std::string, peer_room_ptr>;
+
         class udp_queue;
+        class udp_connection;
+        using udp_connection_ptr = std::shared_ptr<udp_connection>;
+        using udp_connections = std::vector<udp_connection_ptr>;
+
         class udp_connection
         {
             public:
                 udp_connection(
                         endpoint_queue& in,
-                        boost::asio::io_service& io);
+                        boost::asio::io_service& io,
+                        size_t batch = 0,
+                        size_t mtu = 0,
+                        const udp_connections* shards = nullptr,
+                        const util::watermarks& peer_limits = util::watermarks{});
+                ~udp_connection();
             public:
                 bool send(const endpoint_message& m, bool block = false);
 
             public:
-                void bind(port_type port);
+                void bind(port_type port, bool reuse_port = false);
                 void do_send();
+                void handle_ack(const message_chunk& c);
                 void handle_write(const boost::system::error_code& error);
                 void handle_read(const boost::system::error_code& error, size_t transferred);
+                void handle_batch_write(const boost::system::error_code& error);
+                void handle_batch_read(const boost::system::error_code& error);
+                void handle_ack_timer(const boost::system::error_code& error);
+                void handle_resend_timer(const boost::system::error_code& error, sequence_type sequence);
+                void handle_probe_timer(const boost::system::error_code& error);
                 void close();
                 void start_read();
                 void do_close();
                 const udp_stats& stats() const; 
 
             private:
-                void add_to_working_set(endpoint_message m);
-                void init_working(message_chunk& proto, util::bytes& data);
+                void add_to_working_set(const endpoint& ep, bool robust, util::bytes_ptr data, util::occupancy* room, std::shared_ptr<bool> left);
+                util::occupancy& peer_room(const endpoint&);
+                void init_working(message_chunk& proto, util::bytes_ptr data, udp_peer&);
                 void send_right_away(message_chunk& c);
                 bool get_next_chunk(working_message&, message_chunk& queued_chunk);
+                bool get_resend_chunk(working_message&, message_chunk& queued_chunk);
                 void cleanup_message(sequence_type sequence);
                 void validate_chunk(const message_chunk& c);
-                void queue_resend(message_ring_item&, chunk_id_type c);
+                void validate_sack(const message_chunk& c);
+                bool ack_chunk(working_message&, chunk_id_type c);
+                void acked(working_message&, udp_clock::time_point newest_sent);
+                void queue_sack(const endpoint&, sequence_type, bool duplicate);
+                void send_sack(const endpoint&, sequence_type, const working_message&);
+                void send_complete_sack(const endpoint&, sequence_type, chunk_total_type);
+                void send_pending_sacks();
+                void queue_resend(working_message&, chunk_id_type c);
+                void lost_chunk(working_message&, chunk_id_type c);
+                void loss_event(udp_peer&, udp_clock::time_point sent, bool timeout);
+                void expire_chunks(working_message&);
+                void fast_resend(working_message&);
+                void tail_probe(working_message&);
+                void arm_resend_timer(working_message&);
                 void queue_next_chunk();
-                bool incr_next_message();
+                bool queue_next_chunk(send_ring&);
+                void start_sending(working_message&);
                 void sent_chunk(const message_chunk& c);
-                size_t resend(message_ring_item&);
-                void resend();
                 void post_send();
+                void do_batch_send();
+                void flush_batch();
+                udp_peer& add_peer(const std::string& host, port_type port);
+                udp_peer& get_peer(const std::string& host, port_type port);
+                void send_probe(const std::string& host, port_type port, udp_peer&);
+                void update_congestion_stats(const udp_peer&);
+                void handle_probe_ack(const message_chunk& c);
+                void add_completed(const endpoint&, sequence_type);
+                bool is_completed(const endpoint&, sequence_type) const;
+                void probe_peers();
+                void handle_datagram(
+                        const util::bytes& buffer, 
+                        size_t transferred, 
+                        const boost::asio::ip::udp::endpoint& from);
+                udp_connection& owner_of(const endpoint&);
+                void route(udp_connection& owner, message_chunk& c, const endpoint&);
 
             private:
                 //reading
                 util::bytes _work_buffer;
                 util::bytes _in_buffer;
-                util::bytes _out_buffer;
+                util::bytes _out_buffer; //header of the chunk being written
+                message_chunk _out_chunk; //keeps the payload alive while written
                 boost::asio::ip::udp::endpoint _in_endpoint;
-                working_messages _in_working;
-                working_messages _out_working;
+                completed_set _completed;
+                completed_queue _completed_order;
                 endpoint_queue& _in_queue;
 
                 //writing
-                size_t _next_message = 0;
-                message_ring _message_ring; //messages get chunked to here
+                message_slots _out_working; //messages get chunked to here
+                udp_peer_list _sending; //peers with messages to send
+                size_t _next_peer = 0;
 
                 //queue for chunks ready to go
                 chunk_queue _out_queue; //the queue loop adds next message to here to be sent
@@ -168,21 +355,58 @@ namespace fire
                 boost::asio::io_service& _io;
                 udp_socket_ptr _socket;
                 sequence_type _sequence = 0;
-                bool _writing;
+                bool _writing; //a send is in flight, only touched on the io thread
                 boost::system::error_code _error;
                 udp_stats _stats;
+                udp_batch_ptr _batch;
+
+                //path mtu discovery and congestion control
+                size_t _mtu;
+                udp_peer_map _peers;
+
+                //delayed selective acks
+                using pending_acks = std::vector<std::pair<endpoint, sequence_type>>;
+                pending_acks _pending_acks;
+                boost::asio::steady_timer _ack_timer;
+                bool _ack_timer_armed = false;
+
+                //unacked mtu probes are retried on this timer
+                boost::asio::steady_timer _probe_timer;
+                bool _probe_timer_armed = false;
+
+                //connections sharing the port. each peer's messages are
+                //sent by one of them and its acks are routed there.
+                const udp_connections* _shards;
+
+                //bounds the bytes queued to each peer
+                util::watermarks _peer_limits;
+                peer_rooms _rooms;
+                std::mutex _rooms_mutex;
+
+                //blocking sends wait for their message to leave the working set
+                std::mutex _out_mutex;
+                std::condition_variable _out_drained;
+                bool _closed = false;
             private:
-                friend void udp_run_thread(udp_queue*);
-                friend void resend_thread(udp_queue*);
+                friend void udp_run_thread(udp_queue*, size_t);
         };
 
-        using udp_connection_ptr = std::shared_ptr<udp_connection>;
-        using udp_connections = std::vector<udp_connection_ptr>;
+        //each shard binds the port with SO_REUSEPORT and runs its own
+        //io_service so receiving is spread across cores
+        struct udp_shard
+        {
+            asio_service_ptr io;
+            asio_work_ptr work;
+            util::thread_uptr thread;
+        };
+        using udp_shards = std::vector<udp_shard>;
+
+        size_t shard_of(const std::string& host, port_type port, size_t shards);
 
         class udp_queue
         {
             public:
-                udp_queue(const asio_params& p);
+                udp_queue(const asio_params& p, endpoint_queue_ptr in = nullptr);
                 virtual ~udp_queue();
 
             public:
@@ -194,28 +418,28 @@ namespace fire
 
             private:
                 void bind();
-                const std::string& resolve(const endpoint&);
+                std::string resolve(const endpoint&);
 
             private:
                 asio_params _p;
-                asio_service_ptr _io;
-                util::thread_uptr _run_thread;
-                util::thread_uptr _resend_thread;
+                udp_shards _shards;
+                udp_connections _cons;
 
-                udp_connection_ptr _con;
-                endpoint_queue _in_queue;
+                endpoint_queue_ptr _in_queue;
+                bool _shared_in; //someone else owns the in queue
                 udp_resolver_ptr _resolver;
                 resolve_map _rmap;
+                std::mutex _rmutex; //senders resolve from many threads
+                mutable udp_stats _stats; //summed over shards
                 bool _done;
 
             private:
-                friend void udp_run_thread(udp_queue*);
-                friend void resend_thread(udp_queue*);
+                friend void udp_run_thread(udp_queue*, size_t);
         };
 
         using udp_queue_ptr = std::shared_ptr<udp_queue>;
 
-        udp_queue_ptr create_udp_queue(const asio_params& c);
+        udp_queue_ptr create_udp_queue(const asio_params& c, endpoint_queue_ptr in = nullptr);
     }
 }
 
@@ -52,6 +52,7 @@ namespace fire
 
         using byte_queue = util::queue<util::bytes>;
         using asio_service_ptr = std::unique_ptr<boost::asio::io_service>;
+        using asio_work_ptr = std::unique_ptr<boost::asio::io_service::work>;
     }
 }
 
@@ -33,14 +33,17 @@
 #include "util/dbc.hpp"
 #include "util/log.hpp"
 
+#include <algorithm>
 #include <sstream>
 #include <exception>
 
 #include <botan/auto_rng.h>
+#include <botan/cipher_mode.h>
 #include <botan/data_src.h>
 #include <botan/dh.h>
 #include <botan/filters.h>
-#include <botan/pipe.h>
+#include <botan/hash.h>
+#include <botan/hex.h>
 #include <botan/pkcs8.h>
 #include <botan/pubkey.h>
 #include <botan/rng.h>
@@ -65,14 +68,15 @@ namespace fire
             const std::string CYPHER = "AES-256/CBC";
             const std::string SHARED_DOMAIN = "modp/ietf/2048";
             const size_t DH_KEY_SIZE = 32;
-            std::mutex BOTAN_MUTEX;
-            std::unique_ptr<b::AutoSeeded_RNG> RNG;
+            const b::byte ZERO_IV[16] = {}; //in bytes, one AES block
+            const size_t CONTENT_HASH_SIZE = 64; //hex digits of a SHA-256
 
-            inline void init_rng()
+            //each thread has its own rng so crypto on different threads
+            //does not share any state
+            b::RandomNumberGenerator& rng()
             {
-                if(RNG) return;
-                RNG.reset(new b::AutoSeeded_RNG);
-                ENSURE(RNG);
+                thread_local b::AutoSeeded_RNG r;
+                return r;
             }
         }
 
@@ -84,15 +88,12 @@ namespace fire
 
         private_key::private_key(const std::string& passphrase)
         {
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
             validate_passphrase(passphrase);
 
-            init_rng();
-            CHECK(RNG);
 
-            _k.reset(new b::RSA_PrivateKey{*RNG, RSA_SIZE});
+            _k.reset(new b::RSA_PrivateKey{rng(), RSA_SIZE});
             _public_key = b::X509::PEM_encode(*_k);
-            _encrypted_private_key = b::PKCS8::PEM_encode(*_k, *RNG, passphrase);
+            _encrypted_private_key = b::PKCS8::PEM_encode(*_k, rng(), passphrase);
 
             ENSURE(_k);
             ENSURE_FALSE(_encrypted_private_key.empty());
@@ -105,7 +106,6 @@ namespace fire
             _encrypted_private_key(encrypted_private_key)
         {
             REQUIRE_FALSE(encrypted_private_key.empty());
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
             validate_passphrase(passphrase);
 
@@ -113,10 +113,8 @@ namespace fire
                 reinterpret_cast<const b::byte*>(&_encrypted_private_key[0]), 
                     _encrypted_private_key.size()};
 
-            init_rng();
-            CHECK(RNG);
 
-            _k.reset(b::PKCS8::load_key(ds, *RNG, passphrase));
+            _k.reset(b::PKCS8::load_key(ds, rng(), passphrase));
 
             if(!_k) throw std::invalid_argument{"Invalid Password"};
 
@@ -148,7 +146,6 @@ namespace fire
         void public_key::set(const std::string& key) 
         {
             REQUIRE_FALSE(key.empty());
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
             b::DataSource_Memory ds{reinterpret_cast<const b::byte*>(&_ks[0]), _ks.size()};
             _k.reset(b::X509::load_key(ds));
@@ -188,7 +185,6 @@ namespace fire
         public_key& public_key::operator=(const public_key& o)
         {
             if(&o == this) return *this;
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
             _ks = o._ks;
             b::DataSource_Memory ds{reinterpret_cast<const b::byte*>(&_ks[0]), _ks.size()};
@@ -243,9 +239,8 @@ namespace fire
         u::bytes private_key::decrypt(const u::bytes& b) const
         {
             INVARIANT(_k);
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
-            b::PK_Decryptor_EME d{*_k, *RNG, EME_SCHEME};
+            b::PK_Decryptor_EME d{*_k, rng(), EME_SCHEME};
 
             u::bytes rs;
             std::stringstream s(u::to_str(b));
@@ -264,13 +259,10 @@ namespace fire
         u::bytes private_key::sign(const u::bytes& b) const
         {
             INVARIANT(_k);
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
-            init_rng();
-            CHECK(RNG);
 
-            b::PK_Signer s{*_k, *RNG, EMSA_SCHEME};
-            auto r = s.sign_message(reinterpret_cast<const unsigned char*>(b.data()), b.size(), *RNG); 
+            b::PK_Signer s{*_k, rng(), EMSA_SCHEME};
+            auto r = s.sign_message(reinterpret_cast<const unsigned char*>(b.data()), b.size(), rng()); 
 
             ENSURE_EQUAL(r.size(), SIGNATURE_SIZE);
             return u::bytes {std::begin(r), std::end(r)};
@@ -280,20 +272,17 @@ namespace fire
         {
             INVARIANT(_k);
             INVARIANT_FALSE(_ks.empty());
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
-            init_rng();
-            CHECK(RNG);
 
             std::stringstream rs;
 
-            b::PK_Encryptor_EME e{*_k, *RNG, EME_SCHEME};
+            b::PK_Encryptor_EME e{*_k, rng(), EME_SCHEME};
 
             size_t advance = 0;
             while(advance < b.size())
             {
                 size_t size = std::min(e.maximum_input_size(), b.size()-advance);
-                auto c = e.encrypt(reinterpret_cast<const unsigned char*>(b.data())+advance, size, *RNG);
+                auto c = e.encrypt(reinterpret_cast<const unsigned char*>(b.data())+advance, size, rng());
                 u::bytes bs{std::begin(c), std::end(c)};
                 rs << bs;
                 advance+=size;
@@ -305,7 +294,6 @@ namespace fire
         {
             INVARIANT(_k);
             INVARIANT_FALSE(_ks.empty());
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
             b::PK_Verifier v{*_k, EMSA_SCHEME};
             return v.verify_message(
@@ -320,13 +308,10 @@ namespace fire
 
         dh_secret::dh_secret()
         {
-            u::mutex_scoped_lock l(BOTAN_MUTEX);
 
-            init_rng();
-            CHECK(RNG);
 
             b::DL_Group sd{SHARED_DOMAIN};
-            _pkey = std::make_shared<b::DH_PrivateKey>(*RNG, sd);
+            _pkey = std::make_shared<b::DH_PrivateKey>(rng(), sd);
             auto p = _pkey->public_value();
             _pub_value = u::bytes{std::begin(p), std::end(p)};
             ENSURE(_pkey);
@@ -336,7 +321,10 @@ namespace fire
         dh_secret::dh_secret(const dh_secret& o) : 
             _pkey{o._pkey}, _skey{o._skey}, 
             _pub_value(o._pub_value), 
-            _other_pub_value(o._other_pub_value) {}
+            _other_pub_value(o._other_pub_value) 
+        {
+            if(_skey) create_ciphers();
+        }
 
         dh_secret& dh_secret::operator=(const dh_secret& o)
         {
@@ -346,9 +334,36 @@ namespace fire
             _skey = o._skey;
             _pub_value = o._pub_value;
             _other_pub_value = o._other_pub_value;
+            if(_skey) create_ciphers();
+            else
+            {
+                _encryptor.reset();
+                _decryptor.reset();
+            }
             return *this;
         }
 
+        cipher_ptr create_cipher(const b::SymmetricKey& key, b::Cipher_Dir dir)
+        {
+            cipher_ptr c{b::get_cipher_mode(CYPHER, dir)};
+            if(!c) throw std::runtime_error{"unable to create cipher " + CYPHER};
+
+            c->set_key(key);
+            return c;
+        }
+
+        void dh_secret::create_ciphers()
+        {
+            REQUIRE(_skey);
+
+            //copies get their own ciphers since cipher state is not shared
+            _encryptor = create_cipher(*_skey, b::ENCRYPTION);
+            _decryptor = create_cipher(*_skey, b::DECRYPTION);
+
+            ENSURE(_encryptor);
+            ENSURE(_decryptor);
+        }
+
         const util::bytes& dh_secret::public_value() const
         {
             u::mutex_scoped_lock l(_mutex);
@@ -365,13 +380,10 @@ namespace fire
 
         void dh_secret::create_symmetric_key(const util::bytes& pv)
         {
-            u::mutex_scoped_lock bl(BOTAN_MUTEX);
             u::mutex_scoped_lock l(_mutex);
             INVARIANT(_pkey);
-            init_rng();
-            CHECK(RNG);
 
-            b::PK_Key_Agreement k{*_pkey, *RNG, KEY_AGREEMENT_ALGO};
+            b::PK_Key_Agreement k{*_pkey, rng(), KEY_AGREEMENT_ALGO};
             _skey = 
                 std::make_shared<b::SymmetricKey>(
                         k.derive_key(
@@ -380,6 +392,7 @@ namespace fire
                             CONVERSATION_PARAM));
 
             _other_pub_value = pv;
+            create_ciphers();
             ENSURE(_skey);
         }
 
@@ -389,40 +402,116 @@ namespace fire
             return _skey != nullptr;
         }
 
+        util::bytes run_cipher(b::Cipher_Mode& c, const util::bytes& bs)
+        {
+            //every message starts from a zero iv, same as a new pipe
+            b::secure_vector<b::byte> buf{std::begin(bs), std::end(bs)};
+            c.start(ZERO_IV, sizeof(ZERO_IV));
+            c.finish(buf);
+            return {std::begin(buf), std::end(buf)};
+        }
+
         util::bytes dh_secret::encrypt(const util::bytes& bs) const
         {
             REQUIRE(ready());
-            u::mutex_scoped_lock bl(BOTAN_MUTEX);
             u::mutex_scoped_lock l(_mutex);
-            b::Pipe p{b::get_cipher(CYPHER, *_skey, b::ENCRYPTION)};
-            p.start_msg();
-            p.write(reinterpret_cast<const unsigned char*>(bs.data()), bs.size());
-            p.end_msg();
-              
-            auto e = p.read_all(0);
-            return {std::begin(e), std::end(e)};
+            CHECK(_encryptor);
+            return run_cipher(*_encryptor, bs);
         }
 
         util::bytes dh_secret::decrypt(const util::bytes& bs) const
         {
             REQUIRE(ready());
-            u::mutex_scoped_lock bl(BOTAN_MUTEX);
             u::mutex_scoped_lock l(_mutex);
-            b::Pipe p{b::get_cipher(CYPHER, *_skey, b::DECRYPTION)};
-            p.start_msg();
-            p.write(reinterpret_cast<const unsigned char*>(bs.data()), bs.size());
-            p.end_msg();
-            auto e = p.read_all(0);
-            return {std::begin(e), std::end(e)};
+            CHECK(_decryptor);
+            return run_cipher(*_decryptor, bs);
+        }
+
+        group_secret::group_secret() : _key(DH_KEY_SIZE)
+        {
+            randomize(_key);
+            _skey = std::make_shared<b::SymmetricKey>(
+                    reinterpret_cast<const b::byte*>(_key.data()), _key.size());
+            _encryptor = create_cipher(*_skey, b::ENCRYPTION);
+            _decryptor = create_cipher(*_skey, b::DECRYPTION);
+
+            ENSURE(_encryptor);
+            ENSURE(_decryptor);
+        }
+
+        group_secret::group_secret(const util::bytes& key) : _key(key)
+        {
+            if(_key.size() != DH_KEY_SIZE) throw std::invalid_argument{"group key has the wrong size"};
+
+            _skey = std::make_shared<b::SymmetricKey>(
+                    reinterpret_cast<const b::byte*>(_key.data()), _key.size());
+            _encryptor = create_cipher(*_skey, b::ENCRYPTION);
+            _decryptor = create_cipher(*_skey, b::DECRYPTION);
+
+            ENSURE(_encryptor);
+            ENSURE(_decryptor);
+        }
+
+        const util::bytes& group_secret::key() const
+        {
+            return _key;
+        }
+
+        //the key is used for many payloads so each starts with its own iv
+        util::bytes group_secret::encrypt(const util::bytes& bs) const
+        {
+            b::byte iv[sizeof(ZERO_IV)];
+            rng().randomize(iv, sizeof(iv));
+
+            b::secure_vector<b::byte> buf{std::begin(bs), std::end(bs)};
+            {
+                u::mutex_scoped_lock l(_mutex);
+                CHECK(_encryptor);
+                _encryptor->start(iv, sizeof(iv));
+                _encryptor->finish(buf);
+            }
+
+            util::bytes r;
+            r.reserve(sizeof(iv) + buf.size());
+            r.insert(r.end(), std::begin(iv), std::end(iv));
+            r.insert(r.end(), std::begin(buf), std::end(buf));
+            return r;
+        }
+
+        util::bytes group_secret::decrypt(const util::bytes& bs) const
+        {
+            if(bs.size() <= sizeof(ZERO_IV)) return {};
+
+            const auto iv = reinterpret_cast<const b::byte*>(bs.data());
+            b::secure_vector<b::byte> buf{std::begin(bs) + sizeof(ZERO_IV), std::end(bs)};
+
+            u::mutex_scoped_lock l(_mutex);
+            CHECK(_decryptor);
+            _decryptor->start(iv, sizeof(ZERO_IV));
+            _decryptor->finish(buf);
+            return {std::begin(buf), std::end(buf)};
         }
 
         void randomize(util::bytes& b)
         {
-            u::mutex_scoped_lock bl(BOTAN_MUTEX);
-            init_rng();
-            CHECK(RNG);
 
-            RNG->randomize(reinterpret_cast<unsigned char*>(b.data()), b.size());
+            rng().randomize(reinterpret_cast<unsigned char*>(b.data()), b.size());
+        }
+
+        std::string content_hash(const util::bytes& b)
+        {
+            auto h = b::HashFunction::create_or_throw("SHA-256");
+            CHECK(h);
+
+            h->update(reinterpret_cast<const b::byte*>(b.data()), b.size());
+            return b::hex_encode(h->final(), false);
+        }
+
+        bool is_content_hash(const std::string& h)
+        {
+            return h.size() == CONTENT_HASH_SIZE && 
+                std::all_of(h.begin(), h.end(), 
+                        [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');});
         }
     }
 }
@@ -44,6 +44,7 @@ namespace Botan
     class OctetString;
     typedef OctetString SymmetricKey; 
     class DH_PrivateKey;
+    class Cipher_Mode;
 }
 
 namespace fire  
@@ -112,6 +113,7 @@ namespace fire
 
         using symmetric_key_ptr = std::shared_ptr<Botan::SymmetricKey>;
         using dh_private_key_ptr = std::shared_ptr<Botan::DH_PrivateKey>;
+        using cipher_ptr = std::shared_ptr<Botan::Cipher_Mode>;
 
         class dh_secret
         {
@@ -130,18 +132,62 @@ namespace fire
                 util::bytes encrypt(const util::bytes&) const;
                 util::bytes decrypt(const util::bytes&) const;
 
+            private:
+                void create_ciphers();
+
             private:
                 dh_private_key_ptr _pkey;
                 symmetric_key_ptr _skey;
                 util::bytes _pub_value;
                 util::bytes _other_pub_value;
+
+                //keyed once, guarded by the secret's own mutex so
+                //different channels encrypt in parallel
+                cipher_ptr _encryptor;
+                cipher_ptr _decryptor;
                 mutable std::mutex _mutex;
         };
 
+        /**
+         * A random symmetric key for encrypting one payload to many
+         * peers. Each payload gets its own random iv.
+         */
+        class group_secret
+        {
+            public:
+                group_secret();
+                group_secret(const util::bytes& key);
+
+            public:
+                const util::bytes& key() const;
+                util::bytes encrypt(const util::bytes&) const;
+                util::bytes decrypt(const util::bytes&) const;
+
+            private:
+                symmetric_key_ptr _skey;
+                util::bytes _key;
+                cipher_ptr _encryptor;
+                cipher_ptr _decryptor;
+                mutable std::mutex _mutex;
+        };
+        using group_secret_ptr = std::shared_ptr<group_secret>;
+
         /**
          * Randomizes the byte array with the size specified
          */
         void randomize(util::bytes&);
+
+        /**
+         * Hex encoded SHA-256 of the bytes, used to address content
+         */
+        std::string content_hash(const util::bytes&);
+
+        /**
+         * True if the string is a lowercase hex SHA-256 as content_hash 
+         * returns. Hashes from peers must pass this before they are used
+         * to find content.
+         */
+        bool is_content_hash(const std::string&);
     }
 }
 
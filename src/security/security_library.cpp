@@ -31,6 +31,7 @@
 #include "security/security_library.hpp"
 #include "util/dbc.hpp"
 #include "util/log.hpp"
+#include "util/mencode.hpp"
 
 namespace u = fire::util;
 
@@ -38,6 +39,11 @@ namespace fire
 {
     namespace security 
     {
+        namespace
+        {
+            const size_t MAX_VARINT_SIZE = 10; //in bytes
+        }
+
         encrypted_channels::encrypted_channels(const private_key& pk) : _pk(pk) {}
 
         u::bytes append_prefix(char p, const u::bytes& bs)
@@ -49,20 +55,26 @@ namespace fire
             return rs;
         }
 
-        u::bytes encrypted_channels::encrypt_asymmetric(channel_map::const_iterator s, const u::bytes& bs) const
+        channel_ptr encrypted_channels::find_channel(const id& i) const
+        {
+            u::mutex_scoped_lock l(_mutex);
+            auto s = _s.find(i);
+            return s != _s.end() ? s->second : nullptr;
+        }
+
+        u::bytes encrypted_channels::encrypt_asymmetric(channel_ptr s, const u::bytes& bs) const
         {
             if(bs.empty()) return {};
 
-            if(s == _s.end()) return {};
+            if(!s) return {};
 
-            auto es = s->second.key.encrypt(bs);
+            auto es = s->key.encrypt(bs);
             return append_prefix(encryption_type::asymmetric, es);
         }
 
         u::bytes encrypted_channels::encrypt_asymmetric(const id& i, const u::bytes& bs) const
         {
-            u::mutex_scoped_lock l(_mutex);
-            return encrypt_asymmetric(_s.find(i), bs);
+            return encrypt_asymmetric(find_channel(i), bs);
         }
 
 
@@ -71,28 +83,26 @@ namespace fire
             return append_prefix(encryption_type::plaintext, bs);
         }
 
-        u::bytes encrypted_channels::encrypt_symmetric(channel_map::const_iterator s, const u::bytes& bs) const
+        u::bytes encrypted_channels::encrypt_symmetric(channel_ptr s, const u::bytes& bs) const
         {
-            if(s == _s.end()) return {};
-            REQUIRE(s->second.shared_secret.ready());
+            if(!s) return {};
+            REQUIRE(s->shared_secret.ready());
 
-            auto es = s->second.shared_secret.encrypt(bs);
+            auto es = s->shared_secret.encrypt(bs);
             return append_prefix(encryption_type::symmetric, es);
         }
 
         u::bytes encrypted_channels::encrypt_symmetric(const id& i, const u::bytes& bs) const
         {
-            u::mutex_scoped_lock l(_mutex);
-            return encrypt_symmetric(_s.find(i), bs);
+            return encrypt_symmetric(find_channel(i), bs);
         }
 
         u::bytes encrypted_channels::encrypt(const id& i, const u::bytes& bs) const
         {
-            u::mutex_scoped_lock l(_mutex);
-            auto s = _s.find(i);
-            if(s == _s.end()) return encrypt_plaintext(bs); 
+            auto s = find_channel(i);
+            if(!s) return encrypt_plaintext(bs); 
 
-            if(!s->second.shared_secret.ready())
+            if(!s->shared_secret.ready())
             {
                 return encrypt_asymmetric(s, bs);
             }
@@ -100,6 +110,52 @@ namespace fire
             return encrypt_symmetric(s, bs);
         }
 
+        u::bytes encrypted_channels::encrypt_group(const id& i, const group_secret& g, const u::bytes& sealed) const
+        {
+            if(sealed.empty()) return {};
+
+            //a key sent in the clear would expose every message of the group
+            auto s = find_channel(i);
+            if(!s) return {};
+
+            auto wrapped = s->shared_secret.ready() ?
+                encrypt_symmetric(s, g.key()) :
+                encrypt_asymmetric(s, g.key());
+            if(wrapped.empty()) return {};
+
+            u::bytes rs;
+            rs.reserve(1 + MAX_VARINT_SIZE + wrapped.size() + sealed.size());
+
+            u::byte_writer w{rs};
+            w.put(encryption_type::group);
+            w.varint(wrapped.size());
+            w.raw(wrapped.data(), wrapped.size());
+            w.raw(sealed.data(), sealed.size());
+            return rs;
+        }
+
+        //the group key is decrypted like any message and the message
+        //is as trusted as the key was
+        u::bytes encrypted_channels::decrypt_group(const id& i, const u::bytes& bs, encryption_type& et) const
+        {
+            u::byte_reader r{bs};
+            r.get();
+            const auto size = r.varint();
+            const auto p = r.raw(size);
+
+            u::bytes wrapped{p, p + size};
+            if(wrapped.empty() || wrapped[0] == encryption_type::group) return {};
+
+            const auto key = decrypt(i, wrapped, et);
+            if(key.empty() || et == encryption_type::plaintext) return {};
+
+            const auto sealed_size = r.remaining();
+            const auto sealed = r.raw(sealed_size);
+
+            group_secret g{key};
+            return g.decrypt(u::bytes{sealed, sealed + sealed_size});
+        }
+
         u::bytes encrypted_channels::decrypt(const id& i, const u::bytes& bs, encryption_type& et) const
         {
             if(bs.size() < 2) return {};
@@ -120,13 +176,12 @@ namespace fire
                     break;
                 case encryption_type::symmetric: 
                     {
-                        u::mutex_scoped_lock l(_mutex);
                         et = encryption_type::symmetric;
-                        auto s = _s.find(i);
-                        if(s == _s.end()) return {};
-                        if(!s->second.shared_secret.ready()) return {};
+                        auto s = find_channel(i);
+                        if(!s) return {};
+                        if(!s->shared_secret.ready()) return {};
                         u::bytes cb{message_start, bs.end()};
-                        ds = s->second.shared_secret.decrypt(cb);
+                        ds = s->shared_secret.decrypt(cb);
                     }
                     break;
                 case encryption_type::asymmetric: 
@@ -137,6 +192,11 @@ namespace fire
                         ds = _pk.decrypt(cb);
                     }
                     break;
+                case encryption_type::group: 
+                    {
+                        ds = decrypt_group(i, bs, et);
+                    }
+                    break;
                 default: 
                     {
                         et = encryption_type::unknown;
@@ -150,44 +210,49 @@ namespace fire
         {
             REQUIRE(key.valid());
 
-            u::mutex_scoped_lock l(_mutex);
-
-            auto& s = _s[i];
-            if(s.key.valid() && s.key.key() == key.key()) return;
+            auto e = find_channel(i);
+            if(e && e->key.valid() && e->key.key() == key.key()) return;
 
             LOG << "creating pk security channel for: " << i << std::endl;
 
-            s.key = key;
-            s.shared_secret = dh_secret{};
+            //dh key generation is slow, do it outside the lock
+            auto s = std::make_shared<channel>();
+            s->key = key;
+
+            u::mutex_scoped_lock l(_mutex);
+            _s[i] = s;
 
-            ENSURE(s.key.valid());
+            ENSURE(s->key.valid());
         }
 
         void encrypted_channels::create_channel(const id& i, const public_key& key, const util::bytes& public_val)
         {
             REQUIRE(key.valid());
-            u::mutex_scoped_lock l(_mutex);
 
             LOG << "creating pk/dh security channel for: " << i << std::endl;
 
-            auto& s = _s[i];
+            //copy on write so readers holding the old channel are not disturbed
+            auto e = find_channel(i);
+            auto s = e ? std::make_shared<channel>(*e) : std::make_shared<channel>();
 
             //update public key if changed
-            if(!s.key.valid() || s.key.key() != key.key()) s.key = key;
+            if(!s->key.valid() || s->key.key() != key.key()) s->key = key;
+
+            s->shared_secret.create_symmetric_key(public_val);
 
-            s.shared_secret.create_symmetric_key(public_val);
+            u::mutex_scoped_lock l(_mutex);
+            _s[i] = s;
 
-            ENSURE(s.key.valid());
-            ENSURE(s.shared_secret.ready());
+            ENSURE(s->key.valid());
+            ENSURE(s->shared_secret.ready());
         }
 
-        const channel& encrypted_channels::get_channel(const id& i) const
+        channel_ptr encrypted_channels::get_channel(const id& i) const
         {
-            u::mutex_scoped_lock l(_mutex);
-            auto r = _s.find(i);
-            REQUIRE(r != _s.end());
+            auto r = find_channel(i);
+            REQUIRE(r);
 
-            return r->second;
+            return r;
         }
 
         void encrypted_channels::remove_channel(const id& i)
@@ -51,9 +51,12 @@ namespace fire
             public_key key;
         };
 
-        using channel_map = std::unordered_map<id, channel>;
+        //channels are immutable once in the map, updates replace them,
+        //so crypto can run on a channel without holding the map lock
+        using channel_ptr = std::shared_ptr<channel>;
+        using channel_map = std::unordered_map<id, channel_ptr>;
 
-        enum encryption_type { plaintext='P', symmetric='S', asymmetric='A', unknown='U'};
+        enum encryption_type { plaintext='P', symmetric='S', asymmetric='A', group='G', unknown='U'};
 
         class encrypted_channels
         {
@@ -66,17 +69,25 @@ namespace fire
                 util::bytes encrypt_symmetric(const id&, const util::bytes&) const;
                 util::bytes encrypt_plaintext(const util::bytes&) const;
 
+                //wraps the group key for one peer in front of a payload
+                //already encrypted with it. the key is only wrapped with the
+                //peer's symmetric or asymmetric key, never sent as plaintext.
+                //empty if there is no channel to the peer.
+                util::bytes encrypt_group(const id&, const group_secret&, const util::bytes& sealed) const;
+
                 util::bytes decrypt(const id&, const util::bytes&, encryption_type&) const;
 
             public:
                 void create_channel(const id&, const public_key&);
                 void create_channel(const id&, const public_key&, const util::bytes& public_val);
-                const channel& get_channel(const id&) const;
+                channel_ptr get_channel(const id&) const;
                 void remove_channel(const id&);
 
             private:
-                util::bytes encrypt_asymmetric(channel_map::const_iterator, const util::bytes&) const;
-                util::bytes encrypt_symmetric(channel_map::const_iterator, const util::bytes&) const;
+                channel_ptr find_channel(const id&) const;
+                util::bytes encrypt_asymmetric(channel_ptr, const util::bytes&) const;
+                util::bytes encrypt_symmetric(channel_ptr, const util::bytes&) const;
+                util::bytes decrypt_group(const id&, const util::bytes&, encryption_type&) const;
 
             private:
                 channel_map _s;
@@ -336,6 +336,7 @@ namespace fire::user
         //send registration request to greeter
         m::message tcp_gm = gr; tcp_gm.meta.to = {tcp_addr, "outside"};
         m::message udp_gm = gr; udp_gm.meta.to = {udp_addr, "outside"};
+        tcp_gm.meta.priority = udp_gm.meta.priority = m::metadata::control;
         mail()->push_outbox(tcp_gm);
         mail()->push_outbox(udp_gm);
 
@@ -687,6 +688,7 @@ namespace fire::user
 
         m::message m = r;
         m.meta.to = {service, "outside"};
+        m.meta.priority = m::metadata::control;
         mail()->push_outbox(m);
     }
 
@@ -874,8 +876,8 @@ namespace fire::user
         if(!c || (p.state == contact_data::OFFLINE && !force)) return;
         CHECK(c);
 
-        const auto& sc = _encrypted_channels->get_channel(c->address());
-        CHECK(sc.shared_secret.ready());
+        auto sc = _encrypted_channels->get_channel(c->address());
+        CHECK(sc->shared_secret.ready());
 
         if(!by_id(c->id()))
         {
@@ -885,8 +887,9 @@ namespace fire::user
 
         ping r = {c->address(), _user->info().id(), s};
         auto m = convert(r);
-        //ping should always be DH
+        //ping should always be DH and not wait behind app traffic
         m.meta.encryption = m::metadata::encryption_type::symmetric;
+        m.meta.priority = m::metadata::control;
         mail()->push_outbox(m);
     }
 
@@ -930,8 +933,8 @@ namespace fire::user
         {
             u::mutex_scoped_lock l{_ping_mutex};
             _encrypted_channels->create_channel(address, key);
-            const auto& s = _encrypted_channels->get_channel(address);
-            a.public_secret = s.shared_secret.public_value();
+            auto s = _encrypted_channels->get_channel(address);
+            a.public_secret = s->shared_secret.public_value();
         }
 
         //we need to force using PK encryption here because of DH timing
@@ -939,6 +942,7 @@ namespace fire::user
         auto m = a.to_message();
         m.meta.to = {address, SERVICE_ADDRESS};
         m.meta.encryption = m::metadata::encryption_type::asymmetric;
+        m.meta.priority = m::metadata::control;
         mail()->push_outbox(m);
     }
 
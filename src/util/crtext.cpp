@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2017  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#include "util/crtext.hpp"
+#include "util/mencode.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace fire::util
+{
+    namespace
+    {
+        const char INSERT_OP = 'i';
+        const char REMOVE_OP = 'r';
+
+        uint32_t to_seq(uint64_t v)
+        {
+            if(v > UINT32_MAX) throw std::runtime_error{"text op sequence out of range"};
+            return static_cast<uint32_t>(v);
+        }
+
+        const size_t COMPARE_BLOCK = 64; //bytes
+
+        //editors change a little at a time so most of the text matches,
+        //comparing it in blocks first is several times faster 
+        size_t common_prefix(const char* a, const char* b, size_t size)
+        {
+            size_t i = 0;
+            while(i + COMPARE_BLOCK <= size && std::memcmp(a + i, b + i, COMPARE_BLOCK) == 0) i += COMPARE_BLOCK;
+            while(i < size && a[i] == b[i]) i++;
+            return i;
+        }
+
+        //same as common_prefix but from the ends backward
+        size_t common_suffix(const char* a_end, const char* b_end, size_t size)
+        {
+            size_t i = 0;
+            while(i + COMPARE_BLOCK <= size && 
+                    std::memcmp(a_end - i - COMPARE_BLOCK, b_end - i - COMPARE_BLOCK, COMPARE_BLOCK) == 0) i += COMPARE_BLOCK;
+            while(i < size && *(a_end - i - 1) == *(b_end - i - 1)) i++;
+            return i;
+        }
+
+        //a utf8 byte which continues a character
+        bool continues(char c)
+        {
+            return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+        }
+    }
+
+    bytes encode_text_ops(const text_ops& ops)
+    {
+        bytes b;
+        byte_writer w{b};
+        w.varint(ops.size());
+        for(const auto& op : ops)
+        {
+            w.put(op.k == text_op::INSERT ? INSERT_OP : REMOVE_OP);
+            encode_binary(w, op.site);
+            w.varint(op.seq);
+
+            if(op.k == text_op::INSERT)
+            {
+                w.varint(op.stamp);
+                encode_binary(w, op.after_site);
+                w.varint(op.after_seq);
+                encode_binary(w, op.text);
+            }
+            else w.varint(op.size);
+        }
+        return b;
+    }
+
+    text_ops decode_text_ops(const bytes& b)
+    {
+        byte_reader r{b};
+        const auto size = r.varint();
+
+        text_ops ops;
+        for(uint64_t i = 0; i < size; i++)
+        {
+            text_op op;
+            const auto k = r.get();
+            if(k != INSERT_OP && k != REMOVE_OP) throw std::runtime_error{"unknown text op"};
+
+            decode_binary(r, op.site);
+            op.seq = to_seq(r.varint());
+
+            if(k == INSERT_OP)
+            {
+                op.k = text_op::INSERT;
+                op.stamp = r.varint();
+                decode_binary(r, op.after_site);
+                op.after_seq = to_seq(r.varint());
+                decode_binary(r, op.text);
+                to_seq(op.seq + op.text.size());
+            }
+            else
+            {
+                op.k = text_op::REMOVE;
+                op.size = to_seq(r.varint());
+                to_seq(uint64_t{op.seq} + op.size);
+            }
+            ops.emplace_back(std::move(op));
+        }
+        return ops;
+    }
+
+    cr_text::cr_text(const std::string& site)
+    {
+        REQUIRE_FALSE(site.empty());
+        _local = site_index(site);
+    }
+
+    const std::string& cr_text::str() const { return _s; }
+    size_t cr_text::size() const { return _s.size(); }
+    const std::string& cr_text::site() const { return _sites[_local].name; }
+    size_t cr_text::waiting() const { return _waiting.size(); }
+
+    text_ops cr_text::insert(size_t pos, const std::string& s)
+    {
+        if(s.empty()) return {};
+        pos = std::min(pos, _s.size());
+
+        text_op op;
+        op.k = text_op::INSERT;
+        op.site = site();
+        op.seq = _sites[_local].nodes.size();
+        op.stamp = _stamp + 1;
+        op.text = s;
+
+        if(pos > 0)
+        {
+            const auto& a = _n[at(pos - 1)];
+            op.after_site = _sites[a.site].name;
+            op.after_seq = a.seq;
+        }
+
+        const bool done = integrate_insert(op);
+        CHECK(done);
+
+        ENSURE_EQUAL(_s.compare(pos, s.size(), s), 0);
+        return {op};
+    }
+
+    text_ops cr_text::remove(size_t pos, size_t size)
+    {
+        if(pos >= _s.size()) return {};
+        size = std::min(size, _s.size() - pos);
+        if(size == 0) return {};
+
+        //removed characters next to each other in the text are usually a
+        //run from one site, so they are sent as one op
+        text_ops ops;
+        auto n = at(pos);
+        for(size_t left = size; left > 0; n = next(n))
+        {
+            CHECK_NOT_EQUAL(n, NONE);
+            if(_n[n].removed) continue;
+
+            const auto& c = _n[n];
+            if(!ops.empty() && ops.back().site == _sites[c.site].name && ops.back().seq + ops.back().size == c.seq)
+                ops.back().size++;
+            else ops.emplace_back(make_remove(n));
+
+            mark_removed(n);
+            left--;
+        }
+
+        _s.erase(pos, size);
+        return ops;
+    }
+
+    text_ops cr_text::set(const std::string& s)
+    {
+        const auto most = std::min(_s.size(), s.size());
+
+        auto prefix = common_prefix(_s.data(), s.data(), most);
+        auto suffix = common_suffix(_s.data() + _s.size(), s.data() + s.size(), most - prefix);
+
+        //don't split a utf8 character between an op and the text around it
+        while(prefix > 0 && 
+                ((prefix < _s.size() && continues(_s[prefix])) || 
+                 (prefix < s.size() && continues(s[prefix])))) prefix--;
+        while(suffix > 0 && continues(s[s.size() - suffix])) suffix--;
+
+        auto ops = remove(prefix, _s.size() - prefix - suffix);
+        auto ins = insert(prefix, s.substr(prefix, s.size() - prefix - suffix));
+        ops.insert(ops.end(), ins.begin(), ins.end());
+
+        ENSURE_EQUAL(_s, s);
+        return ops;
+    }
+
+    bool cr_text::apply(const text_ops& ops)
+    {
+        const auto size = _s.size();
+        const auto nodes = _n.size();
+
+        for(auto op : ops) 
+            if(!integrate(op)) _waiting.emplace_back(std::move(op));
+
+        //only inserts let waiting ops go, so retry them until nothing is inserted
+        auto inserted = nodes != _n.size();
+        while(inserted && !_waiting.empty())
+        {
+            const auto before = _n.size();
+
+            text_ops waiting;
+            waiting.swap(_waiting);
+            for(auto& op : waiting) 
+                if(!integrate(op)) _waiting.emplace_back(std::move(op));
+
+            inserted = before != _n.size();
+        }
+
+        //inserts add characters and removes shrink the text
+        return nodes != _n.size() || size != _s.size();
+    }
+
+    text_ops cr_text::state() const
+    {
+        //runs are found in text order then sorted by stamp, which puts a run
+        //after the run holding its parent and after the runs from its own site 
+        //with lower sequence numbers, so nothing waits when they are applied
+        text_ops ops;
+        text_ops removes;
+        index prev = NONE;
+        for(auto n = first(); n != NONE; prev = n, n = next(n))
+        {
+            const auto& c = _n[n];
+            const auto& site = _sites[c.site].name;
+
+            auto* run = ops.empty() ? nullptr : &ops.back();
+            if(run && prev == c.parent && run->site == site && 
+                    run->seq + run->text.size() == c.seq &&
+                    run->stamp + run->text.size() == c.stamp)
+                run->text.push_back(c.c);
+            else
+            {
+                text_op op;
+                op.k = text_op::INSERT;
+                op.site = site;
+                op.seq = c.seq;
+                op.stamp = c.stamp;
+                if(c.parent != NONE)
+                {
+                    const auto& p = _n[c.parent];
+                    op.after_site = _sites[p.site].name;
+                    op.after_seq = p.seq;
+                }
+                op.text.push_back(c.c);
+                ops.emplace_back(std::move(op));
+            }
+
+            if(!c.removed) continue;
+
+            if(!removes.empty() && removes.back().site == site && removes.back().seq + removes.back().size == c.seq)
+                removes.back().size++;
+            else removes.emplace_back(make_remove(n));
+        }
+
+        std::stable_sort(ops.begin(), ops.end(), 
+                [](const text_op& a, const text_op& b) { return a.stamp < b.stamp;});
+
+        ops.insert(ops.end(), removes.begin(), removes.end());
+        return ops;
+    }
+
+    bool cr_text::integrate(text_op& op)
+    {
+        return op.k == text_op::INSERT ? integrate_insert(op) : integrate_remove(op);
+    }
+
+    bool cr_text::integrate_insert(const text_op& op)
+    {
+        const auto s = site_index(op.site);
+        auto& nodes = _sites[s].nodes;
+
+        //an earlier op from the site has not arrived yet
+        if(op.seq > nodes.size()) return false;
+
+        //characters already applied are skipped
+        const auto have = nodes.size() - op.seq;
+        if(have >= op.text.size()) return true;
+
+        auto parent = NONE;
+        if(have > 0) parent = nodes.back();
+        else if(!op.after_site.empty())
+        {
+            parent = find(op.after_site, op.after_seq);
+            if(parent == NONE) return false;
+        }
+
+        const auto stamp = op.stamp + have;
+        _stamp = std::max(_stamp, op.stamp + op.text.size() - 1);
+
+        //the run goes after its parent and after any characters there with a
+        //larger stamp, which were inserted concurrently or later. the rest of
+        //the run follows its first character since each one is the parent of
+        //the next and has a larger stamp than anything skipped.
+        auto place = parent == NONE ? first() : next(parent);
+        while(place != NONE && before(place, stamp, s)) place = next(place);
+
+        const auto pos = place == NONE ? _n.size() : rank(place);
+        const auto text_pos = place == NONE ? _s.size() : visible_rank(place);
+
+        index run = NONE;
+        for(size_t i = have; i < op.text.size(); i++)
+        {
+            const index n = _n.size();
+
+            _rand ^= _rand << 13; _rand ^= _rand >> 17; _rand ^= _rand << 5;
+            _n.push_back({stamp + i - have, s, static_cast<index>(op.seq + i), parent, 
+                    NONE, NONE, NONE, 1, 1, _rand, op.text[i], false});
+
+            nodes.push_back(n);
+            run = merge(run, n);
+            parent = n;
+        }
+
+        index l, r;
+        split(_root, pos, l, r);
+        _root = merge(merge(l, run), r);
+        _n[_root].up = NONE;
+
+        _s.insert(text_pos, op.text, have, std::string::npos);
+        return true;
+    }
+
+    bool cr_text::integrate_remove(text_op& op)
+    {
+        const auto s = find(op.site, op.seq);
+        if(s == NONE) return false;
+
+        const auto& nodes = _sites[_n[s].site].nodes;
+        const auto end = op.seq + op.size;
+        const auto have = std::min<size_t>(end, nodes.size());
+
+        //characters next to each other are erased from the string together
+        size_t at = 0;
+        size_t size = 0;
+        for(auto q = op.seq; q < have; q++)
+        {
+            const auto n = nodes[q];
+            if(_n[n].removed) continue;
+
+            const auto p = visible_rank(n);
+            mark_removed(n);
+
+            if(size > 0 && p == at) { size++; continue;}
+            if(size > 0) _s.erase(at, size);
+            at = p;
+            size = 1;
+        }
+        if(size > 0) _s.erase(at, size);
+
+        //the rest waits for its characters
+        if(have == end) return true;
+
+        op.size = end - have;
+        op.seq = have;
+        return false;
+    }
+
+    cr_text::index cr_text::site_index(const std::string& name)
+    {
+        auto s = _site_ids.find(name);
+        if(s != _site_ids.end()) return s->second;
+
+        const index i = _sites.size();
+        _sites.push_back({name, {}});
+        _site_ids[name] = i;
+        return i;
+    }
+
+    cr_text::index cr_text::find(const std::string& site, uint32_t seq) const
+    {
+        auto s = _site_ids.find(site);
+        if(s == _site_ids.end()) return NONE;
+
+        const auto& nodes = _sites[s->second].nodes;
+        return seq < nodes.size() ? nodes[seq] : NONE;
+    }
+
+    //characters with a larger stamp, ties broken by site, come first
+    bool cr_text::before(index n, uint64_t stamp, index site) const
+    {
+        const auto& c = _n[n];
+        if(c.stamp != stamp) return c.stamp > stamp;
+        return _sites[c.site].name > _sites[site].name;
+    }
+
+    text_op cr_text::make_remove(index n) const
+    {
+        text_op op;
+        op.k = text_op::REMOVE;
+        op.site = _sites[_n[n].site].name;
+        op.seq = _n[n].seq;
+        op.size = 1;
+        return op;
+    }
+
+    cr_text::index cr_text::first() const
+    {
+        auto n = _root;
+        if(n == NONE) return NONE;
+        while(_n[n].left != NONE) n = _n[n].left;
+        return n;
+    }
+
+    cr_text::index cr_text::next(index n) const
+    {
+        REQUIRE_NOT_EQUAL(n, NONE);
+        if(_n[n].right != NONE)
+        {
+            n = _n[n].right;
+            while(_n[n].left != NONE) n = _n[n].left;
+            return n;
+        }
+
+        auto u = _n[n].up;
+        while(u != NONE && _n[u].right == n) { n = u; u = _n[u].up; }
+        return u;
+    }
+
+    //the node of the character at the position in the text
+    cr_text::index cr_text::at(size_t p) const
+    {
+        REQUIRE_LESS(p, _s.size());
+
+        auto n = _root;
+        while(n != NONE)
+        {
+            const auto l = _n[n].left;
+            const size_t lv = l == NONE ? 0 : _n[l].visible;
+            if(p < lv) { n = l; continue;}
+
+            p -= lv;
+            if(!_n[n].removed) 
+            {
+                if(p == 0) return n;
+                p--;
+            }
+            n = _n[n].right;
+        }
+
+        CHECK(false && "position past the end");
+        return NONE;
+    }
+
+    //nodes before this one, removed ones included
+    size_t cr_text::rank(index n) const
+    {
+        const auto l = _n[n].left;
+        size_t r = l == NONE ? 0 : _n[l].size;
+        for(auto u = _n[n].up; u != NONE; n = u, u = _n[u].up)
+        {
+            if(_n[u].right != n) continue;
+            const auto ul = _n[u].left;
+            r += (ul == NONE ? 0 : _n[ul].size) + 1;
+        }
+        return r;
+    }
+
+    //position in the text of this node or the next one not removed
+    size_t cr_text::visible_rank(index n) const
+    {
+        const auto l = _n[n].left;
+        size_t r = l == NONE ? 0 : _n[l].visible;
+        for(auto u = _n[n].up; u != NONE; n = u, u = _n[u].up)
+        {
+            if(_n[u].right != n) continue;
+            const auto ul = _n[u].left;
+            r += (ul == NONE ? 0 : _n[ul].visible) + (_n[u].removed ? 0 : 1);
+        }
+        return r;
+    }
+
+    void cr_text::mark_removed(index n)
+    {
+        REQUIRE_FALSE(_n[n].removed);
+        _n[n].removed = true;
+        for(; n != NONE; n = _n[n].up) _n[n].visible--;
+    }
+
+    cr_text::index cr_text::merge(index a, index b)
+    {
+        if(a == NONE) return b;
+        if(b == NONE) return a;
+
+        if(_n[a].priority > _n[b].priority)
+        {
+            _n[a].right = merge(_n[a].right, b);
+            pull(a);
+            return a;
+        }
+
+        _n[b].left = merge(a, _n[b].left);
+        pull(b);
+        return b;
+    }
+
+    //splits the tree so the first count nodes are on the left
+    void cr_text::split(index t, size_t count, index& l, index& r)
+    {
+        if(t == NONE) { l = r = NONE; return;}
+
+        const auto tl = _n[t].left;
+        const size_t ls = tl == NONE ? 0 : _n[tl].size;
+        if(count <= ls)
+        {
+            split(tl, count, l, _n[t].left);
+            r = t;
+        }
+        else
+        {
+            split(_n[t].right, count - ls - 1, _n[t].right, r);
+            l = t;
+        }
+        pull(t);
+        if(l != NONE) _n[l].up = NONE;
+        if(r != NONE) _n[r].up = NONE;
+    }
+
+    void cr_text::pull(index n)
+    {
+        auto& c = _n[n];
+        c.size = 1;
+        c.visible = c.removed ? 0 : 1;
+        for(auto k : {c.left, c.right})
+        {
+            if(k == NONE) continue;
+            c.size += _n[k].size;
+            c.visible += _n[k].visible;
+            _n[k].up = n;
+        }
+    }
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2017  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+#pragma once
+
+#include "util/bytes.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace fire::util
+{
+    /**
+     * An insert or remove of a run of characters. Each character is named
+     * by the site which inserted it and a sequence number counting up from
+     * zero at that site, so a run is a range of sequence numbers.
+     */
+    struct text_op
+    {
+        enum kind { INSERT, REMOVE};
+
+        kind k = INSERT;
+        std::string site;
+        uint32_t seq = 0;
+
+        //insert, the lamport stamp of the first character, the character
+        //the run goes after and the run. an empty after_site is the start
+        //of the text.
+        uint64_t stamp = 0;
+        std::string after_site;
+        uint32_t after_seq = 0;
+        std::string text;
+
+        //remove, number of characters
+        uint32_t size = 0;
+    };
+    using text_ops = std::vector<text_op>;
+
+    bytes encode_text_ops(const text_ops&);
+    text_ops decode_text_ops(const bytes&);
+
+    /**
+     * Implements a concurrent string which sends insert and remove operations 
+     * instead of the whole string (RGA). Operations can be applied in any order
+     * and more than once, replicas which applied the same operations have the
+     * same text. An operation which refers to characters not seen yet waits
+     * until they arrive.
+     *
+     * Characters are kept in a tree ordered by position, removed ones included,
+     * so finding a position or placing an operation is O(log n).
+     */
+    class cr_text
+    {
+        public:
+            cr_text(const std::string& site);
+
+        public:
+            const std::string& str() const;
+            size_t size() const;
+            const std::string& site() const;
+
+            /**
+             * Local edits return the operations to send to other replicas
+             */
+            text_ops insert(size_t pos, const std::string&);
+            text_ops remove(size_t pos, size_t size);
+
+            /**
+             * Changes the text to the string given by replacing what is 
+             * between the common prefix and suffix
+             */
+            text_ops set(const std::string&);
+
+            /**
+             * Applies operations from other replicas.
+             * @return true if the text changed
+             */
+            bool apply(const text_ops&);
+
+            /**
+             * Operations which build this text from nothing, 
+             * removed characters included
+             */
+            text_ops state() const;
+
+            /**
+             * Operations waiting for characters which have not arrived
+             */
+            size_t waiting() const;
+
+        private:
+            using index = uint32_t;
+            static constexpr index NONE = UINT32_MAX;
+
+            struct node
+            {
+                uint64_t stamp;
+                index site;
+                index seq;
+                index parent; //character inserted after, NONE is the start
+                index left, right, up;
+                index size; //nodes in the subtree
+                index visible; //nodes in the subtree not removed
+                uint32_t priority;
+                char c;
+                bool removed;
+            };
+
+            struct site_nodes
+            {
+                std::string name;
+                std::vector<index> nodes; //by sequence number
+            };
+
+        private:
+            bool integrate(text_op&);
+            bool integrate_insert(const text_op&);
+            bool integrate_remove(text_op&);
+
+            index site_index(const std::string&);
+            index find(const std::string& site, uint32_t seq) const;
+            bool before(index n, uint64_t stamp, index site) const;
+            text_op make_remove(index n) const;
+
+            index first() const;
+            index next(index) const;
+            index at(size_t visible_pos) const;
+            size_t rank(index) const;
+            size_t visible_rank(index) const;
+            void mark_removed(index);
+
+            index merge(index, index);
+            void split(index, size_t, index&, index&);
+            void pull(index);
+
+        private:
+            std::string _s;
+            std::vector<node> _n;
+            std::vector<site_nodes> _sites;
+            std::unordered_map<std::string, index> _site_ids;
+            index _local;
+            index _root = NONE;
+            uint64_t _stamp = 0;
+            uint32_t _rand = 2463534242;
+            text_ops _waiting;
+    };
+}
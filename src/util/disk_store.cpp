@@ -33,21 +33,54 @@
 
 #include "util/dbc.hpp"
 #include "util/log.hpp"
-#include "util/uuid.hpp"
 #include "util/filesystem.hpp"
+#include "util/thread.hpp"
 
+#include <chrono>
+#include <cstdio>
+#include <limits>
 #include <stdexcept>
-#include <set>
+#include <unordered_map>
+#include <vector>
 
+#ifdef _WIN64
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <boost/crc.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 namespace bf = boost::filesystem;
+namespace bi = boost::interprocess;
 
 namespace fire::util
 {
     namespace 
     {
+        const std::string LOG_FILE = "log";
         const std::string INDEX = "index";
+        const std::string TMP_SUFFIX = ".tmp";
+        const char SET_RECORD = 's';
+        const char REMOVE_RECORD = 'r';
+        const size_t CRC_SIZE = 4; //bytes
+        const size_t FLUSH_SIZE = 64 * 1024; //bytes buffered before writing to the file
+        const size_t COMMIT_INTERVAL = 50; //milliseconds writes wait to share an fsync
+        const size_t WRITE_BEHIND_SIZE = 1024; //keys buffered before the commit thread is woken early
+        const uint64_t MIN_COMPACT_SIZE = 1024 * 1024; //bytes of dead records before compacting
+        const uint64_t BEHIND = std::numeric_limits<uint64_t>::max(); //offset of a value still in the write behind buffer
+        const log_entry BEHIND_ENTRY{BEHIND, 0, 0};
+    }
+
+    std::string get_log_file(const std::string& dir)
+    {
+        bf::path p = dir;
+
+        p /= LOG_FILE;
+        return p.string();
     }
 
     std::string get_index_file(const std::string& dir)
@@ -66,246 +99,1039 @@ namespace fire::util
         return p.string();
     }
 
-    disk_store::disk_store() 
+    uint32_t crc(const char* p, size_t n)
+    {
+        boost::crc_32_type c;
+        c.process_bytes(p, n);
+        return c.checksum();
+    }
+
+    void put_crc(bytes& b, uint32_t c)
     {
-        _mutex = std::make_shared<std::mutex>();
-        _index = std::make_shared<dict>();
+        for(size_t i = 0; i < CRC_SIZE; i++) b.push_back(static_cast<char>((c >> (i * 8)) & 0xFF));
+    }
 
-        ENSURE(_path.empty());
-        ENSURE(_mutex);
-        ENSURE(_index);
+    uint32_t get_crc(const char* p)
+    {
+        uint32_t c = 0;
+        for(size_t i = 0; i < CRC_SIZE; i++) c |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (i * 8);
+        return c;
     }
 
-    disk_store::disk_store(const std::string& path) 
+    void sync_file(FILE* f)
     {
-        _mutex = std::make_shared<std::mutex>();
-        _index = std::make_shared<dict>();
+        REQUIRE(f);
+#ifdef _WIN64
+        _commit(_fileno(f));
+#else
+        fsync(fileno(f));
+#endif
+    }
 
-        REQUIRE_FALSE(path.empty());
-        CHECK(_path.empty());
+    FILE* open_append(const std::string& file)
+    {
+        auto f = std::fopen(file.c_str(), "ab");
+        if(!f) throw std::runtime_error{"unable to open `" + file + "'"};
+        return f;
+    }
 
-        load(path);
+    void write_file(FILE* f, const char* b, size_t size)
+    {
+        REQUIRE(f);
+        if(size == 0) return;
 
-        ENSURE_FALSE(_path.empty());
-        ENSURE(_mutex);
-        ENSURE(_index);
+        if(std::fwrite(b, 1, size, f) != size || std::fflush(f) != 0)
+            throw std::runtime_error{"unable to write to store log"};
     }
 
-    disk_store::disk_store(const disk_store& o) 
+    /**
+     * Builds one record, the size and crc of the body then the body.
+     * The body is one or more writes, each an op, the key and for sets
+     * the value in binary mencode. A record is all there or not at all
+     * after a crash, so writes in one record are applied together.
+     */
+    class record_writer
+    {
+        public:
+            void set(const std::string& key, const value& v, log_entry& e)
+            {
+                start(SET_RECORD, key);
+                const auto at = _body.size();
+                byte_writer w{_body};
+                encode_binary(w, v);
+                add(at, e);
+            }
+
+            //value already in binary mencode
+            void set(const std::string& key, const char* v, size_t size, log_entry& e)
+            {
+                start(SET_RECORD, key);
+                const auto at = _body.size();
+                _body.insert(_body.end(), v, v + size);
+                add(at, e);
+            }
+
+            void remove(const std::string& key, log_entry& e)
+            {
+                start(REMOVE_RECORD, key);
+                add(_body.size(), e);
+            }
+
+            bool empty() const { return _body.empty(); }
+
+            //writes the record to the end of out, which is at the
+            //offset given in the log, and points the entries at it
+            void finish(bytes& out, uint64_t at)
+            {
+                REQUIRE_FALSE(_body.empty());
+
+                const auto start = out.size();
+                byte_writer h{out};
+                h.varint(_body.size());
+                put_crc(out, crc(_body.data(), _body.size()));
+                const auto head = out.size() - start;
+                out.insert(out.end(), _body.begin(), _body.end());
+
+                for(auto e : _entries) e->offset += at + start + head;
+
+                //the head is counted with the first write so dead bytes add up
+                _entries.front()->record += head;
+
+                _body.clear();
+                _entries.clear();
+            }
+
+        private:
+            void start(char op, const std::string& key)
+            {
+                _write_at = _body.size();
+                byte_writer w{_body};
+                w.put(op);
+                w.varint(key.size());
+                w.raw(key.data(), key.size());
+            }
+
+            void add(size_t value_at, log_entry& e)
+            {
+                e.offset = value_at;
+                e.size = _body.size() - value_at;
+                e.record = _body.size() - _write_at;
+                _entries.push_back(&e);
+            }
+
+        private:
+            bytes _body;
+            size_t _write_at = 0;
+            std::vector<log_entry*> _entries;
+    };
+
+    /**
+     * The log behind a disk_store. Writes are buffered and written
+     * together, a background thread fsyncs them at most every
+     * COMMIT_INTERVAL without holding the store lock and compacts the
+     * log once most of it is dead. In write behind mode sets only go
+     * into memory and the background thread encodes and writes them.
+     * Values already in the file are read through a memory map.
+     */
+    class disk_log
     {
-        REQUIRE(o._mutex);
-        REQUIRE(o._index);
+        public:
+            disk_log();
+            ~disk_log();
+
+        public:
+            void open(const std::string& dir);
+            bool is_open();
+
+            void get(const std::string& key, value&);
+            bool has(const std::string& key);
+            void set(const std::string& key, const value&);
+            void set(const dict&);
+            bool remove(const std::string& key);
+            void apply(const store_batch&);
+            void clear();
+            void export_to(dict&);
+
+            void write_behind(bool);
+            void sync();
+            void compact();
+
+            const log_index& index() const;
+
+        private:
+            using lock = std::unique_lock<std::mutex>;
+
+            void close(lock&);
+            void migrate();
+            void recover();
+            void index_write(char op, const std::string& key, const log_entry&);
+            void retire(const log_entry&);
+            void behind_set(const std::string& key, const value&);
+            bool behind_remove(const std::string& key);
+            bool find_behind(const std::string& key, value&) const;
+            void append(record_writer&);
+            void read(const log_entry&, value&);
+            const char* map(uint64_t end);
+            void unmap();
+            void write_pending();
+            void drain(lock&, bool release);
+            void commit();
+            bool should_compact() const;
+            void compact_intern(lock&);
+            void rewrite(const bytes&);
+            FILE* write_side(const bytes&);
+            void replace(FILE* side, uint64_t size);
+            void wait_idle(lock&);
+            void commit_thread();
+
+        private:
+            std::string _dir;
+            std::string _file;
+            FILE* _out = nullptr;
+            log_index _index;
+
+            uint64_t _flushed = 0; //bytes in the file
+            bytes _pending; //appended but not written to the file yet
+            bool _dirty = false; //written but not fsynced
+            uint64_t _dead = 0; //bytes of overwritten and removed records
+
+            bool _write_behind = false;
+            store_batch _behind; //sets and removes not encoded yet
+            store_batch _draining; //being encoded by the commit thread
+            bool _compacting = false; //compaction is writing the new log without the lock
 
-        mutex_scoped_lock l(*o._mutex);
+            std::unique_ptr<bi::file_mapping> _mapping;
+            std::unique_ptr<bi::mapped_region> _region;
 
-        _path = o._path;
-        _index = o._index;
-        _mutex = o._mutex;
+            std::mutex _mutex;
+            std::mutex _sync_mutex; //held while fsyncing without _mutex
+            std::condition_variable _wake;
+            std::condition_variable _drained; //signaled when draining or compacting finishes
+            bool _done = false;
+            thread_uptr _committer;
+    };
 
-        ENSURE(_mutex);
-        ENSURE(_index);
+    disk_log::disk_log() {}
+
+    disk_log::~disk_log()
+    {
+        {
+            lock l(_mutex);
+            _done = true;
+        }
+        _wake.notify_one();
+        if(_committer) _committer->join();
+
+        try
+        {
+            lock l(_mutex);
+            close(l);
+        }
+        catch(std::exception& e)
+        {
+            LOG << "error closing store `" << _dir << "': " << e.what() << std::endl;
+        }
     }
 
-    disk_store& disk_store::operator=(const disk_store& o)
+    void disk_log::open(const std::string& dir)
     {
-        INVARIANT(_mutex);
-        INVARIANT(_index);
-        REQUIRE(o._mutex);
-        REQUIRE(o._index);
+        REQUIRE_FALSE(dir.empty());
 
-        if(this == &o) return *this;
-        if(_mutex == o._mutex) return *this;
+        lock l(_mutex);
+
+        if(!bf::exists(dir)) 
+            throw std::runtime_error{"path `" + dir + "' does not exist."};
+
+        close(l);
+
+        LOG << "loading store `" << dir << "'" << std::endl;
+        _dir = dir;
+        _file = get_log_file(dir);
+
+        if(bf::exists(get_index_file(dir))) migrate();
+
+        recover();
+        _out = open_append(_file);
+
+        if(!_committer) _committer.reset(new std::thread{&disk_log::commit_thread, this});
+
+        ENSURE(_out);
+        ENSURE(_committer);
+    }
+
+    bool disk_log::is_open()
+    {
+        lock l(_mutex);
+        return !_dir.empty();
+    }
+
+    void disk_log::close(lock& l)
+    {
+        if(!_out) return;
+
+        drain(l, false);
+        commit();
 
-        CHECK(_index != _index);
-        mutex_scoped_lock l(*o._mutex);
         {
-            mutex_scoped_lock l(*_mutex);
-            _path = o._path;
-            _index = o._index;
+            mutex_scoped_lock s(_sync_mutex);
+            std::fclose(_out);
+            _out = nullptr;
         }
-        _mutex = o._mutex;
+        unmap();
 
-        ENSURE(_mutex);
-        ENSURE(_index);
-        return *this;
+        _index.clear();
+        _flushed = 0;
+        _dead = 0;
+        _dir.clear();
+        _file.clear();
+
+        ENSURE(_pending.empty());
+        ENSURE(_behind.empty());
     }
 
-    void disk_store::load(const std::string& path) 
+    //moves a store from the old layout, an index of keys to files
+    //with one value each, into a log
+    void disk_log::migrate()
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        REQUIRE_FALSE(path.empty());
+        REQUIRE_FALSE(_dir.empty());
+        REQUIRE_FALSE(_out);
 
-        mutex_scoped_lock l(*_mutex);
+        const auto index_file = get_index_file(_dir);
 
-        if(!bf::exists(path)) 
-            throw std::runtime_error{"path `" + path + "' does not exist."};
+        dict index;
+        load_from_file(index_file, index);
+
+        //a log next to the index means the move finished but the
+        //old files were not all removed
+        if(!bf::exists(_file))
+        {
+            LOG << "moving store `" << _dir << "' with " << index.size() << " values into a log" << std::endl;
 
-        LOG << "loading store `" << path << "'" << std::endl;
-        _path = path;
-        load_from_file(get_index_file(path), *_index);
+            bytes out;
+            record_writer w;
+            log_entry e;
+            for(const auto& p : index)
+            {
+                value v;
+                load_from_file(get_value_file(_dir, p.second.as_string()), v);
 
-        ENSURE_FALSE(_path.empty());
+                w.set(p.first, v, e);
+                w.finish(out, 0);
+            }
+
+            rewrite(out);
+        }
+
+        for(const auto& p : index)
+            delete_file(get_value_file(_dir, p.second.as_string()));
+        delete_file(index_file);
     }
 
-    bool disk_store::loaded() const
+    //rebuilds the index from the log. a record that is cut short or
+    //fails its crc ends the log, it was a write that never finished.
+    void disk_log::recover()
     {
-        INVARIANT(_mutex);
+        REQUIRE_FALSE(_file.empty());
+        REQUIRE(_index.empty());
+
+        if(!bf::exists(_file)) return;
+
+        const auto size = bf::file_size(_file);
+        if(size == 0) return;
+
+        _flushed = size;
+        const auto base = map(size);
+
+        uint64_t good = 0;
+        try
+        {
+            byte_reader r{base, base + size};
+            while(!r.done())
+            {
+                const auto start = r.offset();
+                const auto body_size = r.varint();
+                const auto sum = get_crc(r.raw(CRC_SIZE));
+                const auto head = r.offset() - start;
+                const auto body = r.raw(body_size);
+                if(crc(body, body_size) != sum) break;
 
-        mutex_scoped_lock l(*_mutex);
-        return !_path.empty();
+                byte_reader b{body, body + body_size};
+                bool first = true;
+                while(!b.done())
+                {
+                    const auto write_at = b.offset();
+                    const auto op = b.get();
+                    const auto key_size = b.varint();
+                    const std::string key{b.raw(key_size), key_size};
+
+                    const auto value_at = b.offset();
+                    if(op == SET_RECORD) skip_binary(b);
+
+                    log_entry e;
+                    e.offset = (body - base) + value_at;
+                    e.size = b.offset() - value_at;
+                    e.record = b.offset() - write_at + (first ? head : 0);
+                    first = false;
+
+                    index_write(op, key, e);
+                }
+
+                good = r.offset();
+            }
+        }
+        catch(std::exception& e)
+        {
+            LOG << "store `" << _dir << "' ends in a partial record: " << e.what() << std::endl;
+        }
+
+        if(good < size)
+        {
+            LOG << "truncating store `" << _dir << "' from " << size << " to " << good << " bytes" << std::endl;
+            unmap();
+            bf::resize_file(_file, good);
+            _flushed = good;
+        }
     }
 
-    value disk_store::get(const std::string& key) const
+    //the entry no longer holds the key's value
+    void disk_log::retire(const log_entry& e)
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
+        if(e.offset != BEHIND) _dead += e.record;
+    }
 
-        mutex_scoped_lock l(*_mutex);
-        INVARIANT_FALSE(_path.empty());
+    void disk_log::index_write(char op, const std::string& key, const log_entry& e)
+    {
+        auto i = _index.find(key);
+        if(i != _index.end()) retire(i->second);
 
-        value v;
-        get_value(key, v);
+        if(op == SET_RECORD) 
+        {
+            if(i != _index.end()) i->second = e;
+            else _index.emplace(key, e);
+            return;
+        }
 
-        return v;
+        _dead += e.record;
+        if(i != _index.end()) _index.erase(i);
     }
 
-    void disk_store::get_value(const std::string& key, value& v) const
+    void disk_log::behind_set(const std::string& key, const value& v)
     {
-        INVARIANT(_index);
-        auto id = (*_index)[key].as_string();
-        load_from_file(get_value_file(_path, id), v);
+        auto& w = _behind[key];
+        w.v = v;
+        w.removed = false;
+
+        auto i = _index.find(key);
+        if(i != _index.end()) 
+        {
+            retire(i->second);
+            i->second = BEHIND_ENTRY;
+        }
+        else _index.emplace(key, BEHIND_ENTRY);
     }
 
-    bool disk_store::has(const std::string& key) const
+    bool disk_log::behind_remove(const std::string& key)
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        auto i = _index.find(key);
+        if(i == _index.end()) return false;
+
+        retire(i->second);
+        _index.erase(i);
 
-        return _index->has(key);
+        auto& w = _behind[key];
+        w.v = value{};
+        w.removed = true;
+        return true;
     }
-    void disk_store::set(const std::string& key, const value& v)
+
+    bool disk_log::find_behind(const std::string& key, value& v) const
+    {
+        for(const auto b : {&_behind, &_draining})
+        {
+            auto w = b->find(key);
+            if(w == b->end()) continue;
+
+            if(!w->second.removed) v = w->second.v;
+            return true;
+        }
+        return false;
+    }
+
+    const char* disk_log::map(uint64_t end)
+    {
+        REQUIRE_LESS_EQUAL(end, _flushed);
+
+        if(_region && _region->get_size() >= end) 
+            return static_cast<const char*>(_region->get_address());
+
+        //the file grew past the old mapping, map all of it
+        unmap();
+        _mapping.reset(new bi::file_mapping{_file.c_str(), bi::read_only});
+        _region.reset(new bi::mapped_region{*_mapping, bi::read_only, 0, static_cast<size_t>(_flushed)});
+
+        ENSURE(_region);
+        ENSURE_GREATER_EQUAL(_region->get_size(), end);
+        return static_cast<const char*>(_region->get_address());
+    }
+
+    void disk_log::unmap()
+    {
+        _region.reset();
+        _mapping.reset();
+    }
+
+    void disk_log::read(const log_entry& e, value& v)
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        REQUIRE_NOT_EQUAL(e.offset, BEHIND);
+
+        //records are written to the file whole, so a value is either
+        //all in the file or all still pending
+        const char* p = e.offset >= _flushed ?
+            _pending.data() + (e.offset - _flushed) :
+            map(e.offset + e.size) + e.offset;
 
-        set_intern(key, v);
-        save_index();
+        byte_reader r{p, p + e.size};
+        decode_binary(r, v);
     }
 
-    void disk_store::set_intern(const std::string& key, const value& v)
+    void disk_log::append(record_writer& w)
     {
-        INVARIANT(_index);
+        REQUIRE(_out);
+        REQUIRE_FALSE(w.empty());
+
+        w.finish(_pending, _flushed);
+        if(_pending.size() >= FLUSH_SIZE) write_pending();
 
-        std::string id;
-        if(_index->has(key)) id = (*_index)[key].as_string();
-        else 
+        //first write since the last commit starts the clock on the next one
+        if(!_dirty)
         {
-            id = uuid();
-            (*_index)[key] = id;
+            _dirty = true;
+            _wake.notify_one();
         }
+    }
 
-        CHECK_FALSE(id.empty());
+    void disk_log::write_pending()
+    {
+        if(_pending.empty()) return;
+        REQUIRE(_out);
 
-        save_to_file(get_value_file(_path, id), v);
+        write_file(_out, _pending.data(), _pending.size());
+        _flushed += _pending.size();
+        _pending.clear();
     }
 
-    bool disk_store::remove(const std::string& key)
+    //encodes the write behind buffer into one record. the commit thread
+    //releases the lock while it encodes so writers can keep going, 
+    //everyone else first waits for it to finish.
+    void disk_log::drain(lock& l, bool release)
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        wait_idle(l);
+        if(_behind.empty() || !_out) return;
+
+        _draining.swap(_behind);
+
+        std::vector<log_entry> es(_draining.size());
+        record_writer w;
+        {
+            if(release) l.unlock();
+
+            size_t n = 0;
+            for(const auto& p : _draining)
+                if(p.second.removed) w.remove(p.first, es[n++]);
+                else w.set(p.first, p.second.v, es[n++]);
 
-        return remove_intern(key);
+            if(release) l.lock();
+        }
+
+        append(w);
+
+        //point the index at the record unless something newer came in
+        size_t n = 0;
+        for(const auto& p : _draining)
+        {
+            const auto& e = es[n++];
+            auto i = _index.find(p.first);
+            const bool current = 
+                !p.second.removed && 
+                i != _index.end() && 
+                i->second.offset == BEHIND && 
+                !_behind.count(p.first);
+
+            if(current) i->second = e;
+            else _dead += e.record;
+        }
+
+        _draining.clear();
+        _drained.notify_all();
     }
 
-    bool disk_store::remove_intern(const std::string& key)
+    //waits for the commit thread to finish work it does without the lock
+    void disk_log::wait_idle(lock& l)
     {
-        INVARIANT(_index);
+        _drained.wait(l, [this]() { return _draining.empty() && !_compacting; });
+    }
 
-        if(!_index->has(key)) return false;
+    void disk_log::commit()
+    {
+        if(!_out) return;
 
-        //remove data
-        const auto id = (*_index)[key].as_string();
-        delete_file(get_value_file(_path, id));
+        write_pending();
 
-        //remove from index
-        _index->remove(key);
+        //the commit thread clears _dirty before its fsync, so wait that
+        //one out. it covers everything written before it started.
+        mutex_scoped_lock s(_sync_mutex);
+        if(_dirty) sync_file(_out);
+        _dirty = false;
+    }
 
-        save_index();
+    void disk_log::get(const std::string& key, value& v)
+    {
+        lock l(_mutex);
+        INVARIANT_FALSE(_dir.empty());
+
+        auto i = _index.find(key);
+        if(i == _index.end()) return;
+
+        if(i->second.offset == BEHIND) find_behind(key, v);
+        else read(i->second, v);
+    }
+
+    bool disk_log::has(const std::string& key)
+    {
+        lock l(_mutex);
+        return _index.count(key);
+    }
+
+    void disk_log::set(const std::string& key, const value& v)
+    {
+        lock l(_mutex);
+        INVARIANT_FALSE(_dir.empty());
+
+        if(_write_behind) 
+        {
+            behind_set(key, v);
+            if(_behind.size() >= WRITE_BEHIND_SIZE) _wake.notify_one();
+            return;
+        }
+
+        record_writer w;
+        log_entry e;
+        w.set(key, v, e);
+        append(w);
+        index_write(SET_RECORD, key, e);
+    }
+
+    void disk_log::set(const dict& d)
+    {
+        store_batch b;
+        for(const auto& p : d) b[p.first].v = p.second;
+        apply(b);
+    }
+
+    bool disk_log::remove(const std::string& key)
+    {
+        lock l(_mutex);
+        INVARIANT_FALSE(_dir.empty());
+
+        if(_write_behind) return behind_remove(key);
+        if(!_index.count(key)) return false;
+
+        record_writer w;
+        log_entry e;
+        w.remove(key, e);
+        append(w);
+        index_write(REMOVE_RECORD, key, e);
         return true;
     }
 
-    using key_set = std::set<std::string>;
+    void disk_log::apply(const store_batch& b)
+    {
+        if(b.empty()) return;
 
-    void disk_store::clear()
+        lock l(_mutex);
+        INVARIANT_FALSE(_dir.empty());
+
+        //the write behind buffer is drained as one record, so the
+        //batch still lands together
+        if(_write_behind) 
+        {
+            for(const auto& p : b)
+                if(p.second.removed) behind_remove(p.first);
+                else behind_set(p.first, p.second.v);
+
+            if(_behind.size() >= WRITE_BEHIND_SIZE) _wake.notify_one();
+            return;
+        }
+
+        std::vector<log_entry> es(b.size());
+        record_writer w;
+        size_t n = 0;
+        for(const auto& p : b)
+            if(p.second.removed) w.remove(p.first, es[n++]);
+            else w.set(p.first, p.second.v, es[n++]);
+
+        append(w);
+
+        n = 0;
+        for(const auto& p : b)
+            index_write(p.second.removed ? REMOVE_RECORD : SET_RECORD, p.first, es[n++]);
+    }
+
+    void disk_log::clear()
+    {
+        lock l(_mutex);
+        INVARIANT_FALSE(_dir.empty());
+
+        //nothing is live so the log can start over
+        wait_idle(l);
+        _behind.clear();
+        _pending.clear();
+        rewrite(bytes{});
+        _index.clear();
+    }
+
+    void disk_log::export_to(dict& d)
+    {
+        lock l(_mutex);
+
+        for(const auto& p : _index)
+        {
+            value v;
+            if(p.second.offset == BEHIND) find_behind(p.first, v);
+            else read(p.second, v);
+            d[p.first] = v;
+        }
+    }
+
+    void disk_log::write_behind(bool on)
+    {
+        lock l(_mutex);
+        _write_behind = on;
+        if(!on) drain(l, false);
+    }
+
+    void disk_log::sync()
+    {
+        lock l(_mutex);
+
+        drain(l, false);
+        commit();
+    }
+
+    void disk_log::compact()
+    {
+        lock l(_mutex);
+        if(_dir.empty()) return;
+
+        compact_intern(l);
+    }
+
+    bool disk_log::should_compact() const
+    {
+        const auto size = _flushed + _pending.size();
+        return _dead >= MIN_COMPACT_SIZE && _dead * 2 > size;
+    }
+
+    //copies the live values to a new log. the copy is written and
+    //fsynced without the lock, then the records that came in meanwhile
+    //are moved over and the copy replaces the log.
+    void disk_log::compact_intern(lock& l)
+    {
+        REQUIRE_FALSE(_file.empty());
+
+        //values still in memory are written first so the old copies
+        //can be dropped without a window where neither is on disk
+        drain(l, false);
+
+        const auto before = _flushed + _pending.size();
+        write_pending();
+
+        const auto snapshot = _flushed;
+        const auto dead = _dead;
+
+        //copy the live values as they are, no need to decode them
+        bytes out;
+        record_writer w;
+        std::unordered_map<std::string, log_entry> moved;
+        for(const auto& p : _index)
+        {
+            const auto& e = p.second;
+            CHECK_NOT_EQUAL(e.offset, BEHIND);
+
+            const char* v = map(e.offset + e.size) + e.offset;
+            w.set(p.first, v, e.size, moved[p.first]);
+            w.finish(out, 0);
+        }
+
+        _compacting = true;
+        FILE* side = nullptr;
+        try
+        {
+            l.unlock();
+            side = write_side(out);
+            l.lock();
+        }
+        catch(...)
+        {
+            l.lock();
+            _compacting = false;
+            _drained.notify_all();
+            throw;
+        }
+
+        //records written since the snapshot follow the copy as they are
+        write_pending();
+        const auto tail = _flushed - snapshot;
+        if(tail > 0) write_file(side, map(_flushed) + snapshot, tail);
+
+        replace(side, out.size() + tail);
+
+        //update entries in place so iterators into the index stay good
+        for(auto& p : _index)
+        {
+            auto& e = p.second;
+            if(e.offset == BEHIND) continue;
+
+            if(e.offset >= snapshot) e.offset = e.offset - snapshot + out.size();
+            else e = moved[p.first];
+        }
+
+        //only what died since the snapshot is dead in the copy
+        _dead -= dead;
+        if(tail > 0) _dirty = true;
+
+        _compacting = false;
+        _drained.notify_all();
+
+        LOG << "compacted store `" << _dir << "' from " << before << " to " << _flushed << " bytes" << std::endl;
+    }
+
+    //replaces the log with the bytes given
+    void disk_log::rewrite(const bytes& b)
+    {
+        REQUIRE(_pending.empty());
+
+        replace(write_side(b), b.size());
+        _dead = 0;
+        _dirty = false;
+    }
+
+    //writes and fsyncs a new log to the side of the current one
+    FILE* disk_log::write_side(const bytes& b)
+    {
+        REQUIRE_FALSE(_file.empty());
+
+        const auto tmp = _file + TMP_SUFFIX;
+        auto f = std::fopen(tmp.c_str(), "wb");
+        if(!f) throw std::runtime_error{"unable to open `" + tmp + "'"};
+
+        write_file(f, b.data(), b.size());
+        sync_file(f);
+
+        ENSURE(f);
+        return f;
+    }
+
+    //moves the side log over the current one
+    void disk_log::replace(FILE* side, uint64_t size)
+    {
+        REQUIRE(side);
+        REQUIRE_FALSE(_file.empty());
+
+        std::fclose(side);
+
+        //the old log has to be closed before it can be replaced on some systems
+        unmap();
+        mutex_scoped_lock s(_sync_mutex);
+        const bool was_open = _out;
+        if(_out) std::fclose(_out);
+        _out = nullptr;
+
+        bf::rename(_file + TMP_SUFFIX, _file);
+        if(was_open) _out = open_append(_file);
+
+        _flushed = size;
+    }
+
+    void disk_log::commit_thread()
+    try
+    {
+        lock l(_mutex);
+        while(!_done)
+        {
+            if(!_dirty && _behind.empty()) 
+            {
+                _wake.wait(l);
+                continue;
+            }
+
+            //let more writes come in so they share the fsync
+            _wake.wait_for(l, std::chrono::milliseconds(COMMIT_INTERVAL), 
+                    [this]() { return _done || _behind.size() >= WRITE_BEHIND_SIZE; });
+            if(_done) break;
+
+            drain(l, true);
+            write_pending();
+
+            //fsync without the store lock so readers and writers never
+            //wait on the disk. the sync lock keeps the file open and
+            //makes commit wait for the fsync. writes that come in
+            //meanwhile set _dirty again.
+            if(_dirty && _out)
+            {
+                _dirty = false;
+                lock s(_sync_mutex);
+                auto out = _out;
+                l.unlock();
+                sync_file(out);
+                s.unlock();
+                l.lock();
+            }
+
+            if(should_compact()) compact_intern(l);
+        }
+    }
+    catch(std::exception& e)
+    {
+        LOG << "error in store commit thread: " << e.what() << std::endl;
+    }
+    catch(...)
+    {
+        LOG << "unexpected error in store commit thread." << std::endl;
+    }
+
+    const log_index& disk_log::index() const
+    {
+        return _index;
+    }
+
+    disk_store::disk_store() : _log{std::make_shared<disk_log>()}
+    {
+        ENSURE(_log);
+    }
+
+    disk_store::disk_store(const std::string& path) : _log{std::make_shared<disk_log>()}
+    {
+        REQUIRE_FALSE(path.empty());
+
+        load(path);
+
+        ENSURE(_log);
+    }
+
+    disk_store::disk_store(const disk_store& o) : _log{o._log}
+    {
+        ENSURE(_log);
+    }
+
+    disk_store& disk_store::operator=(const disk_store& o)
+    {
+        REQUIRE(o._log);
+
+        _log = o._log;
+
+        ENSURE(_log);
+        return *this;
+    }
+
+    void disk_store::load(const std::string& path) 
+    {
+        INVARIANT(_log);
+        REQUIRE_FALSE(path.empty());
+
+        _log->open(path);
+    }
+
+    bool disk_store::loaded() const
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        INVARIANT(_log);
+        return _log->is_open();
+    }
+
+    value disk_store::get(const std::string& key) const
+    {
+        INVARIANT(_log);
+
+        value v;
+        _log->get(key, v);
+        return v;
+    }
 
-        key_set keys;
-        std::transform(
-                _index->begin(), _index->end(),
-                std::inserter(keys, keys.end()),
-                [](const auto& p ) 
-                { 
-                    return p.first;
-                });
+    bool disk_store::has(const std::string& key) const
+    {
+        INVARIANT(_log);
+        return _log->has(key);
+    }
 
-        for(const auto& k : keys)
-            remove_intern(k);
+    void disk_store::set(const std::string& key, const value& v)
+    {
+        INVARIANT(_log);
+        _log->set(key, v);
+    }
+
+    bool disk_store::remove(const std::string& key)
+    {
+        INVARIANT(_log);
+        return _log->remove(key);
+    }
+
+    void disk_store::clear()
+    {
+        INVARIANT(_log);
+        _log->clear();
     }
 
     disk_store::const_iterator disk_store::begin() const
     {
-        INVARIANT(_index);
-        return _index->begin();
+        INVARIANT(_log);
+        return _log->index().begin();
     }
 
     disk_store::const_iterator disk_store::end() const
     {
-        INVARIANT(_index);
-        return _index->end();
+        INVARIANT(_log);
+        return _log->index().end();
     }
 
     size_t disk_store::size() const
     {
-        INVARIANT(_index);
-        return _index->size();
+        INVARIANT(_log);
+        return _log->index().size();
     }
 
-    void disk_store::save_index()
+    void disk_store::import_from(const dict& d)
     {
-        INVARIANT_FALSE(_path.empty());
-        save_to_file(get_index_file(_path), *_index);
+        INVARIANT(_log);
+        _log->set(d);
     }
 
-    void disk_store::import_from(const dict& d)
+    void disk_store::export_to(dict& d) const
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        INVARIANT(_log);
+        _log->export_to(d);
+    }
 
-        for(const auto& p : d)
-            set_intern(p.first, p.second);
+    void disk_store::apply(const store_batch& b)
+    {
+        INVARIANT(_log);
+        _log->apply(b);
+    }
 
-        save_index();
+    void disk_store::write_behind(bool on)
+    {
+        INVARIANT(_log);
+        _log->write_behind(on);
     }
 
-    void disk_store::export_to(dict& d) const
+    void disk_store::sync()
     {
-        INVARIANT(_index);
-        INVARIANT(_mutex);
-        mutex_scoped_lock l(*_mutex);
+        INVARIANT(_log);
+        _log->sync();
+    }
 
-        for(const auto& p : *_index)
-        {
-            value v;
-            get_value(p.first, v);
-            d[p.first]  = v;
-        }
+    void disk_store::compact()
+    {
+        INVARIANT(_log);
+        _log->compact();
     }
 }
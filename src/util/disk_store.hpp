@@ -32,10 +32,36 @@
 #pragma once
 
 #include "util/mencode.hpp"
-#include "util/thread.hpp"
+
+#include <map>
+#include <memory>
 
 namespace fire::util
 {
+    //where a key's value sits in the log
+    struct log_entry
+    {
+        uint64_t offset; //of the encoded value
+        uint64_t size; //of the encoded value
+        uint64_t record; //size of the whole record
+    };
+    using log_index = std::map<std::string, log_entry>;
+
+    //a set, or a remove when removed is true
+    struct store_write
+    {
+        value v;
+        bool removed = false;
+    };
+    using store_batch = std::map<std::string, store_write>;
+
+    class disk_log;
+    using disk_log_ptr = std::shared_ptr<disk_log>;
+
+    /**
+     * Key value store kept in an append only log with the index of
+     * where each value lives kept in memory. Copies share the same log.
+     */
     class disk_store
     {
         public:
@@ -57,21 +83,28 @@ namespace fire::util
             bool remove(const std::string& key);
             void clear();
 
-            using const_iterator = dict::const_iterator;
+            //applies the writes together, after a crash either all
+            //of them are there or none are
+            void apply(const store_batch&);
+
+            using const_iterator = log_index::const_iterator;
             const_iterator begin() const;
             const_iterator end() const;
             size_t size() const;
 
-        private:
-            void save_index();
-            void set_intern(const std::string& key, const value&);
-            void get_value(const std::string& key, value&) const;
-            bool remove_intern(const std::string& key);
+        public:
+            //sets and removes only go into memory and are written by a
+            //background thread. reads still see them right away.
+            void write_behind(bool);
+
+            //writes and fsyncs everything set so far
+            void sync();
+
+            //rewrites the log with only the live values
+            void compact();
 
         private:
-            std::string _path;
-            dict_ptr _index;
-            mutable mutex_ptr _mutex;
+            disk_log_ptr _log;
     };
 
 }
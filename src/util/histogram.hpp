@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+
+namespace fire::util
+{
+    //counts latency samples in power of two buckets of microseconds.
+    //bucket i holds samples under 2^(i+1) microseconds. safe to add
+    //to from many threads.
+    class histogram
+    {
+        public:
+            static const size_t BUCKETS = 32;
+
+        public:
+            void add(double micros)
+            {
+                const auto us = micros < 0 ? 0 : static_cast<size_t>(micros);
+                size_t b = 0;
+                while(b + 1 < BUCKETS && (us >> (b + 1)) > 0) b++;
+
+                _buckets[b].fetch_add(1, std::memory_order_relaxed);
+                _count.fetch_add(1, std::memory_order_relaxed);
+                _total.fetch_add(us, std::memory_order_relaxed);
+
+                auto m = _max.load(std::memory_order_relaxed);
+                while(us > m && !_max.compare_exchange_weak(m, us, std::memory_order_relaxed));
+            }
+
+            size_t count() const { return _count.load(std::memory_order_relaxed); }
+            size_t max() const { return _max.load(std::memory_order_relaxed); }
+            size_t bucket(size_t b) const { return _buckets.at(b).load(std::memory_order_relaxed); }
+
+            double mean() const
+            {
+                const auto c = count();
+                return c == 0 ? 0 : static_cast<double>(_total.load(std::memory_order_relaxed)) / c;
+            }
+
+            //upper bound in microseconds of the bucket holding the p'th
+            //fraction of samples
+            size_t percentile(double p) const
+            {
+                const auto c = count();
+                if(c == 0) return 0;
+
+                const auto want = static_cast<size_t>(std::ceil(p * c));
+                size_t seen = 0;
+                for(size_t b = 0; b < BUCKETS; b++)
+                {
+                    seen += bucket(b);
+                    if(seen >= want) return size_t{2} << b;
+                }
+                return max();
+            }
+
+            void reset()
+            {
+                for(auto& b : _buckets) b.store(0, std::memory_order_relaxed);
+                _count.store(0, std::memory_order_relaxed);
+                _total.store(0, std::memory_order_relaxed);
+                _max.store(0, std::memory_order_relaxed);
+            }
+
+        private:
+            std::array<std::atomic<size_t>, BUCKETS> _buckets{};
+            std::atomic<size_t> _count{0};
+            std::atomic<size_t> _total{0}; //in microseconds
+            std::atomic<size_t> _max{0}; //in microseconds
+    };
+}
@@ -35,10 +35,14 @@
 #include <memory>
 
 #include "util/queue.hpp"
+#include "util/ring_queue.hpp"
+#include "util/watermark.hpp"
 
 namespace fire::util
 {
-    template<class letter>
+    //queue_type can be mpsc_queue when each box has one reader.
+    //the outbox is unbounded unless given watermarks.
+    template<class letter, template<class> class queue_type = queue>
         class mailbox
         {
             public:
@@ -51,19 +55,36 @@ namespace fire::util
                 void address(const std::string& a) { _address = a; }
 
                 void push_inbox(const letter& l) { _in.push(l); }
+                void push_inbox(letter&& l) { _in.emplace_push(l); }
                 bool pop_inbox(letter& l, bool wait = false) { return _in.pop(l, wait); }
 
-                void push_outbox(const letter& l) { _out.push(l); }
-                bool pop_outbox(letter& l, bool wait = false) { return _out.pop(l, wait); }
+                push_result push_outbox(const letter& l) 
+                { 
+                    const auto r = _out_room.add(1);
+                    if(r != push_result::rejected) _out.push(l); 
+                    return r;
+                }
+
+                bool pop_outbox(letter& l, bool wait = false) 
+                { 
+                    const bool p = _out.pop(l, wait); 
+                    if(p) _out_room.remove(1);
+                    return p;
+                }
+
+                void notify_outbox(event_ptr e) { _out.notify(e); }
+                void out_limits(const watermarks& w) { _out_room.limits(w); }
+                const occupancy& out_occupancy() const { return _out_room; }
 
                 size_t in_size() const { return _in.size(); }
                 size_t out_size() const { return _out.size(); }
 
-                void done() { _in.done(); _out.done(); }
+                void done() { _in.done(); _out.done(); _out_room.done(); }
 
             private:
                 std::string _address;
-                queue<letter> _in;
-                queue<letter> _out;
+                queue_type<letter> _in;
+                queue_type<letter> _out;
+                occupancy _out_room;
         };
 }
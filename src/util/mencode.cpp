@@ -32,6 +32,7 @@
 #include "util/mencode.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <boost/lexical_cast.hpp>
 
@@ -46,17 +47,22 @@ namespace fire::util
 
     using boost::lexical_cast;
 
-    value::value() : _v{} {}
-    value::value(bool v) : _v{v} {}
-    value::value(int v) : _v{static_cast<int64_t>(v)} {}
-    value::value(int64_t v) : _v{v} {}
-    value::value(size_t v) : _v{v} {}
-    value::value(double v) : _v{v} {}
-    value::value(const std::string& v) : _v{to_bytes(v)} {}
-    value::value(const bytes& v) : _v{v} {}
-    value::value(const dict& v) : _v{v} {}
-    value::value(const array& v) : _v{v} {}
-    value::value(const value& o) : _v{o._v} {}
+    value::value() : _k{empty_kind} {}
+    value::value(bool v) : _k{bool_kind}, _b{v} {}
+    value::value(int v) : _k{int_kind}, _i{v} {}
+    value::value(int64_t v) : _k{int_kind}, _i{v} {}
+    value::value(size_t v) : _k{size_kind}, _s{v} {}
+    value::value(double v) : _k{double_kind}, _d{v} {}
+    value::value(const std::string& v) : _k{bytes_kind}, _p{std::make_shared<bytes>(v.begin(), v.end())} {}
+    value::value(const bytes& v) : _k{bytes_kind}, _p{std::make_shared<bytes>(v)} {}
+    value::value(const dict& v) : _k{dict_kind}, _p{std::make_shared<dict>(v)} {}
+    value::value(const array& v) : _k{array_kind}, _p{std::make_shared<array>(v)} {}
+    value::value(bytes&& v) : _k{bytes_kind}, _p{std::make_shared<bytes>(std::move(v))} {}
+    value::value(dict&& v) : _k{dict_kind}, _p{std::make_shared<dict>(std::move(v))} {}
+    value::value(array&& v) : _k{array_kind}, _p{std::make_shared<array>(std::move(v))} {}
+    value::value(const value& o) : _k{empty_kind} { copy(o); }
+    value::value(value&& o) noexcept : _k{empty_kind} { take(o); }
+    value::~value() { clear(); }
 
     value::operator bool() const { return as_bool();}
     value::operator int() const { return static_cast<int>(as_int());}
@@ -68,131 +74,193 @@ namespace fire::util
     value::operator dict() const { return as_dict();}
     value::operator array() const { return as_array();}
 
-    value& value::operator=(bool v) { _v = v; return *this;}
-    value& value::operator=(int v) { _v = static_cast<int64_t>(v); return *this;}
-    value& value::operator=(int64_t v) { _v = v; return *this;}
-    value& value::operator=(size_t v) { _v = v; return *this;}
-    value& value::operator=(double v) { _v = v; return *this;}
-    value& value::operator=(const std::string& v) { _v = to_bytes(v); return *this;}
-    value& value::operator=(const bytes& v) { _v = v; return *this;}
-    value& value::operator=(const dict& v) { _v = v; return *this;}
-    value& value::operator=(const array& v) { _v = v; return *this;}
+    value& value::operator=(bool v) { clear(); _k = bool_kind; _b = v; return *this;}
+    value& value::operator=(int v) { clear(); _k = int_kind; _i = v; return *this;}
+    value& value::operator=(int64_t v) { clear(); _k = int_kind; _i = v; return *this;}
+    value& value::operator=(size_t v) { clear(); _k = size_kind; _s = v; return *this;}
+    value& value::operator=(double v) { clear(); _k = double_kind; _d = v; return *this;}
+
+    //the new storage is made before the old is released since v
+    //may live inside this value
+    value& value::operator=(const std::string& v) { set(bytes_kind, std::make_shared<bytes>(v.begin(), v.end())); return *this;}
+    value& value::operator=(const bytes& v) { set(bytes_kind, std::make_shared<bytes>(v)); return *this;}
+    value& value::operator=(const dict& v) { set(dict_kind, std::make_shared<dict>(v)); return *this;}
+    value& value::operator=(const array& v) { set(array_kind, std::make_shared<array>(v)); return *this;}
+    value& value::operator=(bytes&& v) { set(bytes_kind, std::make_shared<bytes>(std::move(v))); return *this;}
+    value& value::operator=(dict&& v) { set(dict_kind, std::make_shared<dict>(std::move(v))); return *this;}
+    value& value::operator=(array&& v) { set(array_kind, std::make_shared<array>(std::move(v))); return *this;}
 
     value& value::operator=(const value& o) 
     { 
         if(&o == this) return *this;
-        _v = o._v; 
+
+        value t{o};
+        clear();
+        take(t);
         return *this;
     }
 
-    bool value::as_bool() const 
-    try
+    value& value::operator=(value&& o) noexcept
     { 
-        return boost::any_cast<bool>(_v); 
+        if(&o == this) return *this;
+
+        value t{std::move(o)};
+        clear();
+        take(t);
+        return *this;
     }
-    catch (...)
+
+    void value::set(kind k, std::shared_ptr<void> p)
     {
-        throw std::runtime_error("value is not an boolean");
+        REQUIRE_GREATER_EQUAL(k, bytes_kind);
+        REQUIRE(p);
+
+        clear();
+        new (&_p) std::shared_ptr<void>{std::move(p)};
+        _k = k;
     }
 
-    int64_t value::as_int() const 
-    try
-    { 
-        return boost::any_cast<int64_t>(_v); 
+    void value::clear()
+    {
+        if(shared()) _p.~shared_ptr();
+        _k = empty_kind;
+        _unshared = false;
     }
-    catch (...)
+
+    void value::copy(const value& o)
     {
-        throw std::runtime_error("value is not an integer");
+        REQUIRE_EQUAL(_k, empty_kind);
+
+        switch(o._k)
+        {
+            case empty_kind: break;
+            case bool_kind: _b = o._b; break;
+            case int_kind: _i = o._i; break;
+            case size_kind: _s = o._s; break;
+            case double_kind: _d = o._d; break;
+            default:
+                if(o._unshared) deep_copy(o);
+                else new (&_p) std::shared_ptr<void>{o._p};
+                break;
+        }
+        _k = o._k;
     }
 
-    size_t value::as_size() const 
-    try
-    { 
-        return boost::any_cast<size_t>(_v); 
+    void value::deep_copy(const value& o)
+    {
+        switch(o._k)
+        {
+            case bytes_kind: new (&_p) std::shared_ptr<void>{std::make_shared<bytes>(*static_cast<const bytes*>(o._p.get()))}; break;
+            case dict_kind: new (&_p) std::shared_ptr<void>{std::make_shared<dict>(*static_cast<const dict*>(o._p.get()))}; break;
+            case array_kind: new (&_p) std::shared_ptr<void>{std::make_shared<array>(*static_cast<const array*>(o._p.get()))}; break;
+            default: CHECK(false && "missed case");
+        }
     }
-    catch (...)
+
+    void value::take(value& o)
     {
-        throw std::runtime_error("value is not an size type");
+        REQUIRE_EQUAL(_k, empty_kind);
+
+        if(!o.shared()) 
+        {
+            copy(o);
+            return;
+        }
+
+        //references into the contents move with them
+        new (&_p) std::shared_ptr<void>{std::move(o._p)};
+        _k = o._k;
+        _unshared = o._unshared;
+        o.clear();
     }
 
-    double value::as_double() const 
-    try
-    { 
-        return boost::any_cast<double>(_v); 
+    //copies shared storage before a write through this value
+    void value::detach()
+    {
+        REQUIRE(shared());
+        if(_p.use_count() == 1) return;
+
+        switch(_k)
+        {
+            case bytes_kind: _p = std::make_shared<bytes>(*static_cast<const bytes*>(_p.get())); break;
+            case dict_kind: _p = std::make_shared<dict>(*static_cast<const dict*>(_p.get())); break;
+            case array_kind: _p = std::make_shared<array>(*static_cast<const array*>(_p.get())); break;
+            default: CHECK(false && "missed case");
+        }
     }
-    catch (...)
+
+    bool value::as_bool() const 
     {
-        throw std::runtime_error("value is not an real");
+        if(_k != bool_kind) throw std::runtime_error("value is not an boolean");
+        return _b;
     }
 
-    std::string value::as_string() const
-    try
-    { 
-        return to_str(boost::any_cast<const bytes&>(_v)); 
+    int64_t value::as_int() const 
+    {
+        if(_k != int_kind) throw std::runtime_error("value is not an integer");
+        return _i;
     }
-    catch (...)
+
+    size_t value::as_size() const 
     {
-        throw std::runtime_error("value is not a string");
+        if(_k != size_kind) throw std::runtime_error("value is not an size type");
+        return _s;
     }
 
-    const bytes& value::as_bytes() const 
-    try
-    { 
-        return boost::any_cast<const bytes&>(_v); 
+    double value::as_double() const 
+    {
+        if(_k != double_kind) throw std::runtime_error("value is not an real");
+        return _d;
     }
-    catch (...)
+
+    std::string value::as_string() const
     {
-        throw std::runtime_error("value is not a byte array");
+        if(_k != bytes_kind) throw std::runtime_error("value is not a string");
+        return to_str(*static_cast<const bytes*>(_p.get()));
     }
 
-    const dict& value::as_dict() const 
-    try
-    { 
-        return boost::any_cast<const dict&>(_v); 
+    const bytes& value::as_bytes() const 
+    {
+        if(_k != bytes_kind) throw std::runtime_error("value is not a byte array");
+        return *static_cast<const bytes*>(_p.get());
     }
-    catch (...)
+
+    const dict& value::as_dict() const 
     {
-        throw std::runtime_error("value is not an dictionary");
+        if(_k != dict_kind) throw std::runtime_error("value is not an dictionary");
+        return *static_cast<const dict*>(_p.get());
     }
 
     const array& value::as_array() const 
-    try
-    { 
-        return boost::any_cast<const array&>(_v); 
-    }
-    catch (...)
     {
-        throw std::runtime_error("value is not an array");
+        if(_k != array_kind) throw std::runtime_error("value is not an array");
+        return *static_cast<const array*>(_p.get());
     }
 
     dict& value::as_dict() 
-    try
-    { 
-        return boost::any_cast<dict&>(_v); 
-    }
-    catch (...)
     {
-        throw std::runtime_error("value is not an dictionary");
+        if(_k != dict_kind) throw std::runtime_error("value is not an dictionary");
+        detach();
+        _unshared = true;
+        return *static_cast<dict*>(_p.get());
     }
 
     array& value::as_array() 
-    try
-    { 
-        return boost::any_cast<array&>(_v); 
-    }
-    catch (...)
     {
-        throw std::runtime_error("value is not an array");
+        if(_k != array_kind) throw std::runtime_error("value is not an array");
+        detach();
+        _unshared = true;
+        return *static_cast<array*>(_p.get());
     }
 
-    bool value::is_bool() const { return _v.type() == typeid(bool);}
-    bool value::is_int() const { return _v.type() == typeid(int64_t);}
-    bool value::is_size() const { return _v.type() == typeid(size_t);}
-    bool value::is_double() const { return _v.type() == typeid(double);}
-    bool value::is_bytes() const { return _v.type() == typeid(bytes);}
-    bool value::is_dict() const { return _v.type() == typeid(dict);}
-    bool value::is_array() const { return _v.type() == typeid(array);}
-    bool value::empty() const { return _v.empty();}
+    bool value::is_bool() const { return _k == bool_kind;}
+    bool value::is_int() const { return _k == int_kind;}
+    bool value::is_size() const { return _k == size_kind;}
+    bool value::is_double() const { return _k == double_kind;}
+    bool value::is_bytes() const { return _k == bytes_kind;}
+    bool value::is_dict() const { return _k == dict_kind;}
+    bool value::is_array() const { return _k == array_kind;}
+    bool value::empty() const { return _k == empty_kind;}
 
     dict::dict() : _m{} {}
     dict::dict(std::initializer_list<kv> s)
@@ -265,6 +333,7 @@ namespace fire::util
     array::iterator array::end() { return _a.end(); }
 
     void array::add(const value& v) { _a.push_back(v); }
+    void array::add(value&& v) { _a.push_back(std::move(v)); }
     void array::resize(size_t size) { _a.resize(size); }
     void array::reserve(size_t size) { _a.reserve(size); }
 
@@ -315,15 +384,18 @@ namespace fire::util
 
     void encode(std::ostream& o, const value& v)
     {
-        if(v.empty()) encode_empty(o);
-        else if(v.is_bool()) encode(o, v.as_bool());
-        else if(v.is_int()) encode(o, v.as_int());
-        else if(v.is_size()) encode(o, v.as_size());
-        else if(v.is_double()) encode(o, v.as_double());
-        else if(v.is_bytes()) encode(o, v.as_bytes());
-        else if(v.is_dict()) encode(o, v.as_dict());
-        else if(v.is_array()) encode(o, v.as_array());
-        else CHECK(false && "missed case");
+        switch(v.type())
+        {
+            case value::empty_kind: encode_empty(o); break;
+            case value::bool_kind: encode(o, v.as_bool()); break;
+            case value::int_kind: encode(o, v.as_int()); break;
+            case value::size_kind: encode(o, v.as_size()); break;
+            case value::double_kind: encode(o, v.as_double()); break;
+            case value::bytes_kind: encode(o, v.as_bytes()); break;
+            case value::dict_kind: encode(o, v.as_dict()); break;
+            case value::array_kind: encode(o, v.as_array()); break;
+            default: CHECK(false && "missed case");
+        }
     }
 
     std::ostream& operator<<(std::ostream& o, const dict& v)
@@ -594,6 +666,268 @@ namespace fire::util
     }
 }
 
+namespace fire::util
+{
+    namespace
+    {
+        //value tags of the binary encoding
+        enum binary_tag : char
+        {
+            B_EMPTY = 'n',
+            B_FALSE = 'F',
+            B_TRUE = 'T',
+            B_INT = 'i',
+            B_SIZE = 's',
+            B_REAL = 'r',
+            B_BYTES = 'b',
+            B_DICT = 'd',
+            B_ARRAY = 'a'
+        };
+
+        const size_t MAX_VARINT_BYTES = 10;
+    }
+
+    void byte_writer::varint(uint64_t v)
+    {
+        while(v >= 0x80)
+        {
+            _b.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        _b.push_back(static_cast<char>(v));
+    }
+
+    void byte_writer::real(double v)
+    {
+        static_assert(sizeof(double) == sizeof(uint64_t), "expected 64 bit doubles");
+
+        //little endian ieee 754
+        uint64_t u;
+        std::memcpy(&u, &v, sizeof(u));
+        for(size_t i = 0; i < sizeof(u); i++) _b.push_back(static_cast<char>((u >> (i * 8)) & 0xFF));
+    }
+
+    void byte_reader::need(size_t n) const
+    {
+        if(static_cast<size_t>(_e - _p) >= n) return;
+
+        std::stringstream e;
+        e << "unexpected end of buffer at byte " << offset();
+        throw std::runtime_error{e.str()};
+    }
+
+    uint64_t byte_reader::varint()
+    {
+        uint64_t v = 0;
+        for(size_t i = 0; i < MAX_VARINT_BYTES; i++)
+        {
+            const auto c = static_cast<unsigned char>(get());
+            v |= static_cast<uint64_t>(c & 0x7F) << (i * 7);
+            if(!(c & 0x80)) return v;
+        }
+
+        std::stringstream e;
+        e << "varint too long at byte " << offset();
+        throw std::runtime_error{e.str()};
+    }
+
+    double byte_reader::real()
+    {
+        const auto p = reinterpret_cast<const unsigned char*>(raw(sizeof(uint64_t)));
+
+        uint64_t u = 0;
+        for(size_t i = 0; i < sizeof(u); i++) u |= static_cast<uint64_t>(p[i]) << (i * 8);
+
+        double v;
+        std::memcpy(&v, &u, sizeof(v));
+        return v;
+    }
+
+    //zigzag so small negative numbers stay small
+    uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    void encode_binary(byte_writer& w, const bytes& v)
+    {
+        w.put(B_BYTES);
+        w.varint(v.size());
+        w.raw(v.data(), v.size());
+    }
+
+    void encode_binary(byte_writer& w, const std::string& v)
+    {
+        w.put(B_BYTES);
+        w.varint(v.size());
+        w.raw(v.data(), v.size());
+    }
+
+    void encode_binary(byte_writer& w, const dict& v)
+    {
+        w.put(B_DICT);
+        w.varint(v.size());
+        for(const auto& p : v)
+        {
+            w.varint(p.first.size());
+            w.raw(p.first.data(), p.first.size());
+            encode_binary(w, p.second);
+        }
+    }
+
+    void encode_binary_array_size(byte_writer& w, size_t size)
+    {
+        w.put(B_ARRAY);
+        w.varint(size);
+    }
+
+    void encode_binary(byte_writer& w, const array& v)
+    {
+        encode_binary_array_size(w, v.size());
+        for(const auto& e : v) encode_binary(w, e);
+    }
+
+    void encode_binary(byte_writer& w, const value& v)
+    {
+        switch(v.type())
+        {
+            case value::empty_kind: w.put(B_EMPTY); break;
+            case value::bool_kind: w.put(v.as_bool() ? B_TRUE : B_FALSE); break;
+            case value::int_kind: w.put(B_INT); w.varint(zigzag(v.as_int())); break;
+            case value::size_kind: w.put(B_SIZE); w.varint(v.as_size()); break;
+            case value::double_kind: w.put(B_REAL); w.real(v.as_double()); break;
+            case value::bytes_kind: encode_binary(w, v.as_bytes()); break;
+            case value::dict_kind: encode_binary(w, v.as_dict()); break;
+            case value::array_kind: encode_binary(w, v.as_array()); break;
+            default: CHECK(false && "missed case");
+        }
+    }
+
+    void expect_tag(byte_reader& r, char tag, const std::string& type)
+    {
+        const auto offset = r.offset();
+        if(r.get() == tag) return;
+
+        std::stringstream e;
+        e << "expected " << type << " at byte " << offset;
+        throw std::runtime_error{e.str()};
+    }
+
+    size_t decode_binary_bytes_size(byte_reader& r)
+    {
+        expect_tag(r, B_BYTES, "byte string");
+        return r.varint();
+    }
+
+    void decode_binary(byte_reader& r, bytes& v)
+    {
+        const auto size = decode_binary_bytes_size(r);
+        const auto p = r.raw(size);
+        v.assign(p, p + size);
+    }
+
+    void decode_binary(byte_reader& r, std::string& v)
+    {
+        const auto size = decode_binary_bytes_size(r);
+        v.assign(r.raw(size), size);
+    }
+
+    void decode_binary(byte_reader& r, dict& v)
+    {
+        expect_tag(r, B_DICT, "dictionary");
+        auto size = r.varint();
+
+        std::string k;
+        while(size--)
+        {
+            const auto ks = r.varint();
+            k.assign(r.raw(ks), ks);
+            decode_binary(r, v[k]);
+        }
+    }
+
+    size_t decode_binary_array_size(byte_reader& r)
+    {
+        expect_tag(r, B_ARRAY, "array");
+        return r.varint();
+    }
+
+    void decode_binary(byte_reader& r, array& v)
+    {
+        const auto size = decode_binary_array_size(r);
+
+        //each value is at least a byte, so a bad size cannot reserve much
+        v.resize(0);
+        v.reserve(std::min<uint64_t>(size, r.remaining()));
+        for(uint64_t i = 0; i < size; i++)
+        {
+            value e;
+            decode_binary(r, e);
+            v.add(std::move(e));
+        }
+    }
+
+    void decode_binary(byte_reader& r, value& v)
+    {
+        const auto offset = r.offset();
+        switch(r.peek())
+        {
+            case B_EMPTY: r.get(); v = value{}; break;
+            case B_FALSE: r.get(); v = false; break;
+            case B_TRUE: r.get(); v = true; break;
+            case B_INT: r.get(); v = unzigzag(r.varint()); break;
+            case B_SIZE: r.get(); v = static_cast<size_t>(r.varint()); break;
+            case B_REAL: r.get(); v = r.real(); break;
+            case B_BYTES: { bytes b; decode_binary(r, b); v = std::move(b); break; }
+            case B_DICT: { dict d; decode_binary(r, d); v = std::move(d); break; }
+            case B_ARRAY: { array a; decode_binary(r, a); v = std::move(a); break; }
+            default:
+                {
+                    std::stringstream e;
+                    e << "unexpected value type `" << r.peek() << "' at byte " << offset;
+                    throw std::runtime_error{e.str()};
+                }
+        }
+    }
+
+    void skip_binary(byte_reader& r)
+    {
+        const auto offset = r.offset();
+        switch(r.get())
+        {
+            case B_EMPTY: case B_FALSE: case B_TRUE: break;
+            case B_INT: case B_SIZE: r.varint(); break;
+            case B_REAL: r.real(); break;
+            case B_BYTES: r.raw(r.varint()); break;
+            case B_DICT: 
+                {
+                    auto size = r.varint();
+                    while(size--)
+                    {
+                        r.raw(r.varint());
+                        skip_binary(r);
+                    }
+                    break;
+                }
+            case B_ARRAY: 
+                {
+                    auto size = r.varint();
+                    while(size--) skip_binary(r);
+                    break;
+                }
+            default:
+                {
+                    std::stringstream e;
+                    e << "unexpected value type at byte " << offset;
+                    throw std::runtime_error{e.str()};
+                }
+        }
+    }
+
+    bool is_binary(const bytes& b)
+    {
+        return !b.empty() && b.front() == BINARY_MENCODE;
+    }
+}
+
 namespace std
 {
     std::ostream& operator<<(std::ostream& o, const fire::util::bytes& v)
@@ -38,8 +38,6 @@
 #include <sstream>
 #include <memory>
 
-#include <boost/any.hpp>
-
 #include "util/bytes.hpp"
 #include "util/dbc.hpp"
 
@@ -48,8 +46,26 @@ namespace fire::util
     class dict;
     class array;
 
+    //scalars are stored inline. bytes, dicts and arrays are shared between
+    //copies and copied on the first write through a shared value. once a
+    //writable dict or array reference is handed out the value stops
+    //sharing, copies of it copy the contents so writes through an old
+    //reference never reach them.
     class value
     {
+        public:
+            enum kind : char
+            {
+                empty_kind,
+                bool_kind,
+                int_kind,
+                size_kind,
+                double_kind,
+                bytes_kind,
+                dict_kind,
+                array_kind
+            };
+
         public:
             value();
             value(bool v);
@@ -61,7 +77,12 @@ namespace fire::util
             value(const bytes& v);
             value(const dict& v);
             value(const array& v);
+            value(bytes&& v);
+            value(dict&& v);
+            value(array&& v);
             value(const value& o);
+            value(value&& o) noexcept;
+            ~value();
 
         public:
             operator bool() const;
@@ -84,7 +105,11 @@ namespace fire::util
             value& operator=(const bytes& v);
             value& operator=(const dict& v);
             value& operator=(const array& v);
+            value& operator=(bytes&& v);
+            value& operator=(dict&& v);
+            value& operator=(array&& v);
             value& operator=(const value& o);
+            value& operator=(value&& o) noexcept;
 
         public:
             bool as_bool() const;
@@ -107,9 +132,28 @@ namespace fire::util
             bool is_dict() const;
             bool is_array() const;
             bool empty() const;
+            kind type() const { return _k; }
+
+        private:
+            bool shared() const { return _k >= bytes_kind; }
+            void set(kind, std::shared_ptr<void>);
+            void clear();
+            void copy(const value&);
+            void take(value&);
+            void detach();
+            void deep_copy(const value&);
 
         private:
-            boost::any _v;
+            kind _k;
+            bool _unshared = false; //a writable reference to the contents is out
+            union
+            {
+                bool _b;
+                int64_t _i;
+                size_t _s;
+                double _d;
+                std::shared_ptr<void> _p;
+            };
     };
 
     using kv = std::pair<std::string, value>;
@@ -165,6 +209,7 @@ namespace fire::util
 
         public:
             void add(const value&);
+            void add(value&&);
             void resize(size_t size);
             void reserve(size_t size);
 
@@ -244,6 +289,79 @@ namespace fire::util
             return v;
         }
 
+    //binary mencode, version 2. integers are varints, reals are raw
+    //ieee doubles and strings are length prefixed, all written straight
+    //into a byte buffer. a v2 encoding starts with BINARY_MENCODE, which
+    //never starts a text encoding, so decoders can tell them apart.
+    const char BINARY_MENCODE = '\x02';
+
+    class byte_writer
+    {
+        public:
+            byte_writer(bytes& b) : _b(b) {}
+
+        public:
+            void put(char c) { _b.push_back(c); }
+            void raw(const char* p, size_t n) { _b.insert(_b.end(), p, p + n); }
+            void varint(uint64_t v);
+            void real(double v);
+
+        private:
+            bytes& _b;
+    };
+
+    //reads a v2 encoding in place, throws when it runs past the end
+    class byte_reader
+    {
+        public:
+            byte_reader(const char* b, const char* e) : _b{b}, _p{b}, _e{e} {}
+            byte_reader(const bytes& b) : _b{b.data()}, _p{b.data()}, _e{b.data() + b.size()} {}
+
+        public:
+            char get() { need(1); return *_p++; }
+            char peek() const { need(1); return *_p; }
+            const char* raw(size_t n) { need(n); auto p = _p; _p += n; return p; }
+            uint64_t varint();
+            double real();
+
+        public:
+            bool done() const { return _p == _e; }
+            size_t remaining() const { return _e - _p; }
+            size_t offset() const { return _p - _b; }
+
+        private:
+            void need(size_t n) const;
+
+        private:
+            const char* _b;
+            const char* _p;
+            const char* _e;
+    };
+
+    void encode_binary(byte_writer&, const value&);
+    void encode_binary(byte_writer&, const dict&);
+    void encode_binary(byte_writer&, const array&);
+    void encode_binary(byte_writer&, const bytes&);
+    void encode_binary(byte_writer&, const std::string&);
+
+    void decode_binary(byte_reader&, value&);
+    void decode_binary(byte_reader&, dict&);
+    void decode_binary(byte_reader&, array&);
+    void decode_binary(byte_reader&, bytes&);
+    void decode_binary(byte_reader&, std::string&);
+
+    //starts an array whose elements are written one by one
+    void encode_binary_array_size(byte_writer&, size_t);
+    size_t decode_binary_array_size(byte_reader&);
+
+    //starts a byte string whose bytes can be read in place
+    size_t decode_binary_bytes_size(byte_reader&);
+
+    //steps over one value without decoding it
+    void skip_binary(byte_reader&);
+
+    bool is_binary(const bytes&);
+
     template<class R>
         bool load_from_file(const std::string& f, R& r)
         {
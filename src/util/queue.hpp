@@ -37,6 +37,7 @@
 #include <condition_variable>
 
 #include "util/dbc.hpp"
+#include "util/thread.hpp"
 
 namespace fire::util
 {
@@ -87,6 +88,7 @@ namespace fire::util
                 std::lock_guard<std::mutex> lock(_m);
                 _q.push_back(v);
                 _c.notify_one();
+                if(_event) _event->signal();
 
                 ENSURE_GREATER(_q.size(), 0);
             }
@@ -96,6 +98,7 @@ namespace fire::util
                 std::lock_guard<std::mutex> lock(_m);
                 _q.emplace_back(std::move(v));
                 _c.notify_one();
+                if(_event) _event->signal();
 
                 ENSURE_GREATER(_q.size(), 0);
             }
@@ -105,6 +108,7 @@ namespace fire::util
                 std::lock_guard<std::mutex> lock(_m);
                 _q.emplace_front(std::move(v));
                 _c.notify_one();
+                if(_event) _event->signal();
 
                 ENSURE_GREATER(_q.size(), 0);
             }
@@ -192,10 +196,19 @@ namespace fire::util
                 return _done;
             }
 
+            //also signal e on every push
+            void notify(event_ptr e)
+            {
+                std::lock_guard<std::mutex> lock(_m);
+                _event = e;
+                if(_event && !_q.empty()) _event->signal();
+            }
+
         private:
             std::deque<t> _q;
             mutable std::mutex _m;
             mutable std::condition_variable _c;
             bool _done = false;
+            event_ptr _event;
     };
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2017  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "util/dbc.hpp"
+#include "util/queue.hpp"
+#include "util/thread.hpp"
+
+namespace fire::util
+{
+    enum ring_producers { single_producer, multi_producer };
+
+    const size_t DEFAULT_RING_CAPACITY = 4096; //in items
+    const size_t RING_SPINS = 64; //push or pop attempts before sleeping
+    const size_t RING_ROOM_WAIT = 1; //in milliseconds a full push sleeps before looking again
+
+    //bounded lock free queue with one consumer. each cell has a sequence
+    //number that says whether it is ready to be written or read, so 
+    //producers and the consumer never share a lock. a push to a full ring
+    //and a waiting pop on an empty one sleep on condition variables the
+    //other side only touches when someone is actually sleeping.
+    template<class t, ring_producers producers>
+        class ring_queue : 
+            public in_queue<t>, 
+            public out_queue<t>,
+            public has_size
+    {
+        public:
+            ring_queue(size_t capacity = DEFAULT_RING_CAPACITY)
+            {
+                REQUIRE_GREATER(capacity, 0);
+
+                size_t size = 1;
+                while(size < capacity) size <<= 1;
+
+                _mask = size - 1;
+                _cells.reset(new cell[size]);
+                for(size_t i = 0; i < size; i++) 
+                    _cells[i].seq.store(i, std::memory_order_relaxed);
+
+                ENSURE_GREATER_EQUAL(_mask + 1, capacity);
+            }
+
+            ring_queue(const ring_queue&) = delete;
+            ring_queue& operator=(const ring_queue&) = delete;
+
+            virtual void push(const t& v) 
+            {
+                t c = v;
+                emplace_push(c);
+            }
+
+            //waits for room while the ring is full. once done nobody
+            //makes room anymore, so the item is dropped.
+            virtual void emplace_push(t& v) 
+            {
+                if(try_push(v)) return;
+
+                for(size_t i = 0; i < RING_SPINS; i++)
+                {
+                    if(_done) return;
+                    if(try_push(v)) return;
+                    std::this_thread::yield();
+                }
+
+                bool pushed = false;
+                {
+                    std::unique_lock<std::mutex> lock(_m);
+                    _full_waiters.fetch_add(1);
+
+                    while(!_done && !(pushed = put(v)))
+                        _room.wait_for(lock, std::chrono::milliseconds(RING_ROOM_WAIT));
+
+                    _full_waiters.fetch_sub(1);
+                }
+
+                if(pushed) wake();
+            }
+
+            bool try_push(t& v)
+            {
+                if(!put(v)) return false;
+
+                wake();
+                return true;
+            }
+
+            bool try_pop(t& v)
+            {
+                if(!take(v)) return false;
+
+                made_room();
+                return true;
+            }
+
+            virtual bool pop(t& v, bool wait = false)
+            {
+                if(try_pop(v)) return true;
+                if(!wait) return false;
+
+                for(size_t i = 0; i < RING_SPINS; i++)
+                {
+                    if(_done) return false;
+                    if(try_pop(v)) return true;
+                    std::this_thread::yield();
+                }
+
+                bool got = false;
+                {
+                    std::unique_lock<std::mutex> lock(_m);
+                    _waiters.fetch_add(1);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                    while(!_done && !(got = take(v))) _c.wait(lock);
+
+                    _waiters.fetch_sub(1);
+                }
+
+                if(got) made_room();
+                return got;
+            }
+
+            virtual size_t size() const 
+            { 
+                const auto tail = _tail.load(std::memory_order_acquire);
+                const auto head = _head.load(std::memory_order_acquire);
+                return tail > head ? tail - head : 0;
+            }
+
+            virtual bool empty() const 
+            { 
+                return size() == 0;
+            }
+
+            size_t capacity() const
+            {
+                return _mask + 1;
+            }
+
+            virtual void done()
+            {
+                std::lock_guard<std::mutex> lock(_m);
+                _done = true;
+                _c.notify_all();
+                _room.notify_all();
+            }
+
+            virtual bool is_done() const
+            {
+                return _done;
+            }
+
+            //also signal e on every push. producers may be pushing while
+            //it changes, so they read a plain pointer and every event set
+            //is kept alive until the queue goes away.
+            void notify(event_ptr e)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(_m);
+                    if(e && (_events.empty() || _events.back() != e)) _events.push_back(e);
+                    _event.store(e.get(), std::memory_order_release);
+                }
+                if(e && !empty()) e->signal();
+            }
+
+        private:
+            //claims a free cell without waking anyone, so it can be
+            //called with _m held
+            bool put(t& v)
+            {
+                cell* c = nullptr;
+                size_t pos = _tail.load(std::memory_order_relaxed);
+                while(true)
+                {
+                    c = &_cells[pos & _mask];
+                    const auto seq = c->seq.load(std::memory_order_acquire);
+                    const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+                    //cell is free, claim it
+                    if(dif == 0)
+                    {
+                        if(producers == single_producer)
+                        {
+                            _tail.store(pos + 1, std::memory_order_relaxed);
+                            break;
+                        }
+                        if(_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    //full
+                    else if(dif < 0) return false;
+                    //another producer got there first
+                    else pos = _tail.load(std::memory_order_relaxed);
+                }
+
+                CHECK(c);
+                c->value = std::move(v);
+                c->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            //frees the head cell without waking anyone, so it can be
+            //called with _m held
+            bool take(t& v)
+            {
+                const auto pos = _head.load(std::memory_order_relaxed);
+                auto& c = _cells[pos & _mask];
+                const auto seq = c.seq.load(std::memory_order_acquire);
+
+                //empty
+                if(seq != pos + 1) return false;
+
+                v = std::move(c.value);
+                c.seq.store(pos + _mask + 1, std::memory_order_release);
+                _head.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            void wake()
+            {
+                auto e = _event.load(std::memory_order_acquire);
+                if(e) e->signal();
+
+                //pairs with the fence in pop so either the sleeper 
+                //sees the item or we see the sleeper
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(_waiters.load(std::memory_order_relaxed) == 0) return;
+
+                std::lock_guard<std::mutex> lock(_m);
+                _c.notify_one();
+            }
+
+            //no fence here so pops stay cheap. a push that misses the
+            //notify looks again after RING_ROOM_WAIT.
+            void made_room()
+            {
+                if(_full_waiters.load(std::memory_order_relaxed) == 0) return;
+
+                std::lock_guard<std::mutex> lock(_m);
+                _room.notify_all();
+            }
+
+        private:
+            struct cell
+            {
+                std::atomic<size_t> seq;
+                t value;
+            };
+
+            std::unique_ptr<cell[]> _cells;
+            size_t _mask = 0;
+
+            //kept on their own cache lines so producers and the 
+            //consumer don't bounce each other's line
+            alignas(64) std::atomic<size_t> _tail{0};
+            alignas(64) std::atomic<size_t> _head{0};
+
+            alignas(64) std::atomic<size_t> _waiters{0};
+            std::atomic<size_t> _full_waiters{0};
+            std::atomic<bool> _done{false};
+            std::mutex _m;
+            std::condition_variable _c;
+            std::condition_variable _room;
+            std::atomic<event*> _event{nullptr};
+            std::vector<event_ptr> _events;
+    };
+
+    template<class t>
+        using spsc_queue = ring_queue<t, single_producer>;
+
+    template<class t>
+        using mpsc_queue = ring_queue<t, multi_producer>;
+}
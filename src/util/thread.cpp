@@ -42,4 +42,31 @@ namespace fire::util
         std::chrono::milliseconds s(ms);
         std::this_thread::sleep_for(s);
     }
+
+    void event::signal()
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        _count++;
+        _c.notify_all();
+    }
+
+    size_t event::count() const
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        return _count;
+    }
+
+    bool event::wait(size_t since)
+    {
+        std::unique_lock<std::mutex> lock(_m);
+        while(_count == since && !_done) _c.wait(lock);
+        return !_done;
+    }
+
+    void event::done()
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        _done = true;
+        _c.notify_all();
+    }
 }
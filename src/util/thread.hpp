@@ -33,6 +33,7 @@
 #include <thread>
 #include <mutex>
 #include <memory>
+#include <condition_variable>
 
 namespace fire::util
 {
@@ -41,4 +42,22 @@ namespace fire::util
     using mutex_ptr = std::shared_ptr<std::mutex>;
 
     void sleep_thread(size_t milliseconds);
+
+    //wakes a thread waiting on more than one source. the waiter takes the
+    //count before checking its sources and waits for it to change.
+    class event
+    {
+        public:
+            void signal();
+            size_t count() const;
+            bool wait(size_t since);
+            void done();
+
+        private:
+            size_t _count = 0;
+            bool _done = false;
+            mutable std::mutex _m;
+            std::condition_variable _c;
+    };
+    using event_ptr = std::shared_ptr<event>;
 }
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2017  Maxim Noah Khailo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give 
+ * permission to link the code of portions of this program with the 
+ * Botan library under certain conditions as described in each 
+ * individual source file, and distribute linked combinations 
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects for 
+ * all of the code used other than Botan. If you modify file(s) with 
+ * this exception, you may extend this exception to your version of the 
+ * file(s), but you are not obligated to do so. If you do not wish to do 
+ * so, delete this exception statement from your version. If you delete 
+ * this exception statement from all source files in the program, then 
+ * also delete it here.
+ */
+
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "util/dbc.hpp"
+
+namespace fire::util
+{
+    //what a bounded queue does with a push while it is over its high watermark
+    enum class overflow 
+    { 
+        block,  //wait until it drains to the low watermark
+        reject, //drop the push
+        signal  //take the push but tell the caller to slow down
+    };
+
+    inline overflow parse_overflow(const std::string& s)
+    {
+        if(s == "reject") return overflow::reject;
+        if(s == "signal") return overflow::signal;
+        return overflow::block;
+    }
+
+    //a queue goes over once it reaches high and stays over until it
+    //drains to low. a high of 0 means unbounded.
+    struct watermarks
+    {
+        size_t high = 0;
+        size_t low = 0;
+        overflow policy = overflow::block;
+    };
+
+    enum class push_result 
+    { 
+        queued,  //under the high watermark
+        over,    //queued but over the high watermark
+        rejected //not queued
+    };
+
+    //counts what sits in a bounded queue, messages or bytes, and applies
+    //its watermarks to pushes
+    class occupancy
+    {
+        public:
+            occupancy(const watermarks& w = watermarks{}) { limits(w); }
+
+        public:
+            push_result add(size_t n)
+            {
+                if(!_bounded.load(std::memory_order_relaxed))
+                {
+                    update_peak(_value.fetch_add(n, std::memory_order_relaxed) + n);
+                    return push_result::queued;
+                }
+
+                std::unique_lock<std::mutex> l(_m);
+                if(_over)
+                {
+                    if(_w.policy == overflow::reject || _done)
+                    {
+                        _rejected++;
+                        return push_result::rejected;
+                    }
+
+                    if(_w.policy == overflow::block)
+                    {
+                        _blocked++;
+                        while(_over && !_done) _drained.wait(l);
+                        if(_done) 
+                        {
+                            _rejected++;
+                            return push_result::rejected;
+                        }
+                    }
+                }
+
+                const auto v = _value.fetch_add(n, std::memory_order_relaxed) + n;
+                update_peak(v);
+                if(v >= _w.high) _over = true;
+                return _over ? push_result::over : push_result::queued;
+            }
+
+            void remove(size_t n)
+            {
+                if(!_bounded.load(std::memory_order_relaxed))
+                {
+                    _value.fetch_sub(n, std::memory_order_relaxed);
+                    return;
+                }
+
+                std::lock_guard<std::mutex> l(_m);
+                const auto v = _value.fetch_sub(n, std::memory_order_relaxed) - n;
+                if(_over && v <= _w.low)
+                {
+                    _over = false;
+                    _drained.notify_all();
+                }
+            }
+
+            //low is kept under high, half of it when not given
+            void limits(const watermarks& w)
+            {
+                std::lock_guard<std::mutex> l(_m);
+                _w = w;
+                if(_w.low >= _w.high) _w.low = _w.high / 2;
+                _bounded.store(_w.high > 0, std::memory_order_relaxed);
+
+                _over = _w.high > 0 && _value.load(std::memory_order_relaxed) >= _w.high;
+                if(!_over) _drained.notify_all();
+
+                ENSURE(_w.high == 0 || _w.low < _w.high);
+            }
+
+            watermarks limits() const
+            {
+                std::lock_guard<std::mutex> l(_m);
+                return _w;
+            }
+
+            //wakes blocked pushes, which are rejected from then on
+            void done()
+            {
+                std::lock_guard<std::mutex> l(_m);
+                _done = true;
+                _drained.notify_all();
+            }
+
+        public:
+            size_t value() const { return _value.load(std::memory_order_relaxed); }
+            size_t peak() const { return _peak.load(std::memory_order_relaxed); }
+            size_t rejected() const { std::lock_guard<std::mutex> l(_m); return _rejected; }
+            size_t blocked() const { std::lock_guard<std::mutex> l(_m); return _blocked; }
+            bool over() const { std::lock_guard<std::mutex> l(_m); return _over; }
+
+        private:
+            void update_peak(size_t v)
+            {
+                auto p = _peak.load(std::memory_order_relaxed);
+                while(v > p && !_peak.compare_exchange_weak(p, v, std::memory_order_relaxed));
+            }
+
+        private:
+            watermarks _w;
+            std::atomic<bool> _bounded{false};
+            std::atomic<size_t> _value{0};
+            std::atomic<size_t> _peak{0};
+            bool _over = false;
+            bool _done = false;
+            size_t _rejected = 0;
+            size_t _blocked = 0;
+            mutable std::mutex _m;
+            std::condition_variable _drained;
+    };
+}